@@ -0,0 +1,431 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "aclstore.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string versionsSuffix = ".d";
+const std::string lockSuffix     = ".lock";
+const std::string newLinkSuffix  = ".new";
+
+/// How long a replaced snapshot is kept for the readers that don't lock it
+const std::time_t keptSeconds = 60;
+
+const mode_t entryPerm = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+
+[[noreturn]] void throwErrno()
+{
+    throw std::system_error(errno, std::system_category());
+}
+
+/// flock(2), retried on signals; false if it would block
+bool lockDirectory(const tbtadm::Directory& dir, int operation)
+{
+    while (::flock(dir.fd(), operation) == -1)
+    {
+        if (errno == EWOULDBLOCK)
+        {
+            return false;
+        }
+        if (errno != EINTR)
+        {
+            throwErrno();
+        }
+    }
+    return true;
+}
+
+bool isVisible(const char* name)
+{
+    return name[0] != '.';
+}
+
+/// Populates the new snapshot with hard links to the files of the current one
+void copySnapshot(const fs::path& from, const fs::path& to)
+{
+    tbtadm::Directory source(from, isVisible);
+    tbtadm::Directory target(to);
+    for (const auto& entry : source)
+    {
+        if (!entry.isDirectory())
+        {
+            continue;
+        }
+        if (::mkdirat(target.fd(), entry.name(), entryPerm) == -1)
+        {
+            throwErrno();
+        }
+
+        tbtadm::Directory sourceEntry(source, entry.name(), isVisible);
+        tbtadm::Directory targetEntry(target, entry.name());
+        for (const auto& file : sourceEntry)
+        {
+            if (::linkat(sourceEntry.fd(),
+                         file.name(),
+                         targetEntry.fd(),
+                         file.name(),
+                         0)
+                == -1)
+            {
+                throwErrno();
+            }
+        }
+
+        // The modification time tells when the entry was last used
+        struct stat st;
+        if (::fstat(sourceEntry.fd(), &st) == -1)
+        {
+            throwErrno();
+        }
+        const struct timespec times[] = {st.st_atim, st.st_mtim};
+        if (::futimens(targetEntry.fd(), times) == -1)
+        {
+            throwErrno();
+        }
+    }
+}
+} // namespace
+
+tbtadm::AclStore::AclStore(fs::path root)
+    : m_root(std::move(root)),
+      m_versions(m_root.string() + versionsSuffix)
+{
+}
+
+std::unique_ptr<tbtadm::Directory> tbtadm::AclStore::open() const
+{
+    for (;;)
+    {
+        std::unique_ptr<Directory> dir;
+        try
+        {
+            dir = std::make_unique<Directory>(
+                m_pending.empty() ? m_root : m_pending, isVisible);
+        }
+        catch (std::system_error& e)
+        {
+            if (e.code().value() != ENOENT)
+            {
+                throw;
+            }
+            return nullptr;
+        }
+        lockDirectory(*dir, LOCK_SH);
+
+        // Removed before the lock was taken; the link points to a newer one
+        struct stat st;
+        if (::fstat(dir->fd(), &st) == -1)
+        {
+            throwErrno();
+        }
+        if (st.st_nlink)
+        {
+            return dir;
+        }
+    }
+}
+
+void tbtadm::AclStore::update(const Change& change, bool copy)
+{
+    if (!m_pending.empty())
+    {
+        m_changed = true;
+        change(m_pending);
+        return;
+    }
+
+    FileLock lock(m_root.string() + lockSuffix);
+    const auto version = prepare(copy);
+    change(m_versions / std::to_string(version));
+    publish(version);
+}
+
+void tbtadm::AclStore::batch(const std::function<void()>& changes)
+{
+    if (!m_pending.empty())
+    {
+        changes();
+        return;
+    }
+
+    FileLock lock(m_root.string() + lockSuffix);
+    const auto version = prepare(true);
+    m_pending          = m_versions / std::to_string(version);
+    m_changed          = false;
+
+    auto finish = [&] {
+        const auto pending = m_pending;
+        m_pending.clear();
+        if (m_changed)
+        {
+            publish(version);
+        }
+        else
+        {
+            fs::remove_all(pending);
+        }
+    };
+    try
+    {
+        changes();
+    }
+    catch (...)
+    {
+        finish();
+        throw;
+    }
+    finish();
+}
+
+unsigned tbtadm::AclStore::prepare(bool copy)
+{
+    const auto version = currentVersion() + 1;
+    const auto dir     = m_versions / std::to_string(version);
+
+    fs::create_directories(m_versions);
+    fs::remove_all(dir); // Leftover of an interrupted update
+    fs::create_directory(dir);
+    fs::permissions(dir, static_cast<fs::perms>(entryPerm));
+
+    if (copy && fs::exists(m_root))
+    {
+        copySnapshot(m_root, dir);
+    }
+    return version;
+}
+
+bool tbtadm::AclStore::add(const std::string& uuid, const Files& files)
+{
+    bool added = false;
+    update([&](const fs::path& snapshot) {
+        auto entry = snapshot / uuid;
+        if (fs::exists(entry))
+        {
+            return;
+        }
+        fs::create_directory(entry);
+        fs::permissions(entry, static_cast<fs::perms>(entryPerm));
+        for (const auto& file : files)
+        {
+            File(entry / file.first, File::Mode::Write, O_CREAT, defaultPerm)
+                .write(file.second);
+        }
+        added = true;
+    });
+    return added;
+}
+
+void tbtadm::AclStore::write(const std::string& uuid,
+                             const std::string& name,
+                             const std::string& content,
+                             int perm)
+{
+    update([&](const fs::path& snapshot) {
+        auto entry = snapshot / uuid;
+        if (!fs::exists(entry))
+        {
+            throw std::system_error(ENOENT, std::system_category());
+        }
+
+        // Keep the entry modification time, it isn't a use of the entry
+        struct stat st;
+        if (::stat(entry.c_str(), &st) == -1)
+        {
+            throwErrno();
+        }
+
+        // The file may be shared with older snapshots
+        fs::remove(entry / name);
+        File(entry / name, File::Mode::Write, O_CREAT, perm).write(content);
+
+        const struct timespec times[] = {st.st_atim, st.st_mtim};
+        if (::utimensat(AT_FDCWD, entry.c_str(), times, 0) == -1)
+        {
+            throwErrno();
+        }
+    });
+}
+
+bool tbtadm::AclStore::erase(const std::string& uuid, const std::string& name)
+{
+    bool erased = false;
+    update([&](const fs::path& snapshot) {
+        erased = fs::remove(snapshot / uuid / name);
+    });
+    return erased;
+}
+
+bool tbtadm::AclStore::remove(const std::string& uuid)
+{
+    bool removed = false;
+    update([&](const fs::path& snapshot) {
+        removed = fs::remove_all(snapshot / uuid) != 0;
+    });
+    return removed;
+}
+
+size_t tbtadm::AclStore::clear()
+{
+    size_t count       = 0;
+    const bool batched = !m_pending.empty();
+    update(
+        [&](const fs::path& snapshot) {
+            // Out of a batch the new snapshot starts empty
+            const auto current = batched ? snapshot : m_root;
+            if (!fs::exists(current))
+            {
+                return;
+            }
+            Directory acl(current, isVisible);
+            for (const auto& entry : acl)
+            {
+                if (!entry.isDirectory())
+                {
+                    continue;
+                }
+                ++count;
+                if (batched)
+                {
+                    fs::remove_all(snapshot / entry.name());
+                }
+            }
+        },
+        false);
+    return count;
+}
+
+void tbtadm::AclStore::touch(const std::string& uuid)
+{
+    tbtadm::touch((m_pending.empty() ? m_root : m_pending) / uuid);
+}
+
+unsigned tbtadm::AclStore::currentVersion() const
+{
+    if (!fs::is_symlink(m_root))
+    {
+        return 0;
+    }
+    try
+    {
+        return std::stoul(fs::read_symlink(m_root).filename().string());
+    }
+    catch (std::exception&)
+    {
+        return 0;
+    }
+}
+
+void tbtadm::AclStore::publish(unsigned version)
+{
+    const auto target =
+        (m_versions.filename() / std::to_string(version)).string();
+    auto link = m_root.string() + newLinkSuffix;
+    ::unlink(link.c_str());
+    if (::symlink(target.c_str(), link.c_str()) == -1)
+    {
+        throwErrno();
+    }
+
+    if (!fs::exists(fs::symlink_status(m_root)) || fs::is_symlink(m_root))
+    {
+        if (::rename(link.c_str(), m_root.c_str()) == -1)
+        {
+            throwErrno();
+        }
+        prune(version);
+        return;
+    }
+
+    // An ACL from before the snapshots; a link can't be renamed over a
+    // directory, but they can be exchanged
+    if (::renameat2(AT_FDCWD, link.c_str(), AT_FDCWD, m_root.c_str(),
+                    RENAME_EXCHANGE)
+        == -1)
+    {
+        throwErrno();
+    }
+    fs::remove_all(link);
+    prune(version);
+}
+
+void tbtadm::AclStore::prune(unsigned current)
+{
+    const auto now = std::time(nullptr);
+    Directory versions(m_versions, isVisible);
+    for (const auto& entry : versions)
+    {
+        unsigned version;
+        try
+        {
+            version = std::stoul(entry.name());
+        }
+        catch (std::exception&)
+        {
+            continue;
+        }
+        if (version >= current || !entry.isDirectory())
+        {
+            continue;
+        }
+
+        // Replaced when the next one was built; if that one is gone too,
+        // long enough ago
+        boost::system::error_code error;
+        const auto replaced = fs::last_write_time(
+            m_versions / std::to_string(version + 1), error);
+        if (!error && now - replaced < keptSeconds)
+        {
+            continue;
+        }
+
+        // Readers hold a shared lock, see open()
+        Directory snapshot(versions, entry.name());
+        if (lockDirectory(snapshot, LOCK_EX | LOCK_NB))
+        {
+            fs::remove_all(m_versions / entry.name());
+        }
+    }
+}
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief The ACL database, safe for concurrent use by tbtadm and tbtacl
+ *
+ * The ACL is kept in versioned snapshots (e.g. "acl.d/7"), and the ACL path
+ * itself (e.g. "acl") is a symbolic link to the current one. Writers are
+ * serialized by a file lock: every update builds the next snapshot, starting
+ * from hard links to the files of the current one, and publishes it by
+ * atomically replacing the symbolic link. Bulk edits should be grouped with
+ * batch(), as every update links all the entries again.
+ *
+ * Readers take no writer lock: open() pins the snapshot that is current at
+ * that moment by holding a shared lock on its directory, and as long as
+ * everything is then read relative to it, no partial update is ever seen.
+ * Old snapshots are removed only when no reader holds them and they were
+ * replaced long enough ago for readers that don't lock (e.g. scripts) to be
+ * done with them.
+ *
+ * An ACL from before this scheme (a plain directory) becomes the first
+ * snapshot on the first update.
+ */
+class AclStore
+{
+public:
+    /// Content of the files of an entry, by file name
+    using Files = std::map<std::string, std::string>;
+
+    /// Changes the given snapshot directory
+    using Change = std::function<void(const boost::filesystem::path&)>;
+
+    static constexpr int defaultPerm = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+    explicit AclStore(boost::filesystem::path root);
+
+    /**
+     * @brief Opens the current snapshot for reading
+     *
+     * The snapshot is kept until the directory is closed. In a batch, this is
+     * the snapshot being built, so the changes made so far are seen.
+     *
+     * @return null if there is no ACL yet
+     */
+    std::unique_ptr<Directory> open() const;
+
+    /**
+     * @brief Applies a change and publishes it as the new snapshot
+     *
+     * @param change    gets the directory of the new snapshot, that already
+     *                  holds the current entries (unless copy is false); the
+     *                  files in it may be hard links shared with the older
+     *                  snapshots, so they must be replaced, not modified
+     * @param copy      whether to start from the current entries; ignored in
+     *                  a batch, where all the changes go to the same snapshot
+     */
+    void update(const Change& change, bool copy = true);
+
+    /**
+     * @brief Makes all the updates done by the given function a single one
+     *
+     * The writer lock is held meanwhile. What was done is published even if
+     * the function throws; nothing is published if nothing was changed. The
+     * updates may be done from several threads.
+     */
+    void batch(const std::function<void()>& changes);
+
+    /// Adds an entry; returns false if it already exists
+    bool add(const std::string& uuid, const Files& files);
+
+    /// Replaces (or creates) a file of an existing entry
+    void write(const std::string& uuid,
+               const std::string& name,
+               const std::string& content,
+               int perm = defaultPerm);
+
+    /// Removes a file of an entry; returns false if it doesn't exist
+    bool erase(const std::string& uuid, const std::string& name);
+
+    /// Removes an entry; returns false if it doesn't exist
+    bool remove(const std::string& uuid);
+
+    /// Removes all the entries; returns their count
+    size_t clear();
+
+    /**
+     * @brief Marks the entry as used now, by its modification time
+     *
+     * Done in place, with no new snapshot, as it changes no content.
+     */
+    void touch(const std::string& uuid);
+
+private:
+    /// The number of the current snapshot; 0 if there is none
+    unsigned currentVersion() const;
+
+    /// Creates the directory of the next snapshot; returns its number
+    unsigned prepare(bool copy);
+
+    /// Makes the ACL path point to the given snapshot
+    void publish(unsigned version);
+
+    /// Removes the old snapshots that aren't in use anymore
+    void prune(unsigned current);
+
+    const boost::filesystem::path m_root;
+    const boost::filesystem::path m_versions;
+    boost::filesystem::path m_pending; ///< the snapshot of the running batch
+    std::atomic<bool> m_changed{false};
+};
+} // namespace tbtadm
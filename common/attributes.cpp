@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "attributes.h"
+
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+/// Skips the trailing whitespace, usually a newline
+const char* trimEnd(const char* begin, const char* end)
+{
+    while (end != begin && std::isspace(static_cast<unsigned char>(end[-1])))
+    {
+        --end;
+    }
+    return end;
+}
+
+[[noreturn]] void
+unexpected(const char* name, const char* begin, const char* end)
+{
+    throw std::runtime_error(std::string("Unexpected value of ") + name + ": "
+                             + std::string(begin, end));
+}
+} // namespace
+
+void tbtadm::parseAttribute(const char* name,
+                            const char* begin,
+                            const char* end,
+                            unsigned& value)
+{
+    end = trimEnd(begin, end);
+    if (begin == end)
+    {
+        unexpected(name, begin, end);
+    }
+
+    unsigned long result = 0;
+    for (auto p = begin; p != end; ++p)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            unexpected(name, begin, end);
+        }
+        result = result * 10 + (*p - '0');
+        if (result > UINT_MAX)
+        {
+            unexpected(name, begin, end);
+        }
+    }
+    value = result;
+}
+
+void tbtadm::parseAttribute(const char* name,
+                            const char* begin,
+                            const char* end,
+                            bool& value)
+{
+    unsigned number;
+    parseAttribute(name, begin, end, number);
+    if (number > 1)
+    {
+        unexpected(name, begin, trimEnd(begin, end));
+    }
+    value = number;
+}
+
+void tbtadm::parseAttribute(const char* name,
+                            const char* begin,
+                            const char* end,
+                            HexNumber& value)
+{
+    end = trimEnd(begin, end);
+    auto digits = begin;
+    if (end - digits > 2 && digits[0] == '0'
+        && (digits[1] == 'x' || digits[1] == 'X'))
+    {
+        digits += 2;
+    }
+    if (digits == end)
+    {
+        unexpected(name, begin, end);
+    }
+
+    unsigned long result = 0;
+    for (auto p = digits; p != end; ++p)
+    {
+        const auto c = static_cast<unsigned char>(*p);
+        if (!std::isxdigit(c))
+        {
+            unexpected(name, begin, end);
+        }
+        result = result * 16
+                 + (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+        if (result > UINT_MAX)
+        {
+            unexpected(name, begin, end);
+        }
+    }
+    value.value = result;
+}
+
+void tbtadm::parseAttribute(const char* name,
+                            const char* begin,
+                            const char* end,
+                            security_level& value)
+{
+    end              = trimEnd(begin, end);
+    const auto level = parseSecurityLevel(begin, end - begin);
+    if (level == -1)
+    {
+        unexpected(name, begin, end);
+    }
+    value = static_cast<security_level>(level);
+}
+
+void tbtadm::parseAttribute(const char* /*name*/,
+                            const char* begin,
+                            const char* end,
+                            std::string& value)
+{
+    value.assign(begin, trimEnd(begin, end));
+}
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "file.h"
+#include "sysfs.h"
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief Describes a sysfs attribute and the type its content is parsed into
+ *
+ * The descriptors are compile-time constants, so an attribute is read with
+ * its name and type checked by the compiler rather than by convention.
+ */
+template <typename T>
+struct AttributeDescriptor
+{
+    const char* name;
+
+    /// Reading it may wake up a runtime-suspended domain, as the kernel has
+    /// to ask the hardware rather than return a cached value
+    bool wakes;
+};
+
+/// A number the kernel prints in hex, e.g. "0x8086" for the vendor ID
+struct HexNumber
+{
+    unsigned value;
+};
+
+namespace attr
+{
+constexpr AttributeDescriptor<unsigned> authorized{"authorized", false};
+constexpr AttributeDescriptor<security_level> security{"security", false};
+constexpr AttributeDescriptor<bool> deauthorization{"deauthorization", false};
+constexpr AttributeDescriptor<std::string> bootACL{"boot_acl", true};
+constexpr AttributeDescriptor<std::string> uniqueID{"unique_id", false};
+constexpr AttributeDescriptor<std::string> vendorName{"vendor_name", false};
+constexpr AttributeDescriptor<std::string> deviceName{"device_name", false};
+constexpr AttributeDescriptor<std::string> key{"key", true};
+constexpr AttributeDescriptor<HexNumber> vendorID{"vendor", false};
+constexpr AttributeDescriptor<HexNumber> deviceID{"device", false};
+constexpr AttributeDescriptor<std::string> nvmVersion{"nvm_version", true};
+/// The status of the last NVM authentication, 0 if it succeeded
+constexpr AttributeDescriptor<std::string> nvmAuthenticate{"nvm_authenticate",
+                                                           false};
+} // namespace attr
+
+/// Sysfs attributes are at most a page
+constexpr size_t attributeBufferSize = 4096;
+
+/**
+ * @brief Parse the content of an attribute, ignoring the trailing newline
+ *
+ * Throw std::runtime_error, naming the attribute, on unexpected content.
+ */
+void parseAttribute(const char* name,
+                    const char* begin,
+                    const char* end,
+                    unsigned& value);
+void parseAttribute(const char* name,
+                    const char* begin,
+                    const char* end,
+                    bool& value);
+void parseAttribute(const char* name,
+                    const char* begin,
+                    const char* end,
+                    HexNumber& value);
+void parseAttribute(const char* name,
+                    const char* begin,
+                    const char* end,
+                    security_level& value);
+void parseAttribute(const char* name,
+                    const char* begin,
+                    const char* end,
+                    std::string& value);
+
+/// Reads the given attribute from its open file, parsing it straight from the
+/// read buffer
+template <typename T>
+T readAttribute(File&& file, const AttributeDescriptor<T>& attribute)
+{
+    char buffer[attributeBufferSize];
+    auto size = file.read(buffer, sizeof(buffer), 0);
+    T value;
+    parseAttribute(attribute.name, buffer, buffer + size, value);
+    return value;
+}
+
+/// Reads the given attribute relative to the given directory
+template <typename T>
+T readAttribute(const Directory& dir, const AttributeDescriptor<T>& attribute)
+{
+    return readAttribute(File(dir, attribute.name, File::Mode::Read),
+                         attribute);
+}
+
+/// Reads the given attribute of the device in the given directory
+template <typename T>
+T readAttribute(const boost::filesystem::path& dir,
+                const AttributeDescriptor<T>& attribute)
+{
+    return readAttribute(File(dir / attribute.name, File::Mode::Read),
+                         attribute);
+}
+} // namespace tbtadm
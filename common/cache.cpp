@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "cache.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const char separator         = '\t';
+const std::string magic      = "# tbtadm device cache v1";
+const std::string lockSuffix = ".lock";
+
+/// Makes sure a field can't break the line format
+std::string sanitize(std::string field)
+{
+    std::replace_if(field.begin(),
+                    field.end(),
+                    [](char c) { return c == separator || c == '\n'; },
+                    ' ');
+    return field;
+}
+
+bool same(const tbtadm::CachedDevice& a, const tbtadm::CachedDevice& b)
+{
+    return a.routeString == b.routeString && a.uuid == b.uuid
+           && a.authorized == b.authorized && a.vendor == b.vendor
+           && a.device == b.device;
+}
+} // namespace
+
+tbtadm::DeviceCache::DeviceCache(fs::path path) : m_path(std::move(path))
+{
+}
+
+void tbtadm::DeviceCache::load()
+{
+    std::string content;
+    try
+    {
+        content = File(m_path, File::Mode::Read).read();
+    }
+    catch (std::exception&)
+    {
+        // No cache yet
+        return;
+    }
+
+    std::istringstream stream(content);
+    std::string line;
+    if (!std::getline(stream, line) || line != magic)
+    {
+        // Unknown format, ignore it; it will be overwritten on next save
+        return;
+    }
+
+    while (std::getline(stream, line))
+    {
+        std::istringstream fields(line);
+        CachedDevice device;
+        std::string authorized;
+        if (!std::getline(fields, device.routeString, separator)
+            || !std::getline(fields, device.uuid, separator)
+            || !std::getline(fields, authorized, separator)
+            || !std::getline(fields, device.vendor, separator)
+            || !std::getline(fields, device.device, separator))
+        {
+            continue;
+        }
+        device.authorized = authorized == "1";
+        auto routeString  = device.routeString;
+        m_devices.emplace(std::move(routeString), std::move(device));
+    }
+}
+
+const tbtadm::CachedDevice*
+tbtadm::DeviceCache::find(const std::string& routeString) const
+{
+    auto i = m_devices.find(routeString);
+    return i == m_devices.end() ? nullptr : &i->second;
+}
+
+void tbtadm::DeviceCache::replace(std::map<std::string, CachedDevice> devices)
+{
+    FileLock lock(m_path.string() + lockSuffix);
+    const auto loaded = std::move(m_devices);
+    m_devices.clear();
+    load();
+
+    for (const auto& entry : m_devices)
+    {
+        auto i = loaded.find(entry.first);
+        if (i == loaded.end() || !same(i->second, entry.second))
+        {
+            devices[entry.first] = entry.second;
+        }
+    }
+
+    auto equal = [](const auto& a, const auto& b) {
+        return a.first == b.first && same(a.second, b.second);
+    };
+    if (devices.size() != m_devices.size()
+        || !std::equal(
+               devices.begin(), devices.end(), m_devices.begin(), equal))
+    {
+        m_devices  = std::move(devices);
+        m_modified = true;
+    }
+
+    save();
+}
+
+void tbtadm::DeviceCache::update(const std::vector<CachedDevice>& devices,
+                                 const std::vector<std::string>& gone)
+{
+    FileLock lock(m_path.string() + lockSuffix);
+    m_devices.clear();
+    load();
+
+    for (const auto& device : devices)
+    {
+        auto& cached = m_devices[device.routeString];
+        if (!same(cached, device))
+        {
+            cached     = device;
+            m_modified = true;
+        }
+    }
+    for (const auto& routeString : gone)
+    {
+        m_modified |= m_devices.erase(routeString) != 0;
+    }
+
+    save();
+}
+
+void tbtadm::DeviceCache::save() const
+{
+    if (!m_modified)
+    {
+        return;
+    }
+
+    std::string content = magic + '\n';
+    for (const auto& entry : m_devices)
+    {
+        const auto& device = entry.second;
+        content += sanitize(device.routeString) + separator
+                   + sanitize(device.uuid) + separator
+                   + (device.authorized ? '1' : '0') + separator
+                   + sanitize(device.vendor) + separator
+                   + sanitize(device.device) + '\n';
+    }
+
+    writeAtomically(m_path, content);
+}
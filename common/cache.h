@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/// The last known state of a device, as saved in the device cache
+struct CachedDevice
+{
+    std::string routeString;
+    std::string uuid;
+    std::string vendor;
+    std::string device;
+    bool authorized = false;
+};
+
+/**
+ * @brief Snapshot of the connected devices, kept on disk
+ *
+ * Reading some device attributes wakes up a runtime-suspended domain (see
+ * AttributeDescriptor::wakes), so when asked not to do it and the state of
+ * the devices includes such an attribute, tbtadm uses the state saved here the
+ * last time the devices were read (by a listing or by approval). tbtacl
+ * updates the devices it authorizes.
+ *
+ * The file is line based; each line holds the fields of a single device,
+ * separated by tabs, with the route-string first.
+ */
+class DeviceCache
+{
+public:
+    explicit DeviceCache(boost::filesystem::path path);
+
+    /// Loads the cache file; a missing or unreadable file means empty cache
+    void load();
+
+    /// Returns the cached device with the given route-string, if any
+    const CachedDevice* find(const std::string& routeString) const;
+
+    /**
+     * @brief Replaces the whole content with the given devices
+     *
+     * Like update(), under a lock; a device whose cached state changed since
+     * load() (e.g. authorized by tbtacl while the given devices were read)
+     * keeps that newer state.
+     */
+    void replace(std::map<std::string, CachedDevice> devices);
+
+    /**
+     * @brief Updates the given devices and forgets the gone ones
+     *
+     * The other devices keep their cached state. The cache file is re-read
+     * and written under a lock, so concurrent updates (e.g. of tbtacl) don't
+     * lose each other's changes.
+     */
+    void update(const std::vector<CachedDevice>& devices,
+                const std::vector<std::string>& gone = {});
+
+    /**
+     * @brief Writes the cache file if its content changed
+     *
+     * The file is replaced atomically, so readers never see a partial file.
+     */
+    void save() const;
+
+private:
+    boost::filesystem::path m_path;
+    std::map<std::string, CachedDevice> m_devices;
+    bool m_modified = false;
+};
+} // namespace tbtadm
@@ -0,0 +1,204 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "directory.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+/// Big enough for a whole sysfs device directory in a single call
+const size_t bufferSize = 32 * 1024;
+
+/// The record returned by getdents64(2); glibc doesn't declare it
+struct LinuxDirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+[[noreturn]] void throwErrno()
+{
+    throw std::system_error(errno, std::system_category());
+}
+
+int openDirectory(int dirfd, const char* name)
+{
+    auto fd = ::openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throwErrno();
+    }
+    return fd;
+}
+
+bool isDot(const char* name)
+{
+    return name[0] == '.'
+           && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+} // namespace
+
+bool tbtadm::Directory::Entry::isDirectory() const
+{
+    if (m_type == DT_DIR)
+    {
+        return true;
+    }
+    if (m_type != DT_UNKNOWN && m_type != DT_LNK)
+    {
+        return false;
+    }
+
+    struct stat st;
+    return ::fstatat(m_dir->m_fd, m_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+tbtadm::Directory::Iterator::Iterator(Directory* dir) : m_dir(dir)
+{
+    if (m_dir && !m_dir->next(m_entry))
+    {
+        m_dir = nullptr;
+    }
+}
+
+tbtadm::Directory::Iterator& tbtadm::Directory::Iterator::operator++()
+{
+    if (m_dir && !m_dir->next(m_entry))
+    {
+        m_dir = nullptr;
+    }
+    return *this;
+}
+
+tbtadm::Directory::Directory(const boost::filesystem::path& path,
+                             Filter filter)
+    : m_fd(openDirectory(AT_FDCWD, path.c_str())), m_filter(filter)
+{
+}
+
+tbtadm::Directory::Directory(const Directory& parent,
+                             const std::string& name,
+                             Filter filter)
+    : m_fd(openDirectory(parent.m_fd, name.c_str())), m_filter(filter)
+{
+}
+
+tbtadm::Directory::~Directory()
+{
+    if (m_fd != -1)
+    {
+        ::close(m_fd);
+    }
+}
+
+tbtadm::Directory::Directory(Directory&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+tbtadm::Directory& tbtadm::Directory::operator=(Directory&& other) noexcept
+{
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_filter, other.m_filter);
+    std::swap(m_buffer, other.m_buffer);
+    std::swap(m_offset, other.m_offset);
+    std::swap(m_size, other.m_size);
+    return *this;
+}
+
+tbtadm::Directory::Iterator tbtadm::Directory::begin()
+{
+    if (::lseek(m_fd, 0, SEEK_SET) == -1)
+    {
+        throwErrno();
+    }
+    m_offset = m_size = 0;
+    return Iterator(this);
+}
+
+bool tbtadm::Directory::exists(const std::string& name) const
+{
+    return ::faccessat(m_fd, name.c_str(), F_OK, 0) == 0;
+}
+
+bool tbtadm::Directory::next(Entry& entry)
+{
+    if (!m_buffer)
+    {
+        m_buffer.reset(new char[bufferSize]);
+    }
+
+    while (true)
+    {
+        if (m_offset >= m_size)
+        {
+            auto ret =
+                ::syscall(SYS_getdents64, m_fd, m_buffer.get(), bufferSize);
+            if (ret == -1)
+            {
+                throwErrno();
+            }
+            if (!ret)
+            {
+                return false;
+            }
+            m_size   = ret;
+            m_offset = 0;
+        }
+
+        const auto* dirent =
+            reinterpret_cast<const LinuxDirent64*>(m_buffer.get() + m_offset);
+        m_offset += dirent->d_reclen;
+
+        if (isDot(dirent->d_name) || (m_filter && !m_filter(dirent->d_name)))
+        {
+            continue;
+        }
+
+        entry.m_dir  = this;
+        entry.m_name = dirent->d_name;
+        entry.m_type = dirent->d_type;
+        return true;
+    }
+}
@@ -0,0 +1,168 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/**
+ * @brief Lightweight directory reader, for scanning sysfs and the ACL
+ *
+ * boost::filesystem::directory_iterator creates a path object for every entry
+ * and the callers usually stat() each entry to check if it's a directory. This
+ * class reads the entries in big chunks with getdents64(2) instead, exposing
+ * the entry type reported by the kernel so no stat() is needed in most cases,
+ * and lets the caller filter entries by their name before anything else is
+ * done with them.
+ *
+ * The directory is kept open, so files and sub-directories can be opened
+ * relative to it (see File and the Directory(parent, name) constructor).
+ *
+ * Only one iteration can be active on an object at a time; begin() restarts
+ * the iteration.
+ */
+class Directory
+{
+public:
+    /// Decides by entry name if it's interesting for the caller
+    using Filter = bool (*)(const char* name);
+
+    class Entry
+    {
+    public:
+        const char* name() const { return m_name; }
+
+        /// The type as reported by getdents64(2), i.e. DT_* constant
+        unsigned char type() const { return m_type; }
+
+        /**
+         * @brief Checks if the entry is a directory (or a link to one)
+         *
+         * Uses the type reported by the kernel; falls back to fstatat(2)
+         * only if the type is unknown or the entry is a symbolic link.
+         */
+        bool isDirectory() const;
+
+    private:
+        friend class Directory;
+
+        const Directory* m_dir = nullptr;
+        const char* m_name     = nullptr;
+        unsigned char m_type   = 0;
+    };
+
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = Entry;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const Entry*;
+        using reference         = const Entry&;
+
+        const Entry& operator*() const { return m_entry; }
+        const Entry* operator->() const { return &m_entry; }
+        Iterator& operator++();
+
+        bool operator==(const Iterator& other) const
+        {
+            return m_dir == other.m_dir;
+        }
+        bool operator!=(const Iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class Directory;
+
+        explicit Iterator(Directory* dir);
+
+        Directory* m_dir = nullptr; // null when reaching the end
+        Entry m_entry;
+    };
+
+    /**
+     * @brief Open the directory
+     *
+     * @param path      path of the directory
+     * @param filter    if given, only entries accepted by it are iterated
+     */
+    explicit Directory(const boost::filesystem::path& path,
+                       Filter filter = nullptr);
+
+    /**
+     * @brief Open a sub-directory, relative to an open directory
+     *
+     * @param parent    the directory containing it
+     * @param name      name (or relative path) of the sub-directory
+     * @param filter    if given, only entries accepted by it are iterated
+     */
+    Directory(const Directory& parent,
+              const std::string& name,
+              Filter filter = nullptr);
+
+    ~Directory();
+
+    Directory(const Directory&) = delete;
+    Directory& operator=(const Directory&) = delete;
+
+    Directory(Directory&& other) noexcept;
+    Directory& operator=(Directory&& other) noexcept;
+
+    /// Restarts the iteration from the first entry
+    Iterator begin();
+    Iterator end() { return Iterator(nullptr); }
+
+    /// Checks, without opening it, if the given (relative) path exists
+    bool exists(const std::string& name) const;
+
+    /// The directory file descriptor, for *at() functions
+    int fd() const { return m_fd; }
+
+private:
+    /// Moves to the next entry accepted by the filter; false at the end
+    bool next(Entry& entry);
+
+    int m_fd        = -1;
+    Filter m_filter = nullptr;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_offset = 0; // Next entry in the buffer
+    size_t m_size   = 0; // Valid data in the buffer
+};
+} // namespace tbtadm
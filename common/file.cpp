@@ -30,9 +30,18 @@
  ******************************************************************************/
 
 #include "file.h"
+#include "directory.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstdio>
 #include <system_error>
+#include <vector>
+
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 namespace fs = boost::filesystem;
@@ -65,6 +74,25 @@ tbtadm::File::File(const char* filename, Mode mode, int flags, int perm)
     }
 }
 
+tbtadm::File::File(const Directory& dir,
+                   const std::string& filename,
+                   Mode mode,
+                   int flags,
+                   int perm)
+    : m_fd(perm ? ::openat(dir.fd(),
+                           filename.c_str(),
+                           static_cast<int>(mode) | flags,
+                           perm)
+                : ::openat(dir.fd(),
+                           filename.c_str(),
+                           static_cast<int>(mode) | flags))
+{
+    if (m_fd == ERROR)
+    {
+        throwErrno();
+    }
+}
+
 tbtadm::File::~File()
 {
     close();
@@ -73,12 +101,14 @@ tbtadm::File::~File()
 tbtadm::File::File(tbtadm::File&& other) noexcept
 {
     std::swap(m_fd, other.m_fd);
+    std::swap(m_noSendfile, other.m_noSendfile);
 }
 
 tbtadm::File& tbtadm::File::operator=(tbtadm::File&& other) noexcept
 {
     close();
     std::swap(m_fd, other.m_fd);
+    std::swap(m_noSendfile, other.m_noSendfile);
     return *this;
 }
 
@@ -95,12 +125,11 @@ void tbtadm::File::write(const std::string& value)
 std::string tbtadm::File::read()
 {
     std::string content;
-    errno = 0;
+    char buffer[4096]; // A sysfs attribute is at most a page
     while (true)
     {
-        char c;
-        auto ret = ::read(m_fd, &c, sizeof(c));
-        if (ret == ERROR || (!ret && errno))
+        auto ret = ::read(m_fd, buffer, sizeof(buffer));
+        if (ret == ERROR)
         {
             throwErrno();
         }
@@ -108,7 +137,7 @@ std::string tbtadm::File::read()
         {
             break;
         }
-        content.push_back(c);
+        content.append(buffer, ret);
     }
     if (content.empty())
     {
@@ -117,6 +146,64 @@ std::string tbtadm::File::read()
     return content;
 }
 
+size_t tbtadm::File::read(char* buffer, size_t size, off_t offset)
+{
+    auto ret = ::pread(m_fd, buffer, size, offset);
+    if (ret == ERROR)
+    {
+        throwErrno();
+    }
+    return ret;
+}
+
+size_t tbtadm::File::copyFrom(File& source, size_t count)
+{
+    if (!m_noSendfile)
+    {
+        auto ret = ::sendfile(m_fd, source.m_fd, nullptr, count);
+        if (ret != ERROR)
+        {
+            return ret;
+        }
+        if (errno != EINVAL && errno != ENOSYS)
+        {
+            throwErrno();
+        }
+        // Not supported by one of the files; don't try it again
+        m_noSendfile = true;
+    }
+
+    const size_t maxChunk = 64 * 1024;
+    std::vector<char> buffer(std::min(count, maxChunk));
+    auto ret = ::read(source.m_fd, buffer.data(), buffer.size());
+    if (ret == ERROR)
+    {
+        throwErrno();
+    }
+
+    size_t written = 0;
+    while (written < static_cast<size_t>(ret))
+    {
+        auto n = ::write(m_fd, buffer.data() + written, ret - written);
+        if (n == ERROR)
+        {
+            throwErrno();
+        }
+        written += n;
+    }
+    return written;
+}
+
+size_t tbtadm::File::size() const
+{
+    struct stat st;
+    if (::fstat(m_fd, &st) == ERROR)
+    {
+        throwErrno();
+    }
+    return st.st_size;
+}
+
 void tbtadm::File::close()
 {
     if (m_fd != ERROR)
@@ -133,3 +220,76 @@ void tbtadm::chdir(const fs::path& dir)
         throwErrno();
     }
 }
+
+void tbtadm::touch(const fs::path& path)
+{
+    if (::utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == File::ERROR)
+    {
+        throwErrno();
+    }
+}
+
+tbtadm::FileLock::FileLock(const fs::path& path, bool wait)
+{
+    fs::create_directories(path.parent_path());
+
+    m_fd = ::open(
+        path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (m_fd == File::ERROR)
+    {
+        throwErrno();
+    }
+
+    while (::flock(m_fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) == File::ERROR)
+    {
+        if (errno == EWOULDBLOCK)
+        {
+            ::close(m_fd);
+            m_fd = File::ERROR;
+            return;
+        }
+        if (errno != EINTR)
+        {
+            auto error = errno;
+            ::close(m_fd);
+            throw std::system_error(error, std::system_category());
+        }
+    }
+}
+
+tbtadm::FileLock::~FileLock()
+{
+    // Closing releases the lock
+    if (m_fd != File::ERROR)
+    {
+        ::close(m_fd);
+    }
+}
+
+void tbtadm::writeAtomically(const fs::path& path,
+                             const std::string& content,
+                             int perm)
+{
+    fs::create_directories(path.parent_path());
+
+    // By thread, as the threads of a process may write the same file at once
+    auto temp = path;
+    temp += ".tmp" + std::to_string(::syscall(SYS_gettid));
+    try
+    {
+        File file(temp, File::Mode::Write, O_CREAT | O_TRUNC, perm);
+        file << content;
+    }
+    catch (...)
+    {
+        ::unlink(temp.c_str());
+        throw;
+    }
+
+    if (::rename(temp.c_str(), path.c_str()) == File::ERROR)
+    {
+        auto error = errno;
+        ::unlink(temp.c_str());
+        throw std::system_error(error, std::system_category());
+    }
+}
@@ -33,12 +33,15 @@
 
 #include <string>
 
-#include <fcntl.h> // for O_RDONLY, O_WRONLY
+#include <fcntl.h>    // for O_RDONLY, O_WRONLY
+#include <sys/stat.h> // for S_IRUSR etc.
 
 #include <boost/filesystem.hpp>
 
 namespace tbtadm
 {
+class Directory;
+
 /**
  * @brief This class wraps-around POSIX file interface for C++ style usage
  *
@@ -99,6 +102,19 @@ public:
      */
     File(const char* filename, Mode mode, int flags = 0, int perm = 0);
 
+    /**
+     * @brief Open the file, relative to an open directory
+     *
+     * @param dir       the directory to look in
+     * @param filename  Name/relative path of the file to open
+     * @param mode      File open mode
+     */
+    File(const Directory& dir,
+         const std::string& filename,
+         Mode mode,
+         int flags = 0,
+         int perm  = 0);
+
     /**
      * @brief close the file
      */
@@ -124,16 +140,94 @@ public:
      */
     std::string read();
 
+    /**
+     * @brief read part of the file, from the given offset
+     *
+     * Doesn't change the current file position.
+     *
+     * @param buffer    where to put the data
+     * @param size      how many bytes to read
+     * @param offset    where to start reading from
+     *
+     * @return the number of bytes actually read (0 at the end of the file)
+     */
+    size_t read(char* buffer, size_t size, off_t offset);
+
+    /**
+     * @brief copy data from the current position of another file
+     *
+     * The data is copied in the kernel (with sendfile(2)) when both files
+     * support it; otherwise it goes through a user-space buffer.
+     *
+     * @param source    file to copy from
+     * @param count     the max number of bytes to copy
+     *
+     * @return the number of bytes actually copied (0 at the end of the source)
+     */
+    size_t copyFrom(File& source, size_t count);
+
+    /**
+     * @return the size of the file
+     */
+    size_t size() const;
+
     static const int ERROR = -1;
 
 private:
     void close();
 
-    int m_fd = ERROR;
+    int m_fd          = ERROR;
+    bool m_noSendfile = false;
 };
 
 void chdir(const boost::filesystem::path& dir);
 
+/// Sets the modification (and access) time of the given file to now
+void touch(const boost::filesystem::path& path);
+
+/**
+ * @brief Holds an exclusive flock(2) on a lock file while in scope
+ *
+ * Serializes read-modify-write cycles of state files between concurrent
+ * processes (e.g. udev workers). The lock file and its parent directories are
+ * created if missing.
+ */
+class FileLock
+{
+public:
+    /**
+     * @param path  the lock file
+     * @param wait  if false, don't wait for a lock held by someone else; check
+     *              locked() for the result
+     */
+    explicit FileLock(const boost::filesystem::path& path, bool wait = true);
+    ~FileLock();
+
+    bool locked() const { return m_fd != File::ERROR; }
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+    int m_fd = File::ERROR;
+};
+
+/**
+ * @brief Replace the content of a file atomically
+ *
+ * The content is written to a temporary file next to the target, which is then
+ * renamed over it, so readers see either the old or the new content but never
+ * a partial one, also with concurrent writers. Missing parent directories are
+ * created.
+ *
+ * @param path      file to write
+ * @param content   the new content
+ * @param perm      permissions of the file, if it's created
+ */
+void writeAtomically(const boost::filesystem::path& path,
+                     const std::string& content,
+                     int perm = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
 inline File& operator<<(File& file, const std::string& t)
 {
     file.write(t);
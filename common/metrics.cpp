@@ -0,0 +1,360 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "metrics.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "directory.h"
+#include "file.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+const fs::path tbtadm::Metrics::defaultDir = "/var/lib/thunderbolt";
+
+namespace
+{
+const std::string stateFilename  = "metrics.state";
+const std::string exportFilename = "thunderbolt.prom";
+const std::string gaugesFilename = "thunderbolt_devices.prom";
+const std::string lockSuffix     = ".lock";
+
+const fs::path sysfsDevicesPath = "/sys/bus/thunderbolt/devices";
+const std::string aclDirname    = "acl";
+const std::string domainPrefix  = "domain";
+
+const std::string attemptsName = "thunderbolt_authorization_attempts_total";
+const std::string failuresName = "thunderbolt_authorization_failures_total";
+const std::string latencyName  = "thunderbolt_authorization_duration_seconds";
+const std::string eventsName   = "thunderbolt_acl_events_total";
+
+/// Upper bounds of the latency histogram buckets, in seconds
+const double latencyBuckets[] = {0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+                                 1,    2.5,   5,    10,  30};
+
+struct Family
+{
+    const std::string& name;
+    const char* type;
+    const char* help;
+};
+
+const Family counters[] = {
+    {attemptsName, "counter", "Writes of the authorized attribute"},
+    {failuresName, "counter", "Failed device authorizations, by errno"},
+    {eventsName, "counter", "Device events handled by tbtacl, by outcome"},
+    {latencyName,
+     "histogram",
+     "Time to authorize a device, including key write and retries"}};
+
+/// The errno name, e.g. "EBUSY", where the C library can tell it
+std::string errorName(int error)
+{
+#ifdef HAVE_STRERRORNAME_NP
+    if (const char* name = ::strerrorname_np(error))
+    {
+        return name;
+    }
+#endif
+    return std::to_string(error);
+}
+
+std::string labels(const std::map<std::string, std::string>& values)
+{
+    std::string result = "{";
+    for (const auto& value : values)
+    {
+        if (result.size() > 1)
+        {
+            result += ',';
+        }
+        result += value.first + "=\"" + value.second + '"';
+    }
+    return result + '}';
+}
+
+/// Formats a value with no precision loss for counts (e.g. "1234567890")
+std::string format(double value)
+{
+    std::ostringstream out;
+    out.precision(value == std::floor(value) ? 16 : 9);
+    out << value;
+    return out.str();
+}
+
+bool isDomainName(const char* name)
+{
+    return std::strncmp(name, domainPrefix.c_str(), domainPrefix.size()) == 0;
+}
+
+bool isVisible(const char* name)
+{
+    return name[0] != '.';
+}
+
+/// Reads the current state of the devices as gauges
+void addGauges(std::ostream& out)
+{
+    std::map<std::string, std::string> security;
+    std::map<std::string, double> devices;
+    if (fs::exists(sysfsDevicesPath))
+    {
+        tbtadm::Directory bus(sysfsDevicesPath, isDomainName);
+        for (const auto& entry : bus)
+        {
+            const std::string name = entry.name();
+            security[name.substr(domainPrefix.size())] =
+                tbtadm::readAndTrim(bus, name + "/security");
+        }
+
+        tbtadm::Directory devicesDir(sysfsDevicesPath,
+                                     tbtadm::isConnectedRouteString);
+        for (const auto& entry : devicesDir)
+        {
+            const std::string name = entry.name();
+            std::string authorized;
+            try
+            {
+                authorized =
+                    tbtadm::readAndTrim(devicesDir, name + "/authorized");
+            }
+            catch (std::system_error&)
+            {
+                continue; // e.g. XDomain
+            }
+            const auto domain = name.substr(0, name.find('-'));
+            devices[labels({{"domain", domain},
+                            {"security_level", security[domain]},
+                            {"authorized", authorized}})] += 1;
+        }
+    }
+
+    out << "# HELP thunderbolt_domain_info Thunderbolt domains and their "
+           "security level\n"
+        << "# TYPE thunderbolt_domain_info gauge\n";
+    for (const auto& domain : security)
+    {
+        out << "thunderbolt_domain_info"
+            << labels({{"domain", domain.first},
+                       {"security_level", domain.second}})
+            << " 1\n";
+    }
+
+    out << "# HELP thunderbolt_devices Connected devices\n"
+        << "# TYPE thunderbolt_devices gauge\n";
+    for (const auto& series : devices)
+    {
+        out << "thunderbolt_devices" << series.first << ' '
+            << format(series.second) << '\n';
+    }
+}
+
+size_t aclSize(const fs::path& acl)
+{
+    if (!fs::exists(acl))
+    {
+        return 0;
+    }
+    size_t count = 0;
+    tbtadm::Directory dir(acl, isVisible);
+    for (const auto& entry : dir)
+    {
+        count += entry.isDirectory();
+    }
+    return count;
+}
+} // namespace
+
+tbtadm::Metrics::Metrics(bool gauges, fs::path dir)
+    : m_gauges(gauges), m_dir(std::move(dir))
+{
+}
+
+std::string tbtadm::Metrics::authorization(const std::string& tool,
+                                           unsigned attempts,
+                                           Duration duration,
+                                           int error)
+{
+    return update([&](Series& series) {
+        const auto byTool = labels({{"tool", tool}});
+        series[attemptsName + byTool] += attempts;
+        if (error)
+        {
+            series[failuresName
+                   + labels({{"tool", tool}, {"errno", errorName(error)}})] +=
+                1;
+            return;
+        }
+
+        for (auto bucket : latencyBuckets)
+        {
+            if (duration.count() <= bucket)
+            {
+                series[latencyName + "_bucket"
+                       + labels({{"le", format(bucket)}, {"tool", tool}})] += 1;
+            }
+        }
+        series[latencyName + "_bucket"
+               + labels({{"le", "+Inf"}, {"tool", tool}})] += 1;
+        series[latencyName + "_sum" + byTool] += duration.count();
+        series[latencyName + "_count" + byTool] += 1;
+    });
+}
+
+std::string tbtadm::Metrics::event(const std::string& action,
+                                   const std::string& outcome)
+{
+    return update([&](Series& series) {
+        series[eventsName
+               + labels({{"action", action}, {"outcome", outcome}})] += 1;
+    });
+}
+
+std::string tbtadm::Metrics::update()
+{
+    return update([](Series&) {});
+}
+
+std::string tbtadm::Metrics::batch(const std::function<void()>& records)
+{
+    Series pending;
+    m_pending = &pending;
+    try
+    {
+        records();
+    }
+    catch (...)
+    {
+        m_pending = nullptr;
+        throw;
+    }
+    m_pending = nullptr;
+
+    if (pending.empty())
+    {
+        return {};
+    }
+    return update([&pending](Series& series) {
+        for (const auto& record : pending)
+        {
+            series[record.first] += record.second;
+        }
+    });
+}
+
+template <typename Change>
+std::string tbtadm::Metrics::update(Change change)
+{
+    if (m_pending)
+    {
+        // All the changes are additions, see batch()
+        change(*m_pending);
+        return {};
+    }
+
+    try
+    {
+        {
+            FileLock lock((m_dir / stateFilename).string() + lockSuffix);
+            auto series = load();
+            change(series);
+            save(series);
+            exportTo(series);
+        }
+        if (m_gauges)
+        {
+            exportGauges();
+        }
+        return {};
+    }
+    catch (std::exception& e)
+    {
+        return e.what();
+    }
+}
+
+tbtadm::Metrics::Series tbtadm::Metrics::load() const
+{
+    Series series;
+    std::ifstream file((m_dir / stateFilename).string());
+    std::string name;
+    double value;
+    while (file >> name >> value)
+    {
+        series[name] = value;
+    }
+    return series;
+}
+
+void tbtadm::Metrics::save(const Series& series) const
+{
+    std::ostringstream out;
+    for (const auto& s : series)
+    {
+        out << s.first << ' ' << format(s.second) << '\n';
+    }
+    writeAtomically(m_dir / stateFilename, out.str());
+}
+
+void tbtadm::Metrics::exportTo(const Series& series) const
+{
+    std::ostringstream out;
+    for (const auto& family : counters)
+    {
+        out << "# HELP " << family.name << ' ' << family.help << '\n'
+            << "# TYPE " << family.name << ' ' << family.type << '\n';
+        for (const auto& s : series)
+        {
+            if (s.first.compare(0, family.name.size(), family.name) == 0)
+            {
+                out << s.first << ' ' << format(s.second) << '\n';
+            }
+        }
+    }
+
+    writeAtomically(m_dir / exportFilename, out.str());
+}
+
+void tbtadm::Metrics::exportGauges() const
+{
+    std::ostringstream out;
+    addGauges(out);
+
+    out << "# HELP thunderbolt_acl_entries Devices in the ACL\n"
+        << "# TYPE thunderbolt_acl_entries gauge\n"
+        << "thunderbolt_acl_entries " << aclSize(m_dir / aclDirname) << '\n';
+
+    writeAtomically(m_dir / gaugesFilename, out.str());
+}
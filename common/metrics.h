@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/**
+ * @brief Exports Thunderbolt metrics for the Prometheus node_exporter
+ *
+ * tbtadm and tbtacl are short-lived, so the counters and the authorization
+ * latency histogram are kept in a state file, updated under a lock by every
+ * process that records something. On every update, the state is written in
+ * the textfile-collector format to a ".prom" file, atomically, so
+ * node_exporter (--collector.textfile.directory) never reads a partial file.
+ *
+ * The gauges read from sysfs (devices per domain, security level and
+ * authorization status, ACL size) go to a ".prom" file of their own, written
+ * by tbtadm only: reading them walks the bus, which tbtacl can't afford on
+ * every event.
+ *
+ * Failing to export metrics never fails the operation they're about, so the
+ * methods don't throw; the error is returned instead.
+ */
+class Metrics
+{
+public:
+    using Duration = std::chrono::duration<double>;
+
+    /**
+     * @param gauges    whether to export the gauges as well
+     * @param dir       the directory of the state and the exported files
+     */
+    explicit Metrics(bool gauges                 = true,
+                     boost::filesystem::path dir = defaultDir);
+
+    /**
+     * @brief Records an authorization of a device
+     *
+     * @param tool      the tool that did it (tbtadm, tbtacl)
+     * @param attempts  writes of the authorized attribute (more than one if
+     *                  the connection manager was busy)
+     * @param duration  the time it took, including key write and retries
+     * @param error     the errno of the failure, or 0 on success
+     *
+     * @return empty on success, otherwise the reason of the export failure
+     */
+    std::string authorization(const std::string& tool,
+                              unsigned attempts,
+                              Duration duration,
+                              int error);
+
+    /**
+     * @brief Records a udev event handled by tbtacl
+     *
+     * @param action    the event action (add, change)
+     * @param outcome   what was done, e.g. "authorized" or "coalesced"
+     */
+    std::string event(const std::string& action, const std::string& outcome);
+
+    /// Re-exports after a change that isn't recorded (e.g. the ACL changed)
+    std::string update();
+
+    /**
+     * @brief Makes the records of the given function a single update
+     *
+     * They are kept in memory meanwhile, so e.g. an authorization and the
+     * event it's part of take the lock once.
+     */
+    std::string batch(const std::function<void()>& records);
+
+    static const boost::filesystem::path defaultDir;
+
+private:
+    using Series = std::map<std::string, double>;
+
+    template <typename Change>
+    std::string update(Change change);
+
+    Series load() const;
+    void save(const Series& series) const;
+    void exportTo(const Series& series) const;
+    void exportGauges() const;
+
+    const bool m_gauges;
+    const boost::filesystem::path m_dir;
+    Series* m_pending = nullptr; ///< the records of the running batch
+};
+} // namespace tbtadm
@@ -0,0 +1,306 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "policy.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+#include "attributes.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+const fs::path tbtadm::Policy::defaultPath = TBT_POLICY;
+
+namespace
+{
+const std::string allowKeyword = "allow";
+const std::string denyKeyword  = "deny";
+const std::string maxDepthName = "max-depth";
+
+/// Condition names, by tbtadm::Policy field order
+const std::array<std::string, 6> fieldNames = {{"vendor",
+                                                "device",
+                                                "vendor-name",
+                                                "device-name",
+                                                "domain",
+                                                "security"}};
+
+/// IDs are compared as numbers, so 0x8086 and 0X8086 are the same
+std::string normalizeID(const std::string& id)
+{
+    size_t end = 0;
+    auto value = std::stoul(id, &end, 0);
+    if (end != id.size())
+    {
+        throw std::invalid_argument(id);
+    }
+    return std::to_string(value);
+}
+
+/// Splits a line by whitespace, keeping double-quoted parts together
+std::vector<std::string> tokenize(const std::string& line)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    bool quoted  = false;
+    bool started = false;
+    for (char c : line)
+    {
+        if (c == '"')
+        {
+            quoted  = !quoted;
+            started = true;
+        }
+        else if (!quoted && std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (started)
+            {
+                tokens.push_back(std::move(token));
+                token.clear();
+                started = false;
+            }
+        }
+        else
+        {
+            token += c;
+            started = true;
+        }
+    }
+    if (quoted)
+    {
+        throw std::invalid_argument("unterminated quote");
+    }
+    if (started)
+    {
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+/// Reads an ID attribute, normalized; empty if it isn't there
+std::string readID(const tbtadm::Directory& dir,
+                   const tbtadm::AttributeDescriptor<tbtadm::HexNumber>& id)
+{
+    try
+    {
+        return std::to_string(readAttribute(dir, id).value);
+    }
+    catch (std::exception&)
+    {
+        return {};
+    }
+}
+} // namespace
+
+tbtadm::PolicyDevice tbtadm::readPolicyDevice(const Directory& dir,
+                                              const std::string& routeString,
+                                              const std::string& security)
+{
+    PolicyDevice device;
+    device.vendor     = readID(dir, attr::vendorID);
+    device.device     = readID(dir, attr::deviceID);
+    device.vendorName = readAttribute(dir, attr::vendorName);
+    device.deviceName = readAttribute(dir, attr::deviceName);
+    device.domain     = routeString.substr(0, routeString.find('-'));
+    device.security   = security;
+    device.depth      = routeDepth(routeString);
+    return device;
+}
+
+constexpr unsigned tbtadm::Policy::maxDepth;
+
+tbtadm::Policy::Policy(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    std::string line;
+    for (unsigned num = 1; std::getline(file, line); ++num)
+    {
+        auto fail = [&](const std::string& message) {
+            return std::runtime_error(path.string() + ':' + std::to_string(num)
+                                      + ": " + message);
+        };
+
+        std::vector<std::string> tokens;
+        try
+        {
+            tokens = tokenize(line);
+        }
+        catch (std::invalid_argument& e)
+        {
+            throw fail(e.what());
+        }
+        if (tokens.empty() || tokens[0][0] == '#')
+        {
+            continue;
+        }
+
+        Rule rule;
+        rule.line = num;
+        rule.text = line.substr(line.find_first_not_of(" \t"));
+        if (tokens[0] == allowKeyword)
+        {
+            rule.decision = Decision::Allow;
+        }
+        else if (tokens[0] == denyKeyword)
+        {
+            rule.decision = Decision::Deny;
+        }
+        else
+        {
+            throw fail("expected allow or deny, not " + tokens[0]);
+        }
+
+        std::array<std::string, FieldCount> values;
+        unsigned fields = 0;
+        unsigned depth  = maxDepth;
+        for (size_t i = 1; i < tokens.size(); ++i)
+        {
+            const auto& token = tokens[i];
+            auto equals       = token.find('=');
+            if (equals == std::string::npos)
+            {
+                throw fail("expected <condition>=<value>, not " + token);
+            }
+            const auto name  = token.substr(0, equals);
+            const auto value = token.substr(equals + 1);
+            try
+            {
+                if (name == maxDepthName)
+                {
+                    depth = std::min<unsigned long>(std::stoul(value),
+                                                    maxDepth);
+                    continue;
+                }
+                auto field = std::find(
+                                 fieldNames.begin(), fieldNames.end(), name)
+                             - fieldNames.begin();
+                if (field == FieldCount)
+                {
+                    throw fail("unknown condition " + name);
+                }
+                values[field] = field == Vendor || field == Device
+                                    ? normalizeID(value)
+                                    : value;
+                fields |= 1u << field;
+                const auto secure = securityLevelNames[SECURITY_LEVEL_SECURE];
+                rule.secure |= field == Security && value == secure;
+            }
+            catch (std::logic_error&)
+            {
+                throw fail("invalid value for " + name + ": " + value);
+            }
+        }
+
+        compile(std::move(rule), values, fields, depth);
+    }
+}
+
+std::string
+tbtadm::Policy::key(unsigned fields,
+                    const std::array<std::string, FieldCount>& values)
+{
+    std::string key;
+    for (unsigned field = 0; field < FieldCount; ++field)
+    {
+        if (fields & (1u << field))
+        {
+            key += values[field] + '\0';
+        }
+    }
+    return key;
+}
+
+void tbtadm::Policy::compile(Rule rule,
+                             const std::array<std::string, FieldCount>& values,
+                             unsigned fields,
+                             unsigned depth)
+{
+    auto group = std::find_if(m_groups.begin(),
+                              m_groups.end(),
+                              [fields](const Group& group) {
+                                  return group.fields == fields;
+                              });
+    if (group == m_groups.end())
+    {
+        m_groups.push_back({fields, {}});
+        group = m_groups.end() - 1;
+    }
+
+    auto inserted = group->buckets.emplace(key(fields, values), Bucket());
+    auto& bucket  = inserted.first->second;
+    if (inserted.second)
+    {
+        bucket.fill(-1);
+    }
+
+    // Rules are compiled in order, so an earlier rule is never overridden
+    const int index = m_rules.size();
+    for (unsigned d = 0; d <= depth; ++d)
+    {
+        if (bucket[d] == -1)
+        {
+            bucket[d] = index;
+        }
+    }
+    m_rules.push_back(std::move(rule));
+}
+
+const tbtadm::Policy::Rule*
+tbtadm::Policy::match(const PolicyDevice& device) const
+{
+    const std::array<std::string, FieldCount> values = {{device.vendor,
+                                                         device.device,
+                                                         device.vendorName,
+                                                         device.deviceName,
+                                                         device.domain,
+                                                         device.security}};
+    const auto depth = std::min(device.depth, maxDepth);
+
+    int first = -1;
+    for (const auto& group : m_groups)
+    {
+        auto i = group.buckets.find(key(group.fields, values));
+        if (i == group.buckets.end())
+        {
+            continue;
+        }
+        auto index = i->second[depth];
+        if (index != -1 && (first == -1 || index < first))
+        {
+            first = index;
+        }
+    }
+    return first == -1 ? nullptr : &m_rules[first];
+}
@@ -0,0 +1,160 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/// The properties of a device that policy rules can match on
+struct PolicyDevice
+{
+    std::string vendor;     ///< vendor ID, as in sysfs (e.g. "0x8086")
+    std::string device;     ///< device ID
+    std::string vendorName;
+    std::string deviceName;
+    std::string domain;     ///< domain number, e.g. "0"
+    std::string security;   ///< domain security level, e.g. "user"
+    unsigned depth = 0;     ///< hops from the host, see routeDepth()
+};
+
+/**
+ * @brief Reads the policy properties of a connected device
+ *
+ * @param dir           the sysfs directory of the device
+ * @param routeString   its route-string
+ * @param security      the security attribute of its domain
+ */
+PolicyDevice readPolicyDevice(const Directory& dir,
+                              const std::string& routeString,
+                              const std::string& security);
+
+/**
+ * @brief Auto-approval rules by device model rather than by UUID
+ *
+ * The policy file has a rule per line, "allow" or "deny" followed by any
+ * number of conditions, all of which must hold:
+ *
+ *     allow vendor=0x8086 device=0x1234 max-depth=2
+ *     deny vendor-name="Evil Corp"
+ *
+ * The conditions are vendor, device (IDs), vendor-name, device-name, domain,
+ * security (e.g. user) and max-depth. The first matching rule decides; ACL
+ * entries take precedence over the policy.
+ *
+ * A device the policy allows is authorized with no key, so in a secure (SL2)
+ * domain only allow rules that say security=secure apply; any other allow
+ * rule matching there leaves the device unauthorized.
+ *
+ * The rules are compiled on load into a decision table: rules are grouped by
+ * the set of fields they check, and every group is a hash table from the
+ * values of those fields to the first matching rule at every depth. Looking a
+ * device up takes a single hash lookup per group, whatever the number of
+ * rules.
+ */
+class Policy
+{
+public:
+    enum class Decision
+    {
+        Allow,
+        Deny
+    };
+
+    struct Rule
+    {
+        Decision decision;
+        unsigned line;       ///< in the policy file
+        std::string text;    ///< as written in the policy file
+        bool secure = false; ///< whether it says security=secure
+    };
+
+    /// Default location of the policy file
+    static const boost::filesystem::path defaultPath;
+
+    /**
+     * @brief Loads and compiles the policy file
+     *
+     * A missing file means an empty policy; a malformed one throws, naming the
+     * offending line.
+     */
+    explicit Policy(const boost::filesystem::path& path = defaultPath);
+
+    /// Returns the first rule matching the device, or null if none does
+    const Rule* match(const PolicyDevice& device) const;
+
+    bool empty() const { return m_rules.empty(); }
+
+private:
+    enum Field
+    {
+        Vendor,
+        Device,
+        VendorName,
+        DeviceName,
+        Domain,
+        Security,
+        FieldCount
+    };
+
+    /// Devices deeper than that are matched as if they were that deep
+    static constexpr unsigned maxDepth = 6;
+
+    /// The first rule (index) matching at every depth, -1 for none
+    using Bucket = std::array<int, maxDepth + 1>;
+
+    struct Group
+    {
+        unsigned fields; ///< bit mask of Field
+        std::unordered_map<std::string, Bucket> buckets;
+    };
+
+    /// The values of the given fields of the device, as a table key
+    static std::string key(unsigned fields,
+                           const std::array<std::string, FieldCount>& values);
+
+    void compile(Rule rule,
+                 const std::array<std::string, FieldCount>& values,
+                 unsigned fields,
+                 unsigned depth);
+
+    std::vector<Rule> m_rules;
+    std::vector<Group> m_groups;
+};
+} // namespace tbtadm
@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "sysfs.h"
+
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+#include "directory.h"
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string domainPrefix = "domain";
+
+/* Trim right characters */
+std::string rtrim(const std::string& str, const std::string& chars = " \n\r")
+{
+    return str.substr(0, str.find_last_not_of(chars) + 1);
+}
+
+/// Splits a route-string to the domain part (with the '-') and the route
+std::pair<std::string, unsigned long long>
+splitRouteString(const std::string& routeString)
+{
+    auto dash = routeString.find('-');
+    return {routeString.substr(0, dash + 1),
+            std::stoull(routeString.substr(dash + 1), nullptr, 16)};
+}
+} // namespace
+
+int tbtadm::parseSecurityLevel(const char* security, size_t size)
+{
+    int level = 0;
+    for (const auto* name : securityLevelNames)
+    {
+        if (std::strlen(name) == size && !std::memcmp(name, security, size))
+        {
+            return level;
+        }
+        ++level;
+    }
+    return -1;
+}
+
+int tbtadm::parseSecurityLevel(const std::string& security)
+{
+    return parseSecurityLevel(security.data(), security.size());
+}
+
+std::string tbtadm::readAndTrim(const fs::path& path)
+{
+    File file(path, File::Mode::Read);
+    return rtrim(file.read());
+}
+
+std::string tbtadm::readAndTrim(const Directory& dir, const std::string& name)
+{
+    File file(dir, name, File::Mode::Read);
+    return rtrim(file.read());
+}
+
+fs::path tbtadm::findDomain(const fs::path& device)
+{
+    for (auto path = device; !path.empty(); path = path.parent_path())
+    {
+        if (path.filename().string().compare(
+                0, domainPrefix.size(), domainPrefix)
+            == 0)
+        {
+            return path;
+        }
+    }
+    return {};
+}
+
+unsigned tbtadm::routeDepth(const std::string& routeString)
+{
+    unsigned depth = 0;
+    for (auto route = splitRouteString(routeString).second; route; route >>= 8)
+    {
+        ++depth;
+    }
+    return depth;
+}
+
+std::string tbtadm::parentRouteString(const std::string& routeString)
+{
+    auto split = splitRouteString(routeString);
+    auto depth = routeDepth(routeString);
+    auto route = depth ? split.second & ~(0xffULL << 8 * (depth - 1)) : 0;
+
+    std::ostringstream parent;
+    parent << split.first << std::hex << route;
+    return parent.str();
+}
+
+size_t tbtadm::domainNumLength(const char* name)
+{
+    size_t length = 0;
+    while (std::isdigit(static_cast<unsigned char>(name[length])))
+    {
+        ++length;
+    }
+    return name[length] == '-' ? length : 0;
+}
+
+bool tbtadm::isRouteString(const char* name)
+{
+    // A single '-', so a UUID starting with decimal digits isn't taken for one
+    const auto length = domainNumLength(name);
+    return length && !std::strchr(name + length + 1, '-')
+           && !std::strchr(name, '.');
+}
+
+bool tbtadm::isHostRouteString(const char* name)
+{
+    const auto length = domainNumLength(name);
+    return length && name[length + 1] == '0' && !name[length + 2];
+}
+
+bool tbtadm::isConnectedRouteString(const char* name)
+{
+    return isRouteString(name) && !isHostRouteString(name);
+}
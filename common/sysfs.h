@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/// Security levels, as numbered by the kernel
+enum security_level
+{
+    SECURITY_LEVEL_NONE = 0,
+    SECURITY_LEVEL_USER,
+    SECURITY_LEVEL_SECURE,
+    SECURITY_LEVEL_DPONLY,
+};
+
+/// The names of the security levels in sysfs, by security_level
+constexpr const char* securityLevelNames[] = {"none", "user", "secure",
+                                              "dponly"};
+
+/**
+ * @brief Parses the content of the domain "security" attribute
+ *
+ * @return one of security_level, or -1 if it's unknown
+ */
+int parseSecurityLevel(const char* security, size_t size);
+
+int parseSecurityLevel(const std::string& security);
+
+/// Reads the given sysfs attribute, without trailing whitespace
+std::string readAndTrim(const boost::filesystem::path& path);
+
+/// Reads the given sysfs attribute relative to the given directory, without
+/// trailing whitespace
+std::string readAndTrim(const Directory& dir, const std::string& name);
+
+/**
+ * @brief Finds the domain a device belongs to
+ *
+ * @param device    sysfs path of the device, with the domain as an ancestor
+ *                  (e.g. a devpath-based path, not the bus symlink)
+ *
+ * @return the domain directory, empty if not found
+ */
+boost::filesystem::path findDomain(const boost::filesystem::path& device);
+
+/**
+ * @brief The depth of a device in the topology, by its route-string
+ *
+ * Every byte of the route (hex, after the domain number) is a port on the
+ * way from the host, so e.g. "0-301" is 2 hops away from the host "0-0".
+ */
+unsigned routeDepth(const std::string& routeString);
+
+/// The route-string of the parent of a device, e.g. "0-1" for "0-301"
+std::string parentRouteString(const std::string& routeString);
+
+// Name filters for scanning sysfs (see Directory::Filter); they work on the
+// raw entry names so no string is allocated for entries that aren't
+// interesting
+
+/// The length of the domain number the name starts with, 0 if it isn't
+/// followed by a '-' (as in route-strings and XDomain service names)
+size_t domainNumLength(const char* name);
+
+/// A route-string, e.g. "0-301", but not an XDomain service like "0-1.1"
+bool isRouteString(const char* name);
+
+/// The route-string of a host, e.g. "0-0"
+bool isHostRouteString(const char* name);
+
+/// The route-string of a device or an XDomain, i.e. not of a host
+bool isConnectedRouteString(const char* name);
+} // namespace tbtadm
@@ -0,0 +1,467 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "acl.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <syslog.h>
+
+#include "aclstore.h"
+#include "directory.h"
+#include "file.h"
+#include "metrics.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string authorizedFilename = "authorized";
+const std::string keyFilename        = "key";
+const std::string uniqueIdFilename   = "unique_id";
+const std::string vendorFilename     = "vendor_name";
+const std::string deviceFilename     = "device_name";
+const std::string ueventFilename     = "uevent";
+const std::string deviceType         = "DEVTYPE=thunderbolt_device";
+
+/// A device that failed that many times in the window gets no more attempts
+const unsigned maxFailures      = 5;
+const std::chrono::seconds failuresWindow(30);
+
+// Event outcomes, for the metrics
+const std::string outcomeAuthorized  = "authorized";
+const std::string outcomePlanned     = "authorized_by_plan";
+const std::string outcomeFailed      = "failed";
+const std::string outcomeNotInACL    = "not_in_acl";
+const std::string outcomeAlready     = "already_authorized";
+const std::string outcomeDuplicate   = "duplicate";
+const std::string outcomeGone        = "gone";
+const std::string outcomeRateLimited = "rate_limited";
+const std::string outcomeCoalesced   = "coalesced";
+const std::string outcomePolicy      = "policy_allowed";
+const std::string outcomeDenied      = "policy_denied";
+
+void log(int priority, const std::string& message)
+{
+    syslog(priority, "%s", message.c_str());
+}
+
+/// The modification time of an ACL entry tells when it was last used, so
+/// tbtadm can keep the most relevant entries in the boot ACL
+void markUsed(tbtadm::AclStore& store, const std::string& uuid)
+{
+    try
+    {
+        store.touch(uuid);
+    }
+    catch (std::system_error& e)
+    {
+        log(LOG_WARNING, "can't update ACL entry " + uuid + ": " + e.what());
+    }
+}
+
+/// Logs a failure to export the metrics, if any
+void checkMetrics(const std::string& failure)
+{
+    if (!failure.empty())
+    {
+        log(LOG_WARNING, "can't export metrics: " + failure);
+    }
+}
+
+/// Reads a name the way tbtadm does for its device listing
+std::string readName(const tbtadm::Directory& dir,
+                     const std::string& name,
+                     const std::string& type)
+{
+    try
+    {
+        auto res = readAndTrim(dir, name);
+        if (!res.empty())
+        {
+            return res;
+        }
+    }
+    catch (std::runtime_error&)
+    {
+        // assuming this is from an empty file
+    }
+    return "Unknown " + type;
+}
+
+bool isChildDevice(const char* name)
+{
+    return std::strchr(name, '-') && name[0] != '.';
+}
+} // namespace
+
+tbtadm::AclHandler::AclHandler(AclStore& store,
+                               const Directory* snapshot,
+                               BootPlan& plan,
+                               const fs::path& run,
+                               const Policy& policy,
+                               DeviceCache& cache)
+    : m_store(store),
+      m_acl(snapshot),
+      m_plan(plan),
+      m_coalescer(run),
+      m_limiter(run, maxFailures, failuresWindow),
+      m_connections(run),
+      m_policy(policy),
+      m_cache(cache),
+      m_metrics(false)
+{
+}
+
+void tbtadm::AclHandler::added(const fs::path& device)
+{
+    auto domain = findDomain(device);
+    int sl;
+    try
+    {
+        sl = securityLevel(domain);
+    }
+    catch (std::system_error&)
+    {
+        // The whole domain was removed since the event
+        log(LOG_INFO, domain.string() + " is gone");
+        checkMetrics(m_metrics.event("add", outcomeGone));
+        return;
+    }
+    handle("add", device, domain, sl);
+}
+
+void tbtadm::AclHandler::changed(const fs::path& device)
+{
+    auto domain = findDomain(device);
+    int sl;
+    std::unique_ptr<Directory> children;
+    try
+    {
+        sl       = securityLevel(domain);
+        children = std::make_unique<Directory>(device, isChildDevice);
+    }
+    catch (std::system_error&)
+    {
+        log(LOG_INFO, device.string() + " is gone");
+        checkMetrics(m_metrics.event("change", outcomeGone));
+        return;
+    }
+
+    bool found = false;
+    for (const auto& child : *children)
+    {
+        if (!child.isDirectory())
+        {
+            continue;
+        }
+        const auto path = device / child.name();
+        try
+        {
+            Directory dir(path);
+            if (!dir.exists(ueventFilename)
+                || File(dir, ueventFilename, File::Mode::Read)
+                           .read()
+                           .find(deviceType + '\n')
+                       == std::string::npos)
+            {
+                continue;
+            }
+            found = true;
+            if (readAndTrim(dir, authorizedFilename) != "0")
+            {
+                continue;
+            }
+        }
+        catch (std::system_error&)
+        {
+            continue;
+        }
+        handle("change", path, domain, sl);
+    }
+
+    if (!found)
+    {
+        log(LOG_INFO, "no childs found");
+    }
+}
+
+void tbtadm::AclHandler::handle(const std::string& action,
+                                const fs::path& device,
+                                const fs::path& domain,
+                                int sl)
+{
+    // The authorization and the event make a single metrics update
+    checkMetrics(m_metrics.batch([&] {
+        m_metrics.event(action, coalesce(device, domain, sl));
+    }));
+}
+
+std::string tbtadm::AclHandler::coalesce(const fs::path& device,
+                                         const fs::path& domain,
+                                         int sl)
+{
+    std::string uuid;
+    try
+    {
+        uuid = readAndTrim(device / uniqueIdFilename);
+    }
+    catch (std::system_error&)
+    {
+    }
+    if (uuid.empty())
+    {
+        log(LOG_INFO, device.string() + " is gone");
+        return outcomeGone;
+    }
+
+    std::string outcome = outcomeCoalesced;
+    if (!m_coalescer.run(uuid, [&] {
+            // A re-run for a coalesced event usually finds the device
+            // authorized by the previous one, which is the outcome
+            auto result = authorize(device, domain, sl, uuid);
+            if (outcome == outcomeCoalesced || result != outcomeAlready)
+            {
+                outcome = result;
+            }
+        }))
+    {
+        log(LOG_INFO, "coalesced with the running handling of " + uuid);
+    }
+    return outcome;
+}
+
+std::string tbtadm::AclHandler::authorize(const fs::path& device,
+                                          const fs::path& domain,
+                                          int sl,
+                                          const std::string& uuid)
+{
+    // The device may have been handled already, by a coalesced event, or be
+    // gone since the event
+    std::unique_ptr<Directory> dir;
+    try
+    {
+        dir = std::make_unique<Directory>(device);
+        if (readAndTrim(*dir, uniqueIdFilename) != uuid)
+        {
+            return outcomeGone;
+        }
+        if (readAndTrim(*dir, authorizedFilename) != "0")
+        {
+            return outcomeAlready;
+        }
+        if (m_connections.authorized(uuid, *dir))
+        {
+            log(LOG_INFO, "already authorized on this connection");
+            return outcomeDuplicate;
+        }
+    }
+    catch (std::system_error&)
+    {
+        log(LOG_INFO, "can't access " + device.string());
+        return outcomeGone;
+    }
+
+    // A device where the plan expects it needs no ACL lookup: the plan is
+    // only loaded for the ACL snapshot it was made from
+    const auto routeString = device.filename().string();
+    const auto* expected   = m_plan.find(routeString);
+    const bool planned     = expected && expected->uuid == uuid
+                         && expected->domain == domain.string()
+                         && expected->sl == sl;
+    const bool inACL = planned || (m_acl && m_acl->exists(uuid));
+
+    const Policy::Rule* rule = nullptr;
+    if (!inACL)
+    {
+        if (!m_policy.empty())
+        {
+            rule = m_policy.match(readPolicyDevice(
+                *dir, routeString, readAndTrim(domain / "security")));
+        }
+        if (!rule)
+        {
+            log(LOG_INFO, "not in ACL");
+            return outcomeNotInACL;
+        }
+        log(LOG_INFO,
+            "not in ACL, policy line " + std::to_string(rule->line) + ": "
+                + rule->text);
+        if (rule->decision == Policy::Decision::Deny)
+        {
+            return outcomeDenied;
+        }
+        if (sl == SECURITY_LEVEL_SECURE && !rule->secure)
+        {
+            log(LOG_INFO, "the rule doesn't say security=secure, not in SL2");
+            return outcomeNotInACL;
+        }
+    }
+
+    if (!m_limiter.allow(uuid))
+    {
+        log(LOG_WARNING, "too many failed authorizations of " + uuid);
+        return outcomeRateLimited;
+    }
+
+    if (!inACL)
+    {
+        // Once, with no key: the policy doesn't make the device trusted for
+        // good, as an ACL entry does
+        log(LOG_INFO, "authorizing " + device.string() + " by policy");
+        if (!write(*dir, device, uuid, SECURITY_LEVEL_USER))
+        {
+            m_limiter.failed(uuid);
+            return outcomeFailed;
+        }
+        m_connections.record(uuid, *dir);
+        cacheAuthorized(*dir, routeString, uuid);
+        return outcomePolicy;
+    }
+
+    log(LOG_INFO,
+        "authorizing " + device.string() + (planned ? " by boot plan" : ""));
+    if (!write(*dir, device, uuid, sl))
+    {
+        m_limiter.failed(uuid);
+        return outcomeFailed;
+    }
+    markUsed(m_store, uuid);
+    m_connections.record(uuid, *dir);
+    cacheAuthorized(*dir, routeString, uuid);
+    if (planned)
+    {
+        return outcomePlanned;
+    }
+
+    BootPlan::Entry entry;
+    entry.routeString = routeString;
+    entry.uuid        = uuid;
+    entry.depth       = routeDepth(routeString);
+    entry.sl          = sl;
+    entry.domain      = domain.string();
+    m_plan.record(std::move(entry));
+    return outcomeAuthorized;
+}
+
+bool tbtadm::AclHandler::write(const Directory& dir,
+                               const fs::path& device,
+                               const std::string& uuid,
+                               int sl)
+{
+    const auto start  = std::chrono::steady_clock::now();
+    const auto aclKey = uuid + '/' + keyFilename;
+    if (sl == SECURITY_LEVEL_SECURE)
+    {
+        if (!dir.exists(keyFilename))
+        {
+            log(LOG_INFO, "device doesn't support SL2");
+            return false;
+        }
+        if (!m_acl->exists(aclKey))
+        {
+            log(LOG_INFO, "no key found");
+            return false;
+        }
+
+        File(dir, keyFilename, File::Mode::Write)
+            .write(File(*m_acl, aclKey, File::Mode::Read).read());
+        log(LOG_INFO, "key found");
+    }
+
+    int err = 0;
+    try
+    {
+        File(dir, authorizedFilename, File::Mode::Write)
+            .write(std::to_string(sl));
+    }
+    catch (std::system_error& e)
+    {
+        err = e.code().value();
+    }
+
+    checkMetrics(m_metrics.authorization(
+        "tbtacl", 1, std::chrono::steady_clock::now() - start, err));
+
+    log(LOG_INFO,
+        "authorization result: " + std::to_string(err) + ' '
+            + (err ? std::strerror(err) : ""));
+
+    // The device may have been authorized meanwhile by someone else (e.g.
+    // tbtadm) with a good key, and then the error says nothing about ours
+    if ((err == ENOKEY || err == EKEYREJECTED)
+        && readAndTrim(dir, authorizedFilename) == "0")
+    {
+        m_store.erase(uuid, keyFilename);
+        log(LOG_INFO, "invalid key removed, reapprove");
+        m_plan.forget(device.filename().string());
+        // Not needed if the GUI watches the ACL entry key
+        File(device / ueventFilename, File::Mode::Write).write("change");
+    }
+    return err == 0;
+}
+
+void tbtadm::AclHandler::cacheAuthorized(const Directory& dir,
+                                         const std::string& routeString,
+                                         const std::string& uuid)
+{
+    CachedDevice device;
+    device.routeString = routeString;
+    device.uuid        = uuid;
+    device.authorized  = true;
+    try
+    {
+        device.vendor = readName(dir, vendorFilename, "vendor");
+        device.device = readName(dir, deviceFilename, "device");
+        m_cache.update({device});
+    }
+    catch (std::exception& e)
+    {
+        log(LOG_WARNING,
+            std::string("can't update the device cache: ") + e.what());
+    }
+}
+
+int tbtadm::securityLevel(const fs::path& domain)
+{
+    const auto security = readAndTrim(domain / "security");
+    int sl              = parseSecurityLevel(security);
+    if (sl != SECURITY_LEVEL_USER && sl != SECURITY_LEVEL_SECURE)
+    {
+        throw std::runtime_error("SL is " + security + ", leaving...");
+    }
+    return sl;
+}
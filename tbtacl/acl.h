@@ -0,0 +1,144 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "cache.h"
+#include "coalescer.h"
+#include "metrics.h"
+#include "plan.h"
+#include "policy.h"
+
+namespace tbtadm
+{
+class AclStore;
+class Directory;
+
+/**
+ * @brief Authorizes devices found in the ACL
+ *
+ * All the accesses to a device are done relative to its opened directory
+ * (TOCTOU protection), so if an attacker replaces the device between the read
+ * of unique_id and the write of authorized, the write fails.
+ *
+ * Events of the same device are coalesced (see EventCoalescer), the failed
+ * authorization attempts of every device are rate-limited, and a device is
+ * authorized at most once per connection (see ConnectionRecord).
+ *
+ * Devices not in the ACL are authorized if the policy allows them, once (with
+ * no key and with no ACL entry added).
+ *
+ * The devices authorized are updated in the device cache of tbtadm, so
+ * 'tbtadm devices --no-wake' doesn't report them as non-authorized.
+ */
+class AclHandler
+{
+public:
+    /**
+     * @param store     the ACL, for updates
+     * @param snapshot  the ACL snapshot to read, null if there is no ACL
+     * @param plan      the boot plan
+     * @param run       the directory for the state of the running tbtacl
+     *                  instances
+     * @param policy    the auto-approval policy, for devices not in the ACL
+     * @param cache     the device cache of tbtadm
+     */
+    AclHandler(AclStore& store,
+               const Directory* snapshot,
+               BootPlan& plan,
+               const boost::filesystem::path& run,
+               const Policy& policy,
+               DeviceCache& cache);
+
+    /// A new device was attached
+    void added(const boost::filesystem::path& device);
+
+    /// The device got authorized, authorize the devices behind it
+    void changed(const boost::filesystem::path& device);
+
+private:
+    /// Handles an event of the given device, and records its outcome
+    void handle(const std::string& action,
+                const boost::filesystem::path& device,
+                const boost::filesystem::path& domain,
+                int sl);
+
+    /// Authorizes the given device, unless the event is coalesced with an
+    /// event handled by another tbtacl run; returns the outcome
+    std::string coalesce(const boost::filesystem::path& device,
+                         const boost::filesystem::path& domain,
+                         int sl);
+
+    /**
+     * @brief Authorizes the given device if it's found in the ACL, and records
+     * it in the boot plan
+     *
+     * @return the outcome, for the metrics (e.g. "authorized")
+     */
+    std::string authorize(const boost::filesystem::path& device,
+                          const boost::filesystem::path& domain,
+                          int sl,
+                          const std::string& uuid);
+
+    /**
+     * @brief Writes the key (for SL2) and the authorized attribute
+     *
+     * On a missing or rejected key, the key is removed from the ACL so the
+     * user is asked to re-approve the device.
+     */
+    bool write(const Directory& dir,
+               const boost::filesystem::path& device,
+               const std::string& uuid,
+               int sl);
+
+    /// Records the given device as authorized in the device cache
+    void cacheAuthorized(const Directory& dir,
+                         const std::string& routeString,
+                         const std::string& uuid);
+
+    AclStore& m_store;
+    const Directory* m_acl;
+    BootPlan& m_plan;
+    EventCoalescer m_coalescer;
+    RateLimiter m_limiter;
+    ConnectionRecord m_connections;
+    const Policy& m_policy;
+    DeviceCache& m_cache;
+    Metrics m_metrics; ///< the counters only, the gauges are left to tbtadm
+};
+
+/// The security level of the domain of the given device
+int securityLevel(const boost::filesystem::path& domain);
+} // namespace tbtadm
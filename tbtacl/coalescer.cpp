@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "coalescer.h"
+
+#include <cerrno>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include "directory.h"
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string lockSuffix     = ".lock";
+const std::string pendingSuffix  = ".pending";
+const std::string failuresSuffix = ".failures";
+const std::string doneSuffix     = ".done";
+
+/// How long the holder waits for the rest of a burst before handling it
+const auto settleTime = std::chrono::milliseconds(100);
+
+std::string connection(const tbtadm::Directory& device)
+{
+    struct stat st;
+    if (fstat(device.fd(), &st))
+    {
+        throw std::system_error(errno, std::generic_category(), "fstat");
+    }
+    return std::to_string(st.st_dev) + ':' + std::to_string(st.st_ino);
+}
+} // namespace
+
+tbtadm::EventCoalescer::EventCoalescer(fs::path dir) : m_dir(std::move(dir))
+{
+}
+
+bool tbtadm::EventCoalescer::run(const std::string& uuid,
+                                 const std::function<void()>& work)
+{
+    const auto lockPath    = m_dir / (uuid + lockSuffix);
+    const auto pendingPath = m_dir / (uuid + pendingSuffix);
+
+    bool handled = false;
+    while (true)
+    {
+        auto lock = std::make_unique<FileLock>(lockPath, false);
+        if (!lock->locked())
+        {
+            // The holder checks for the mark after releasing the lock, so if
+            // it's gone by now, the device is ours
+            File(pendingPath, File::Mode::Write, O_CREAT, S_IRUSR | S_IWUSR);
+            lock = std::make_unique<FileLock>(lockPath, false);
+            if (!lock->locked())
+            {
+                return handled;
+            }
+        }
+
+        // The events of a burst come from parallel udev workers within a few
+        // ms; the ones arriving now only leave their mark, and the work below
+        // covers them along with all the events up to now
+        std::this_thread::sleep_for(settleTime);
+        fs::remove(pendingPath);
+        work();
+        handled = true;
+
+        lock.reset();
+        if (!fs::exists(pendingPath))
+        {
+            return true;
+        }
+    }
+}
+
+tbtadm::RateLimiter::RateLimiter(fs::path dir,
+                                 unsigned maxFailures,
+                                 std::chrono::seconds window)
+    : m_dir(std::move(dir)), m_maxFailures(maxFailures), m_window(window)
+{
+}
+
+bool tbtadm::RateLimiter::allow(const std::string& uuid) const
+{
+    return recentFailures(uuid).size() < m_maxFailures;
+}
+
+void tbtadm::RateLimiter::failed(const std::string& uuid)
+{
+    auto failures = recentFailures(uuid);
+    failures.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count());
+    while (failures.size() > m_maxFailures)
+    {
+        failures.pop_front();
+    }
+
+    std::ostringstream out;
+    for (auto failure : failures)
+    {
+        out << failure << '\n';
+    }
+    writeAtomically(
+        m_dir / (uuid + failuresSuffix), out.str(), S_IRUSR | S_IWUSR);
+}
+
+std::deque<std::chrono::nanoseconds::rep>
+tbtadm::RateLimiter::recentFailures(const std::string& uuid) const
+{
+    using namespace std::chrono;
+
+    // steady_clock is the same for all processes (CLOCK_MONOTONIC)
+    const auto now =
+        duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+            .count();
+
+    std::deque<nanoseconds::rep> failures;
+    std::ifstream file((m_dir / (uuid + failuresSuffix)).string());
+    nanoseconds::rep failure;
+    while (file >> failure)
+    {
+        if (now - failure < m_window.count())
+        {
+            failures.push_back(failure);
+        }
+    }
+    return failures;
+}
+
+tbtadm::ConnectionRecord::ConnectionRecord(fs::path dir) : m_dir(std::move(dir))
+{
+}
+
+bool tbtadm::ConnectionRecord::authorized(const std::string& uuid,
+                                          const Directory& device) const
+{
+    std::ifstream file((m_dir / (uuid + doneSuffix)).string());
+    std::string recorded;
+    return std::getline(file, recorded) && recorded == connection(device);
+}
+
+void tbtadm::ConnectionRecord::record(const std::string& uuid,
+                                      const Directory& device)
+{
+    writeAtomically(m_dir / (uuid + doneSuffix),
+                    connection(device) + '\n',
+                    S_IRUSR | S_IWUSR);
+}
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief Coalesces the events of a device that arrive while it's handled
+ *
+ * udev runs tbtacl for every uevent, in parallel workers, so a bouncing cable
+ * or dock produces bursts of runs for the same devices. Only one run handles a
+ * device (by UUID) at a time, holding a lock file; a run that finds the device
+ * held leaves a "pending" mark and exits right away, and the holder handles the
+ * device once more before it leaves if the mark is there. That way no event is
+ * lost, but a burst costs at most two rounds of work.
+ *
+ * The holder lets the device settle for a short while (100 ms) before each
+ * round, so the events of a burst that arrive right after the first one are
+ * merged into that round too, rather than only those arriving while the work
+ * is already running.
+ *
+ * The state is kept under /run, so it doesn't survive a reboot.
+ */
+class EventCoalescer
+{
+public:
+    explicit EventCoalescer(boost::filesystem::path dir);
+
+    /**
+     * @brief Runs the work for the device, unless another run holds it
+     *
+     * @return false if the work was left to the run holding the device
+     */
+    bool run(const std::string& uuid, const std::function<void()>& work);
+
+private:
+    const boost::filesystem::path m_dir;
+};
+
+/**
+ * @brief Limits the failed authorization attempts of a device
+ *
+ * A device that keeps failing gets no more attempts once it failed the given
+ * number of times in the given window; a device that keeps reconnecting (and
+ * succeeding) isn't limited, ConnectionRecord already makes that one attempt
+ * per connection.
+ */
+class RateLimiter
+{
+public:
+    RateLimiter(boost::filesystem::path dir,
+                unsigned maxFailures,
+                std::chrono::seconds window);
+
+    /**
+     * @brief Checks if an attempt is allowed now
+     *
+     * Must be called with the device held (see EventCoalescer::run()).
+     */
+    bool allow(const std::string& uuid) const;
+
+    /// Records a failed attempt, with the device held
+    void failed(const std::string& uuid);
+
+private:
+    /// The failures in the window, oldest first
+    std::deque<std::chrono::nanoseconds::rep>
+    recentFailures(const std::string& uuid) const;
+
+    const boost::filesystem::path m_dir;
+    const unsigned m_maxFailures;
+    const std::chrono::nanoseconds m_window;
+};
+
+/**
+ * @brief Remembers the connection each device was authorized on
+ *
+ * A connection is identified by the inode of the device sysfs directory, which
+ * the kernel creates anew whenever the device shows up. A device is authorized
+ * at most once per connection: by then the other events of the connection
+ * (e.g. the parent's change event looping over its children) are redundant,
+ * and if the device reads as deauthorized later on, it was deauthorized on
+ * purpose.
+ */
+class ConnectionRecord
+{
+public:
+    explicit ConnectionRecord(boost::filesystem::path dir);
+
+    /// Checks if the device was authorized on its current connection
+    bool authorized(const std::string& uuid, const Directory& device) const;
+
+    /// Records that the device was authorized on its current connection
+    void record(const std::string& uuid, const Directory& device);
+
+private:
+    const boost::filesystem::path m_dir;
+};
+} // namespace tbtadm
@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <syslog.h>
+
+#include "acl.h"
+#include "aclstore.h"
+#include "cache.h"
+#include "directory.h"
+#include "plan.h"
+#include "policy.h"
+
+/*
+ * Triggered by udev (see tbtacl.rules) on device addition and authorization:
+ *
+ *     tbtacl add|change <devpath>
+ */
+
+namespace
+{
+const std::string acltree   = "/var/lib/thunderbolt/acl";
+const std::string planFile  = "/var/lib/thunderbolt/boot.plan";
+const std::string cacheFile = "/var/lib/thunderbolt/devices.cache";
+const std::string runDir    = "/run/thunderbolt/tbtacl";
+} // namespace
+
+int main(int argc, char* argv[]) try
+{
+    openlog("tbtacl", LOG_PID, LOG_DAEMON);
+
+    if (argc != 3)
+    {
+        std::cerr << "Usage: tbtacl add|change <devpath>\n";
+        return EXIT_FAILURE;
+    }
+    const std::string action = argv[1];
+    const std::string device = std::string("/sys") + argv[2];
+    syslog(LOG_INFO, "args: %s %s", argv[1], argv[2]);
+
+    // Everything is read relative to the snapshot that is current now, so
+    // concurrent ACL updates are never seen half-way
+    tbtadm::AclStore store(acltree);
+    const auto snapshot = store.open();
+    // A malformed policy mustn't stop the ACL-based authorization
+    const auto policy = [] {
+        try
+        {
+            return tbtadm::Policy();
+        }
+        catch (std::exception& e)
+        {
+            syslog(LOG_ERR, "ignoring the policy: %s", e.what());
+            return tbtadm::Policy(boost::filesystem::path());
+        }
+    }();
+    if (!snapshot && policy.empty())
+    {
+        syslog(LOG_INFO, "no ACL");
+        return EXIT_SUCCESS;
+    }
+
+    tbtadm::BootPlan plan(planFile, snapshot.get());
+    tbtadm::DeviceCache cache(cacheFile);
+    tbtadm::AclHandler handler(
+        store, snapshot.get(), plan, runDir, policy, cache);
+    if (action == "add")
+    {
+        handler.added(device);
+    }
+    else if (action == "change")
+    {
+        handler.changed(device);
+    }
+    else
+    {
+        syslog(LOG_INFO, "unhandled action: %s", action.c_str());
+        return EXIT_FAILURE;
+    }
+}
+catch (std::system_error& e)
+{
+    syslog(LOG_ERR, "%s", e.what());
+    std::cerr << e.code() << ' ' << e.what() << '\n';
+    return e.code().value();
+}
+catch (std::exception& e)
+{
+    syslog(LOG_INFO, "%s", e.what());
+    std::cerr << "Exception: " << e.what() << '\n';
+    return EXIT_FAILURE;
+}
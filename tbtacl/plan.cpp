@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "plan.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "directory.h"
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const char separator         = '\t';
+const std::string magic      = "# tbtacl boot plan v2";
+const std::string aclKeyword = "acl ";
+const std::string lockSuffix = ".lock";
+
+/// Identifies a published ACL snapshot
+std::string stamp(const tbtadm::Directory& acl)
+{
+    struct stat st;
+    if (::fstat(acl.fd(), &st))
+    {
+        return {};
+    }
+
+    std::ostringstream out;
+    out << st.st_ino << ':' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+    return out.str();
+}
+
+bool operator==(const tbtadm::BootPlan::Entry& a,
+                const tbtadm::BootPlan::Entry& b)
+{
+    return a.routeString == b.routeString && a.uuid == b.uuid
+           && a.depth == b.depth && a.sl == b.sl && a.domain == b.domain;
+}
+} // namespace
+
+tbtadm::BootPlan::BootPlan(fs::path path, const Directory* acl)
+    : m_path(std::move(path)), m_acl(acl)
+{
+}
+
+void tbtadm::BootPlan::load()
+{
+    m_loaded = true;
+    m_entries.clear();
+
+    std::ifstream file(m_path.string());
+    std::string line;
+    if (!std::getline(file, line) || line != magic)
+    {
+        return;
+    }
+
+    // Made from another ACL snapshot, nothing can be trusted
+    if (!std::getline(file, line) || line != aclKeyword + stamp(*m_acl))
+    {
+        return;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        Entry entry;
+        std::string depth, sl;
+        if (std::getline(stream, entry.routeString, separator)
+            && std::getline(stream, entry.uuid, separator)
+            && std::getline(stream, depth, separator)
+            && std::getline(stream, sl, separator)
+            && std::getline(stream, entry.domain))
+        {
+            try
+            {
+                entry.depth = std::stoul(depth);
+                entry.sl    = std::stoi(sl);
+            }
+            catch (std::exception&)
+            {
+                continue;
+            }
+            m_entries[entry.routeString] = std::move(entry);
+        }
+    }
+}
+
+const tbtadm::BootPlan::Entry*
+tbtadm::BootPlan::find(const std::string& routeString)
+{
+    if (!m_acl)
+    {
+        return nullptr;
+    }
+    if (!m_loaded)
+    {
+        load();
+    }
+    auto entry = m_entries.find(routeString);
+    return entry == m_entries.end() ? nullptr : &entry->second;
+}
+
+void tbtadm::BootPlan::record(Entry entry)
+{
+    update([&entry](auto& entries) {
+        auto& recorded = entries[entry.routeString];
+        if (recorded == entry)
+        {
+            return false;
+        }
+        recorded = std::move(entry);
+        return true;
+    });
+}
+
+void tbtadm::BootPlan::forget(const std::string& routeString)
+{
+    update([&routeString](auto& entries) {
+        return entries.erase(routeString) != 0;
+    });
+}
+
+template <typename Change>
+void tbtadm::BootPlan::update(Change change)
+{
+    FileLock lock(m_path.string() + lockSuffix);
+    load();
+    if (change(m_entries))
+    {
+        save();
+    }
+}
+
+void tbtadm::BootPlan::save() const
+{
+    std::ostringstream content;
+    content << magic << '\n' << aclKeyword << stamp(*m_acl) << '\n';
+    for (const auto& entry : m_entries)
+    {
+        const auto& e = entry.second;
+        content << e.routeString << separator << e.uuid << separator << e.depth
+                << separator << e.sl << separator << e.domain << '\n';
+    }
+
+    writeAtomically(m_path, content.str(), S_IRUSR | S_IWUSR);
+}
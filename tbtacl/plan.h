@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtacl tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief The devices authorized on previous boots, by route-string
+ *
+ * Desks usually boot into the same chain of devices, so every device tbtacl
+ * authorizes is recorded here. When a device appears at a recorded
+ * route-string with the recorded UUID, it's authorized based on the plan
+ * without looking its ACL entry up again.
+ *
+ * The plan is only trusted for the ACL snapshot it was made from (see
+ * AclStore): snapshots never change once published, so a single fstat of the
+ * snapshot directory tells whether all the entries still hold, and any ACL
+ * update discards the whole plan.
+ *
+ * The file is line based: a magic line, "acl <stamp>" and then a line per
+ * device with the fields of Entry separated by tabs.
+ */
+class BootPlan
+{
+public:
+    struct Entry
+    {
+        std::string routeString;
+        std::string uuid;
+        unsigned depth = 0;
+        int sl         = -1;
+        std::string domain; // sysfs path of the domain
+    };
+
+    /**
+     * @param path  the plan file
+     * @param acl   the ACL snapshot, null if there is no ACL
+     */
+    BootPlan(boost::filesystem::path path, const Directory* acl);
+
+    /// The expected device at the given route-string, if any; the plan is
+    /// loaded on first use
+    const Entry* find(const std::string& routeString);
+
+    /**
+     * @brief Records an authorized device
+     *
+     * The plan file is re-read and written under a lock, so concurrent
+     * events don't lose each other's updates. Nothing is written if the
+     * device is already recorded as is.
+     */
+    void record(Entry entry);
+
+    /// Forgets the device at the given route-string
+    void forget(const std::string& routeString);
+
+private:
+    /// Loads the plan; a missing or outdated plan means an empty one
+    void load();
+
+    /// Re-reads the plan, applies the given change and writes it if the
+    /// change returns true, under lock
+    template <typename Change>
+    void update(Change change);
+
+    void save() const;
+
+    const boost::filesystem::path m_path;
+    const Directory* m_acl;
+    bool m_loaded = false;
+    std::map<std::string, Entry> m_entries;
+};
+} // namespace tbtadm
@@ -1,56 +0,0 @@
-/*******************************************************************************
-* Thunderbolt(TM) tbtacl tool
-* This code is distributed under the following BSD-style license:
-*
-* Copyright(c) 2017 Intel Corporation.
-*
-* Redistribution and use in source and binary forms, with or without
-* modification, are permitted provided that the following conditions are met:
-*
-*     * Redistributions of source code must retain the above copyright notice,
-*       this list of conditions and the following disclaimer.
-*     * Redistributions in binary form must reproduce the above copyright
-*       notice, this list of conditions and the following disclaimer in the
-*       documentation and/or other materials provided with the distribution.
-*     * Neither the name of Intel Corporation nor the names of its contributors
-*       may be used to endorse or promote products derived from this software
-*       without specific prior written permission.
-*
-* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
-* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
-* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
-* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
-* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
-* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
-* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
-* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
-* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
-* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
-* POSSIBILITY OF SUCH DAMAGE.
-*******************************************************************************/
-
-#include "file.h"
-
-/*
- * The reason for this file, instead of writing the file directly from tbtacl
- * script is because shell returns a generic error for all errors, but tbtacl
- * cares about the exact errno returned from driver (see there).
- *
- * This file is intended to be used from tbtacl script only so no (direct) input
- * validation is done, besides what already done inside File class
- * implementation.
- */
-
-int main(int /*argc*/, char* argv[]) try
-{
-    tbtadm::File file(argv[2], tbtadm::File::Mode::Write);
-    file << std::string(argv[1]);
-}
-catch (std::system_error& e)
-{
-    return e.code().value();
-}
-catch (...)
-{
-    return EXIT_FAILURE;
-}
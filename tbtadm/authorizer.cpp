@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "authorizer.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+bool tbtadm::RetryPolicy::isTransient(const std::error_code& code)
+{
+    if (code.category() != std::system_category())
+    {
+        return false;
+    }
+
+    switch (code.value())
+    {
+        case EBUSY:
+        case EAGAIN:
+        case ETIMEDOUT:
+        case EINTR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+tbtadm::AuthorizationExecutor::AuthorizationExecutor(size_t perDomainLimit)
+    : m_perDomainLimit(std::max<size_t>(perDomainLimit, 1))
+{
+}
+
+tbtadm::AuthorizationExecutor::Id
+tbtadm::AuthorizationExecutor::add(const std::string& domain,
+                                   std::string name,
+                                   Task task,
+                                   const std::vector<Id>& after)
+{
+    const Id id = m_entries.size();
+    for (auto dependency : after)
+    {
+        if (dependency >= id)
+        {
+            throw std::out_of_range("Unknown task dependency");
+        }
+    }
+
+    Entry entry;
+    entry.domain  = domain;
+    entry.task    = std::move(task);
+    entry.pending = after.size();
+    m_entries.push_back(std::move(entry));
+    for (auto dependency : after)
+    {
+        m_entries[dependency].dependents.push_back(id);
+    }
+
+    Result result;
+    result.id   = id;
+    result.name = std::move(name);
+    m_results.push_back(std::move(result));
+
+    return id;
+}
+
+std::vector<tbtadm::AuthorizationExecutor::Result>
+tbtadm::AuthorizationExecutor::run(const Report& report)
+{
+    struct DomainState
+    {
+        std::deque<Id> ready;
+        size_t remaining = 0;
+    };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, DomainState> domains;
+    std::vector<bool> done(m_entries.size());
+
+    for (Id id = 0; id < m_entries.size(); ++id)
+    {
+        auto& state = domains[m_entries[id].domain];
+        ++state.remaining;
+        if (!m_entries[id].pending)
+        {
+            state.ready.push_back(id);
+        }
+    }
+
+    // Must be called with the mutex locked
+    std::function<void(Id)> finish = [&](Id id) {
+        const auto& result = m_results[id];
+        const bool ok      = !result.skipped && result.message.empty();
+        done[id]           = true;
+        --domains[m_entries[id].domain].remaining;
+        if (report)
+        {
+            report(result);
+        }
+
+        for (auto dependent : m_entries[id].dependents)
+        {
+            if (done[dependent])
+            {
+                continue;
+            }
+            if (!ok)
+            {
+                m_results[dependent].skipped = true;
+                m_results[dependent].error   = result.error;
+                m_results[dependent].message =
+                    "depends on " + result.name + ", which failed";
+                finish(dependent);
+                continue;
+            }
+            if (!--m_entries[dependent].pending)
+            {
+                domains[m_entries[dependent].domain].ready.push_back(
+                    dependent);
+            }
+        }
+    };
+
+    auto worker = [&](DomainState* state) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [state] {
+                return !state->ready.empty() || !state->remaining;
+            });
+            if (state->ready.empty())
+            {
+                return;
+            }
+            const auto id = state->ready.front();
+            state->ready.pop_front();
+            lock.unlock();
+
+            std::ostringstream out;
+            std::error_code error;
+            std::string message;
+            const auto start = std::chrono::steady_clock::now();
+            try
+            {
+                m_entries[id].task(out);
+            }
+            catch (std::system_error& e)
+            {
+                error   = e.code();
+                message = e.what();
+            }
+            catch (std::exception& e)
+            {
+                message = e.what();
+            }
+            catch (...)
+            {
+                message = "Unknown exception";
+            }
+
+            const auto duration = std::chrono::steady_clock::now() - start;
+
+            lock.lock();
+            auto& result    = m_results[id];
+            result.log      = out.str();
+            result.error    = error;
+            result.message  = std::move(message);
+            result.duration = duration;
+            finish(id);
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (auto& domain : domains)
+    {
+        const auto count = std::min(m_perDomainLimit, domain.second.remaining);
+        for (size_t i = 0; i < count; ++i)
+        {
+            workers.emplace_back(worker, &domain.second);
+        }
+    }
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    return m_results;
+}
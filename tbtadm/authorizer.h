@@ -0,0 +1,170 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace tbtadm
+{
+/**
+ * @brief Retry policy for writes that go through the connection manager
+ *
+ * The connection manager (and the firmware behind it) may be busy handling
+ * another request, so writes to e.g. "authorized" can fail with an error that
+ * means "try again later". Such errors are retried with an exponential,
+ * bounded, backoff; any other error is reported immediately.
+ */
+struct RetryPolicy
+{
+    unsigned maxAttempts = 5;
+    std::chrono::milliseconds initialDelay{20};
+    std::chrono::milliseconds maxDelay{1000};
+
+    /// Returns true if the error is worth retrying (EBUSY, EAGAIN etc.)
+    static bool isTransient(const std::error_code& code);
+
+    /**
+     * @brief Run the operation, retrying it on transient errors
+     *
+     * @param op    callable that reports errors by throwing std::system_error
+     *
+     * @return the number of attempts it took
+     *
+     * The error of the last attempt is rethrown if all of them failed.
+     */
+    template <typename Op>
+    unsigned run(Op&& op) const
+    {
+        auto delay = initialDelay;
+        for (unsigned attempt = 1;; ++attempt)
+        {
+            try
+            {
+                op();
+                return attempt;
+            }
+            catch (std::system_error& e)
+            {
+                if (attempt >= maxAttempts || !isTransient(e.code()))
+                {
+                    throw;
+                }
+            }
+            std::this_thread::sleep_for(delay);
+            delay = std::min(delay * 2, maxDelay);
+        }
+    }
+};
+
+/**
+ * @brief Runs a batch of device authorizations
+ *
+ * Every task belongs to a domain and may depend on other tasks (e.g. a device
+ * can be authorized only after its parent is). Tasks of different domains run
+ * in parallel, and tasks of the same domain run in parallel too, up to the
+ * given limit, so the firmware doesn't get flooded with requests.
+ *
+ * A task whose dependency failed isn't run; it's reported as skipped.
+ */
+class AuthorizationExecutor
+{
+public:
+    using Id = size_t;
+
+    /// The task writes its progress to the given stream and reports errors
+    /// by throwing
+    using Task = std::function<void(std::ostream& out)>;
+
+    struct Result
+    {
+        Id id;
+        std::string name;
+        std::string log;
+        bool skipped = false;
+        std::error_code error; // for skipped tasks, of the one that failed
+        std::string message; // empty on success
+        std::chrono::steady_clock::duration duration{}; // of the task itself
+    };
+
+    /// Called for every finished task; the calls are serialized
+    using Report = std::function<void(const Result& result)>;
+
+    /**
+     * @param perDomainLimit    max tasks of the same domain running together
+     */
+    explicit AuthorizationExecutor(size_t perDomainLimit);
+
+    /**
+     * @brief Add a task
+     *
+     * @param domain    domain the device belongs to
+     * @param name      name to use for reporting (e.g. route-string)
+     * @param task      the actual work
+     * @param after     tasks that must succeed before this one can run
+     *
+     * @return the task ID to be used in @p after of other tasks
+     */
+    Id add(const std::string& domain,
+           std::string name,
+           Task task,
+           const std::vector<Id>& after = {});
+
+    /**
+     * @brief Run all the tasks and wait for them to finish
+     *
+     * @param report    callback for each task result, as it's available
+     *
+     * @return the results of all the tasks, ordered by their ID
+     */
+    std::vector<Result> run(const Report& report = {});
+
+private:
+    struct Entry
+    {
+        std::string domain;
+        Task task;
+        size_t pending = 0; // dependencies not finished yet
+        std::vector<Id> dependents;
+    };
+
+    size_t m_perDomainLimit;
+    std::vector<Entry> m_entries;
+    std::vector<Result> m_results;
+};
+} // namespace tbtadm
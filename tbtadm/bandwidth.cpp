@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "bandwidth.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "directory.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const char portPrefix[]     = "port";
+const std::string regsFile  = "regs";
+const std::string pathsFile = "path";
+
+// Adapter types, ADP_CS_2 bits 23:0
+const uint32_t adapterTypeMask = 0xffffff;
+const uint32_t typeDPOut       = 0x0e0102;
+const uint32_t typePCIeUp      = 0x100102;
+const uint32_t typeUSB3Up      = 0x200102;
+
+const unsigned adapterTypeOffset = 2;    // ADP_CS_2
+const unsigned adapterCapID      = 0x04; // TB_PORT_CAP_ADAP
+const unsigned dpLocalCap        = 0x04; // Relative to the adapter capability
+const unsigned dpCommonCap       = 0x07;
+
+const uint32_t dpRateMask   = 0xf00;
+const unsigned dpRateShift  = 8;
+const uint32_t dpLanesMask  = 0x7000;
+const unsigned dpLanesShift = 12;
+
+const uint32_t hopEnable = 1u << 31; // In the first dword of a hop entry
+
+/// Link rate of the DisplayPort rate codes, Mb/s per lane
+const unsigned dpRates[] = {1620, 2700, 5400, 8100};
+const unsigned dpLanes[] = {1, 2, 4};
+
+/// The adapter registers needed for finding tunnels
+struct Adapter
+{
+    uint32_t type      = 0;
+    uint32_t localCap  = 0;
+    uint32_t commonCap = 0;
+};
+
+/**
+ * Parses the "regs" dump of an adapter; each line is:
+ * <offset> <relative offset> <cap ID> <vendor cap ID> <value>
+ */
+Adapter readAdapter(const fs::path& path)
+{
+    Adapter adapter;
+    std::ifstream file(path.string());
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream stream(line);
+        unsigned offset, relative, capID, vsecID;
+        uint32_t value;
+        stream >> std::hex >> offset >> std::dec >> relative >> std::hex
+            >> capID >> vsecID >> value;
+        if (!stream)
+        {
+            continue;
+        }
+
+        if (capID == 0 && offset == adapterTypeOffset)
+        {
+            adapter.type = value & adapterTypeMask;
+        }
+        else if (capID == adapterCapID && relative == dpLocalCap)
+        {
+            adapter.localCap = value;
+        }
+        else if (capID == adapterCapID && relative == dpCommonCap)
+        {
+            adapter.commonCap = value;
+        }
+    }
+    return adapter;
+}
+
+/**
+ * Checks the "path" dump of an adapter for an enabled hop entry; each line
+ * is: <offset> <relative offset> <in hop ID> <value>
+ */
+bool hasActivePath(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream stream(line);
+        unsigned offset, relative, hopID;
+        uint32_t value;
+        stream >> std::hex >> offset >> std::dec >> relative >> std::hex
+            >> hopID >> value;
+        if (stream && relative == 0 && (value & hopEnable))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Bandwidth of a DisplayPort stream with the given capabilities, in Mb/s
+unsigned dpBandwidth(uint32_t cap)
+{
+    auto rate  = (cap & dpRateMask) >> dpRateShift;
+    auto lanes = (cap & dpLanesMask) >> dpLanesShift;
+    if (rate >= sizeof(dpRates) / sizeof(dpRates[0])
+        || lanes >= sizeof(dpLanes) / sizeof(dpLanes[0]))
+    {
+        return 0;
+    }
+    // 8b/10b encoding
+    return dpRates[rate] * dpLanes[lanes] * 8 / 10;
+}
+
+std::string escape(const std::string& str)
+{
+    std::ostringstream out;
+    for (unsigned char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (c < 0x20)
+        {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                << static_cast<unsigned>(c) << std::dec;
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    return out.str();
+}
+} // namespace
+
+tbtadm::RouterTunnels& tbtadm::RouterTunnels::
+operator+=(const RouterTunnels& other)
+{
+    dpBandwidth += other.dpBandwidth;
+    dpTunnels += other.dpTunnels;
+    pcieTunnels += other.pcieTunnels;
+    usb3Tunnels += other.usb3Tunnels;
+    return *this;
+}
+
+tbtadm::RouterTunnels tbtadm::readRouterTunnels(const fs::path& router)
+{
+    RouterTunnels tunnels;
+    if (!fs::exists(router))
+    {
+        return tunnels;
+    }
+
+    Directory dir(router, [](const char* name) {
+        return std::strncmp(name, portPrefix, sizeof(portPrefix) - 1) == 0;
+    });
+    for (const auto& entry : dir)
+    {
+        const auto port    = router / entry.name();
+        const auto adapter = readAdapter(port / regsFile);
+        if (adapter.type != typeDPOut && adapter.type != typePCIeUp
+            && adapter.type != typeUSB3Up)
+        {
+            continue;
+        }
+        if (!hasActivePath(port / pathsFile))
+        {
+            continue;
+        }
+
+        switch (adapter.type)
+        {
+            case typeDPOut:
+                ++tunnels.dpTunnels;
+                tunnels.dpBandwidth += dpBandwidth(
+                    adapter.commonCap ? adapter.commonCap : adapter.localCap);
+                break;
+            case typePCIeUp:
+                ++tunnels.pcieTunnels;
+                break;
+            case typeUSB3Up:
+                ++tunnels.usb3Tunnels;
+                break;
+        }
+    }
+    return tunnels;
+}
+
+void tbtadm::writeJSON(std::ostream& out, const std::vector<HopUsage>& hops)
+{
+    out << "{\"hops\": [";
+    for (size_t i = 0; i < hops.size(); ++i)
+    {
+        const auto& hop = hops[i];
+        out << (i ? ",\n  " : "\n  ") << "{\"route\": \""
+            << escape(hop.routeString) << "\", \"device\": \""
+            << escape(hop.device)
+            << "\", \"link_mbps\": " << hop.linkBandwidth
+            << ", \"dp_mbps\": " << hop.tunnels.dpBandwidth
+            << ", \"dp_tunnels\": " << hop.tunnels.dpTunnels
+            << ", \"pcie_tunnels\": " << hop.tunnels.pcieTunnels
+            << ", \"usb3_tunnels\": " << hop.tunnels.usb3Tunnels;
+        if (hop.linkBandwidth)
+        {
+            out << ", \"available_mbps\": " << hop.available();
+        }
+        out << '}';
+    }
+    out << (hops.empty() ? "]}\n" : "\n]}\n");
+}
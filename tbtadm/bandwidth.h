@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/**
+ * @brief Tunnels terminating at a router, as found in its debugfs dumps
+ *
+ * The kernel exposes the registers of every adapter under
+ * <debugfs>/thunderbolt/<route-string>/port<N>/, including the hop entries
+ * of the paths going through it ("path") and the adapter configuration
+ * ("regs"). A DisplayPort OUT, PCIe upstream or USB3 upstream adapter with an
+ * enabled path entry is the device end of a tunnel.
+ *
+ * DisplayPort tunnels reserve their bandwidth on all the links from the host,
+ * estimated here from the rate and lanes in DP_COMMON_CAP (falling back to
+ * DP_LOCAL_CAP if the common capabilities weren't negotiated yet). PCIe and
+ * USB3 tunnels use what's left.
+ */
+struct RouterTunnels
+{
+    unsigned dpBandwidth = 0; // Mb/s, reserved by the DisplayPort tunnels
+    unsigned dpTunnels   = 0;
+    unsigned pcieTunnels = 0;
+    unsigned usb3Tunnels = 0;
+
+    RouterTunnels& operator+=(const RouterTunnels& other);
+};
+
+/**
+ * @brief Reads the tunnels terminating at the given router
+ *
+ * @param router    debugfs directory of the router
+ */
+RouterTunnels readRouterTunnels(const boost::filesystem::path& router);
+
+/// Bandwidth usage of the link of a device to its parent
+struct HopUsage
+{
+    std::string routeString;
+    std::string device;
+    unsigned linkBandwidth = 0; // Mb/s, 0 if unknown
+
+    /// Tunnels going through the hop, i.e. to the device or its descendants
+    RouterTunnels tunnels;
+
+    /// Bandwidth left for PCIe and USB3, negative if oversubscribed
+    long available() const
+    {
+        return static_cast<long>(linkBandwidth) - tunnels.dpBandwidth;
+    }
+};
+
+/// Writes the hops as JSON: {"hops": [{"route": "0-1", ...}, ...]}
+void writeJSON(std::ostream& out, const std::vector<HopUsage>& hops);
+} // namespace tbtadm
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "bootacl.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "attributes.h"
+#include "directory.h"
+#include "file.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const char separator = ',';
+
+bool isVisible(const char* name)
+{
+    return name[0] != '.';
+}
+
+std::string join(const std::vector<std::string>& slots)
+{
+    std::string content;
+    for (const auto& slot : slots)
+    {
+        if (&slot != &slots.front())
+        {
+            content += separator;
+        }
+        content += slot;
+    }
+    return content;
+}
+} // namespace
+
+tbtadm::BootACL::BootACL(fs::path domain)
+    : m_path(domain / attr::bootACL.name)
+{
+    std::string content;
+    try
+    {
+        content = readAttribute(domain, attr::bootACL);
+    }
+    catch (std::system_error& e)
+    {
+        if (e.code().value() != ENOENT)
+        {
+            throw;
+        }
+        return;
+    }
+
+    std::istringstream stream(content);
+    std::string slot;
+    while (std::getline(stream, slot, separator))
+    {
+        m_slots.push_back(slot);
+    }
+    // getline() drops the last slot if it's empty
+    if (content.empty() || content.back() == separator)
+    {
+        m_slots.emplace_back();
+    }
+}
+
+bool tbtadm::BootACL::contains(const std::string& uuid) const
+{
+    return std::find(m_slots.begin(), m_slots.end(), uuid) != m_slots.end();
+}
+
+bool tbtadm::BootACL::assign(const std::vector<std::string>& uuids)
+{
+    const auto count = std::min(uuids.size(), m_slots.size());
+    const auto begin = uuids.begin();
+    const auto end   = begin + count;
+
+    auto slots = m_slots;
+    for (auto& slot : slots)
+    {
+        if (std::find(begin, end, slot) == end)
+        {
+            slot.clear();
+        }
+    }
+    for (auto uuid = begin; uuid != end; ++uuid)
+    {
+        if (std::find(slots.begin(), slots.end(), *uuid) == slots.end())
+        {
+            *std::find(slots.begin(), slots.end(), std::string()) = *uuid;
+        }
+    }
+
+    if (slots == m_slots)
+    {
+        return false;
+    }
+
+    File(m_path, File::Mode::Write).write(join(slots));
+    m_slots = std::move(slots);
+    return true;
+}
+
+std::vector<std::string> tbtadm::aclByLastUse(const fs::path& acltree)
+{
+    std::vector<std::pair<struct timespec, std::string>> entries;
+    if (!fs::exists(acltree))
+    {
+        return {};
+    }
+
+    Directory acl(acltree, isVisible);
+    for (const auto& entry : acl)
+    {
+        struct stat st;
+        if (!entry.isDirectory()
+            || ::fstatat(acl.fd(), entry.name(), &st, 0) == File::ERROR)
+        {
+            continue;
+        }
+        entries.emplace_back(st.st_mtim, entry.name());
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        if (a.first.tv_sec != b.first.tv_sec)
+        {
+            return a.first.tv_sec > b.first.tv_sec;
+        }
+        if (a.first.tv_nsec != b.first.tv_nsec)
+        {
+            return a.first.tv_nsec > b.first.tv_nsec;
+        }
+        return a.second < b.second;
+    });
+
+    std::vector<std::string> uuids;
+    uuids.reserve(entries.size());
+    for (auto& entry : entries)
+    {
+        uuids.push_back(std::move(entry.second));
+    }
+    return uuids;
+}
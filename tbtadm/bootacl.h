@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/**
+ * @brief The boot ACL of a domain
+ *
+ * Newer controllers keep a short list of UUIDs that the firmware authorizes by
+ * itself, before the OS is up, so boot-time bring-up of e.g. a dock doesn't
+ * wait for user-space. It's exposed by the kernel as the domain "boot_acl"
+ * attribute: a comma-separated list with an entry, possibly empty, per slot.
+ */
+class BootACL
+{
+public:
+    /// Reads the boot ACL of the given domain
+    explicit BootACL(boost::filesystem::path domain);
+
+    /// Whether the domain has a boot ACL at all
+    bool supported() const { return !m_slots.empty(); }
+
+    size_t capacity() const { return m_slots.size(); }
+
+    bool contains(const std::string& uuid) const;
+
+    /**
+     * @brief Makes the boot ACL hold the first UUIDs of the given list
+     *
+     * UUIDs that stay keep their slots, so the write only changes what's
+     * needed. Nothing is written if the content doesn't change.
+     *
+     * @param uuids     ACL entries, the most relevant first
+     *
+     * @return whether the boot ACL was changed
+     */
+    bool assign(const std::vector<std::string>& uuids);
+
+private:
+    const boost::filesystem::path m_path;
+    std::vector<std::string> m_slots;
+};
+
+/**
+ * @brief Lists the ACL entries, the most recently used first
+ *
+ * The modification time of an ACL entry directory is set when it's created
+ * and whenever the entry is used to authorize its device (by tbtadm or
+ * tbtacl).
+ */
+std::vector<std::string> aclByLastUse(const boost::filesystem::path& acltree);
+} // namespace tbtadm
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "capture.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <dirent.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "file.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string magic           = "# tbtadm capture v1";
+const std::string domainPrefix    = "domain";
+const std::string keyFilename     = "key";
+const std::string powerDirname    = "power";
+const std::string subsystemEnv    = "SUBSYSTEM=thunderbolt";
+const std::string devtypeDevice   = "DEVTYPE=thunderbolt_device";
+const std::string ueventFilename  = "uevent";
+
+bool isDomainName(const char* name)
+{
+    return !std::strncmp(name, domainPrefix.c_str(), domainPrefix.size());
+}
+
+/// Skips hidden and temporary entries
+bool isVisible(const char* name)
+{
+    return name[0] != '.';
+}
+
+/// Devices, XDomains and their services (e.g. "0-1.1") have a route-string
+/// name; "power" holds the runtime PM status tbtadm checks
+bool isRecorded(const char* name)
+{
+    return tbtadm::domainNumLength(name) != 0 || name == powerDirname;
+}
+
+std::string escape(const std::string& value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        switch (c)
+        {
+            case '\t':
+                escaped += "\\t";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            default:
+                escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/// The path of a uevent relative to the sysfs directory of the domains, e.g.
+/// "domain0/0-0/0-1"; empty if it isn't under a domain
+std::string relativeDevpath(const std::string& devpath)
+{
+    auto pos = devpath.find('/' + domainPrefix);
+    return pos == std::string::npos ? std::string() : devpath.substr(pos + 1);
+}
+
+class Socket
+{
+public:
+    explicit Socket(int fd) : m_fd(fd)
+    {
+        if (m_fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "socket");
+        }
+    }
+    ~Socket() { close(m_fd); }
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    int fd() const { return m_fd; }
+
+private:
+    const int m_fd;
+};
+} // namespace
+
+void tbtadm::Capture::addSysfs(const fs::path& devices)
+{
+    Directory bus(devices, isDomainName);
+    for (const auto& entry : bus)
+    {
+        addDirectory(Directory(bus, entry.name()), entry.name());
+    }
+}
+
+void tbtadm::Capture::addDirectory(const Directory& dir,
+                                   const std::string& path)
+{
+    m_content += "dir\t" + escape(path) + '\n';
+    if (dir.exists(ueventFilename)
+        && File(dir, ueventFilename, File::Mode::Read)
+                   .read()
+                   .find(devtypeDevice + '\n')
+               != std::string::npos)
+    {
+        ++m_devices;
+    }
+
+    // Iterating a separate object, so the given one can be used for reading
+    Directory entries(dir, ".", isVisible);
+    std::vector<std::string> subdirs;
+    for (const auto& entry : entries)
+    {
+        const std::string name = entry.name();
+        switch (entry.type())
+        {
+            case DT_DIR:
+                if (isRecorded(entry.name()))
+                {
+                    subdirs.push_back(name);
+                }
+                break;
+            case DT_REG:
+                if (name == keyFilename)
+                {
+                    // Only whether the device supports keys matters
+                    m_content += "attr\t" + escape(path + '/' + name) + "\t\n";
+                    break;
+                }
+                try
+                {
+                    m_content += "attr\t" + escape(path + '/' + name) + '\t'
+                                 + escape(File(dir, name, File::Mode::Read)
+                                              .read())
+                                 + '\n';
+                }
+                catch (std::system_error&)
+                {
+                    // Write-only, or not readable in the current state
+                }
+                break;
+            default:
+                // Links (driver, subsystem etc.) aren't followed
+                break;
+        }
+    }
+
+    for (const auto& name : subdirs)
+    {
+        addDirectory(Directory(dir, name), path + '/' + name);
+    }
+}
+
+void tbtadm::Capture::addACL(const fs::path& acl)
+{
+    std::unique_ptr<Directory> root;
+    try
+    {
+        root = std::make_unique<Directory>(acl, isVisible);
+    }
+    catch (std::system_error& e)
+    {
+        if (e.code().value() != ENOENT)
+        {
+            throw;
+        }
+        return;
+    }
+
+    for (const auto& entry : *root)
+    {
+        const std::string uuid = entry.name();
+        Directory dir(*root, uuid, isVisible);
+
+        struct stat st;
+        if (fstat(dir.fd(), &st))
+        {
+            throw std::system_error(errno, std::generic_category(), "fstat");
+        }
+        m_content += "aclentry\t" + escape(uuid) + '\t'
+                     + std::to_string(st.st_mtime) + '\n';
+        ++m_aclEntries;
+
+        for (const auto& file : dir)
+        {
+            const std::string name = file.name();
+            m_content += "aclfile\t" + escape(uuid + '/' + name) + '\t';
+            if (name != keyFilename)
+            {
+                m_content += escape(File(dir, name, File::Mode::Read).read());
+            }
+            m_content += '\n';
+        }
+    }
+}
+
+void tbtadm::Capture::addEvents(std::chrono::milliseconds duration)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Socket socket(::socket(
+        AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT));
+
+    sockaddr_nl address = {};
+    address.nl_family   = AF_NETLINK;
+    address.nl_groups   = 1; // Kernel events, not the ones udev re-sends
+    if (bind(socket.fd(),
+             reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)))
+    {
+        throw std::system_error(errno, std::generic_category(), "bind");
+    }
+
+    const auto start    = Clock::now();
+    const auto deadline = start + duration;
+    std::vector<char> buffer(16 * 1024);
+    for (auto now = start; now < deadline; now = Clock::now())
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+
+        pollfd fds  = {};
+        fds.fd      = socket.fd();
+        fds.events  = POLLIN;
+        auto result = poll(
+            &fds, 1, duration_cast<milliseconds>(deadline - now).count() + 1);
+        if (result == -1 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::generic_category(), "poll");
+        }
+        if (result <= 0)
+        {
+            continue;
+        }
+
+        auto size = recv(socket.fd(), buffer.data(), buffer.size() - 1, 0);
+        if (size <= 0)
+        {
+            continue;
+        }
+        const auto time =
+            duration_cast<milliseconds>(Clock::now() - start).count();
+
+        // "action@devpath", then NUL separated KEY=value pairs
+        buffer[size] = '\0';
+        std::vector<std::string> fields;
+        for (const char* p = buffer.data(); p < buffer.data() + size;
+             p += std::strlen(p) + 1)
+        {
+            fields.emplace_back(p);
+        }
+        auto at = fields.empty() ? std::string::npos : fields[0].find('@');
+        if (at == std::string::npos
+            || std::find(fields.begin(), fields.end(), subsystemEnv)
+                   == fields.end())
+        {
+            continue;
+        }
+        auto path = relativeDevpath(fields[0].substr(at + 1));
+        if (path.empty())
+        {
+            continue;
+        }
+
+        m_content += "event\t" + std::to_string(time) + '\t'
+                     + escape(fields[0].substr(0, at)) + '\t' + escape(path);
+        for (size_t i = 1; i < fields.size(); ++i)
+        {
+            // The rest is in the attributes and the event line itself
+            if (fields[i].compare(0, 7, "ACTION=")
+                && fields[i].compare(0, 8, "DEVPATH=")
+                && fields[i].compare(0, 7, "SEQNUM="))
+            {
+                m_content += '\t' + escape(fields[i]);
+            }
+        }
+        m_content += '\n';
+        ++m_events;
+    }
+}
+
+void tbtadm::Capture::save(const fs::path& path) const
+{
+    writeAtomically(path, magic + '\n' + m_content);
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief Records the Thunderbolt state of the machine, for replay as a mock
+ *
+ * A capture holds the sysfs subtree of every domain (structure and attribute
+ * values), the ACL entries (but not their keys) and the uevents of the
+ * thunderbolt subsystem seen during the capture, with their timing. The
+ * replayer in the tests recreates it as a mock tree and re-emits the events,
+ * so a problem seen in the field can be reproduced deterministically.
+ *
+ * The file is line based, with tab-separated fields; tabs, newlines and
+ * backslashes in values are escaped (\\t, \\n, \\\\). Paths are relative to
+ * the sysfs directory of the domains (e.g. "domain0/0-0/0-1") and to the ACL
+ * directory. The kinds of lines are:
+ * - dir <path>
+ * - attr <path> <value>
+ * - aclentry <uuid> <mtime>
+ * - aclfile <uuid>/<name> <value>
+ * - event <milliseconds> <action> <path> [<KEY=value>...]
+ */
+class Capture
+{
+public:
+    /// Records the sysfs subtree of every domain found in the given directory
+    void addSysfs(const boost::filesystem::path& devices);
+
+    /// Records the ACL entries with their last use; keys are left out
+    void addACL(const boost::filesystem::path& acl);
+
+    /// Records the uevents of the thunderbolt subsystem for the given time
+    void addEvents(std::chrono::milliseconds duration);
+
+    /// Writes the capture to the given file, atomically
+    void save(const boost::filesystem::path& path) const;
+
+    unsigned devices() const { return m_devices; }
+    unsigned aclEntries() const { return m_aclEntries; }
+    unsigned events() const { return m_events; }
+
+private:
+    void addDirectory(const Directory& dir, const std::string& path);
+
+    std::string m_content;
+    unsigned m_devices    = 0;
+    unsigned m_aclEntries = 0;
+    unsigned m_events     = 0;
+};
+} // namespace tbtadm
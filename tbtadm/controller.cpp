@@ -31,28 +31,54 @@
 
 #include "controller.h"
 
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <random>
 #include <iterator>
 #include <algorithm>
-
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "aclstore.h"
+#include "attributes.h"
+#include "authorizer.h"
+#include "bandwidth.h"
+#include "bootacl.h"
+#include "cache.h"
+#include "capture.h"
+#include "directory.h"
 #include "file.h"
+#include "filter.h"
+#include "links.h"
+#include "metrics.h"
+#include "nvm.h"
+#include "policy.h"
+#include "readiness.h"
+#include "snapshot.h"
+#include "sysfs.h"
+#include "table.h"
 
 using namespace std::string_literals;
+using tbtadm::readAndTrim;
+using tbtadm::readAttribute;
+namespace attr = tbtadm::attr;
 
 namespace
 {
 const fs::path acltree          = "/var/lib/thunderbolt/acl";
 const fs::path sysfsDevicesPath = "/sys/bus/thunderbolt/devices";
+const fs::path deviceCachePath  = "/var/lib/thunderbolt/devices.cache";
+const fs::path debugfsPath      = "/sys/kernel/debug/thunderbolt";
+
+const std::string nvmemFilename      = "nvmem";
+const std::string nvmNonActivePrefix = "nvm_non_active";
 
-const std::string uniqueIDFilename   = "unique_id";
-const std::string authorizedFilename = "authorized";
-const std::string vendorFilename     = "vendor_name";
-const std::string deviceFilename     = "device_name";
-const std::string keyFilename        = "key";
-const std::string securityFilename   = "security";
+const fs::path runtimeStatusFilename = "power/runtime_status";
 
 const std::string domain          = "domain";
 const std::string hostRouteString = "-0";
@@ -63,84 +89,103 @@ const std::string xdomainDevtype  = "DEVTYPE=thunderbolt_xdomain";
 const std::string opt_devices     = "devices";
 const std::string opt_peers       = "peers";
 const std::string opt_topology    = "topology";
+const std::string opt_links       = "links";
+const std::string opt_bandwidth   = "bandwidth";
 const std::string opt_approve     = "approve";
 const std::string opt_approve_all = "approve-all";
+const std::string opt_deauth      = "deauthorize";
+const std::string opt_deauth_all  = "deauthorize-all";
 const std::string opt_acl         = "acl";
 const std::string opt_add         = "add";
 const std::string opt_remove      = "remove";
 const std::string opt_remove_all  = "remove-all";
+const std::string opt_nvm         = "nvm";
+const std::string opt_nvm_upgrade = "upgrade";
 const std::string opt_once_flag   = "--once";
+const std::string opt_unaligned   = "--unaligned";
+const std::string opt_no_wake     = "--no-wake";
+const std::string opt_json        = "--json";
+const std::string opt_wait_ready  = "--wait-ready";
+const std::string opt_timeout     = "--timeout";
+const std::string opt_batch       = "--batch";
+const std::string opt_save        = "--save";
+const std::string opt_diff        = "--diff";
+const std::string opt_domain      = "--domain";
+const std::string opt_root        = "--root";
+const std::string opt_depth       = "--depth";
+const std::string opt_capture     = "capture";
+const std::string opt_events      = "--events";
+const std::string opt_policy      = "policy";
+const std::string opt_policy_test = "test";
+const std::string opt_filter      = "--filter";
+const std::string batchStdin      = "-";
+
+/// Authorizations of the same domain are serialized by the firmware anyway, so
+/// only a few of them are allowed to be in flight together
+const size_t maxAuthorizationsPerDomain = 2;
+
+/// How much of the NVM image is handed to the kernel in a single call
+const size_t nvmChunkSize = 1024 * 1024;
+
+/// NVM authentication includes a restart of the device (or the whole
+/// controller), so it can take a while
+const auto nvmAuthTimeout      = std::chrono::minutes(3);
+const auto nvmAuthPollInterval = std::chrono::milliseconds(500);
 
 const std::string indent     = "│   ";
 const size_t indentLength    = 4;
 const std::string indentLast = "    ";
 
-enum security_level
-{
-    SECURITY_LEVEL_NONE = 0,
-    SECURITY_LEVEL_USER,
-    SECURITY_LEVEL_SECURE,
-    SECURITY_LEVEL_DPONLY,
-};
-
 const std::string SYMBOL_PIPE = "│";
 const std::string SYMBOL_L    = "└─ ";
 const std::string SYMBOL_PLUS = "├─ ";
 
-const std::string green  = "\x1b[0;32m";
-const std::string yellow = "\x1b[0;33m";
-const std::string normal = "\x1b[0m";
-
-class Highlight
+/// Parses a decimal number, rejecting signs, trailing garbage and overflow
+bool parseUnsigned(const std::string& str, unsigned& value)
 {
-public:
-    Highlight(std::ostream& out, const std::string& color)
-        : m_out(out), m_useColor(::isatty(STDOUT_FILENO))
+    if (str.empty()
+        || !std::all_of(str.begin(), str.end(), [](unsigned char c) {
+               return std::isdigit(c);
+           }))
     {
-        if (m_useColor)
-            m_out << color;
+        return false;
     }
-
-    ~Highlight()
+    try
     {
-        if (m_useColor)
-            m_out << normal;
+        auto parsed = std::stoul(str);
+        if (parsed > std::numeric_limits<unsigned>::max())
+        {
+            return false;
+        }
+        value = parsed;
+        return true;
+    }
+    catch (std::out_of_range&)
+    {
+        return false;
     }
-
-private:
-    std::ostream& m_out;
-    bool m_useColor;
-};
-
-std::string read(const fs::path& path)
-{
-    tbtadm::File file(path, tbtadm::File::Mode::Read);
-    auto content = file.read();
-    return content;
-}
-
-/* Trim right characters */
-std::string rtrim(const std::string& str, const std::string& chars = " \n\r")
-{
-    return str.substr(0, str.find_last_not_of(chars) + 1);
 }
 
-std::string readAndTrim(const fs::path& path)
+std::string read(const tbtadm::Directory& dir, const std::string& name)
 {
-    return rtrim(read(path));
+    tbtadm::File file(dir, name, tbtadm::File::Mode::Read);
+    return file.read();
 }
 
 /**
- * Return the content of the file from given path or "Unknown" + type if empty
+ * Return the content of the given file or "Unknown" + type if empty
  *
- * @param path  path to file to read from
+ * @param dir   directory the file is in
+ * @param name  name of the file to read from
  * @param type  string to return if file is empty, prefixed with "Unknown"
  */
-std::string readName(const fs::path& path, const std::string& type)
+std::string readName(const tbtadm::Directory& dir,
+                     const std::string& name,
+                     const std::string& type)
 {
     try
     {
-        auto res = readAndTrim(path);
+        auto res = readAndTrim(dir, name);
         if (!res.empty())
         {
             return res;
@@ -153,86 +198,108 @@ std::string readName(const fs::path& path, const std::string& type)
     return "Unknown " + type;
 }
 
-std::string readVendor(const fs::path& path)
+std::string readVendor(const tbtadm::Directory& dir,
+                       const std::string& name = attr::vendorName.name)
 {
-    return readName(path, "vendor");
+    return readName(dir, name, "vendor");
 }
 
-std::string readDevice(const fs::path& path)
+std::string readDevice(const tbtadm::Directory& dir,
+                       const std::string& name = attr::deviceName.name)
 {
-    return readName(path, "device");
+    return readName(dir, name, "device");
 }
 
-bool findUeventAttr(const fs::path& path, const std::string& attribute)
+/// Reads the attributes of the given device that are kept in the cache
+tbtadm::CachedDevice readDeviceState(const tbtadm::Directory& dir,
+                                     const std::string& routeString)
+{
+    tbtadm::CachedDevice device;
+    device.routeString = routeString;
+    device.authorized  = readAttribute(dir, attr::authorized);
+    device.uuid        = readAttribute(dir, attr::uniqueID);
+    device.vendor      = readVendor(dir);
+    device.device      = readDevice(dir);
+    return device;
+}
+
+/// Whether reading the state of a device (see readDeviceState()) may wake up
+/// its domain
+constexpr bool readingStateWakes = attr::authorized.wakes
+                                   || attr::uniqueID.wakes
+                                   || attr::vendorName.wakes
+                                   || attr::deviceName.wakes;
+
+bool findUeventAttr(const tbtadm::Directory& dir, const std::string& attribute)
 {
-    const auto ueventFile = path / "uevent";
-    if (!fs::exists(ueventFile))
-    {
-        return false;
-    }
     try
     {
-        const auto uevent = read(ueventFile);
+        const auto uevent = read(dir, "uevent");
         return uevent.find(attribute) != uevent.npos;
     }
-    // assuming this is from an empty uevent file
+    // assuming this is from a missing or empty uevent file
     catch (std::runtime_error&)
     {
         return false;
     }
 }
 
-bool isDomain(const fs::path& path)
+bool isDomain(const tbtadm::Directory& dir)
 {
-    return findUeventAttr(path, domainDevtype);
+    return findUeventAttr(dir, domainDevtype);
 }
 
-bool isRouteString(const std::string& str)
+bool isDevice(const tbtadm::Directory& dir)
 {
-    return str.size() > 1 && str[1] == '-' && str.find('.') == str.npos;
+    return findUeventAttr(dir, deviceDevtype);
 }
 
-bool isHost(const std::string& str)
+bool isXDomain(const tbtadm::Directory& dir)
 {
-    return str.size() == 3 && str.substr(1) == hostRouteString;
+    return findUeventAttr(dir, xdomainDevtype);
 }
 
-bool isDevice(const fs::path& path)
-{
-    return findUeventAttr(path, deviceDevtype)
-           && !isHost(path.filename().string());
-}
+// Name filters for scanning sysfs, like the route-string ones of sysfs.h
 
-bool isXDomain(const fs::path& path)
+bool isDomainName(const char* name)
 {
-    return findUeventAttr(path, xdomainDevtype);
+    return std::strncmp(name, domain.c_str(), domain.size()) == 0;
 }
 
-struct SLDetails
-{
-    int num;
-    std::string desc;
-};
+/// By security_level
+constexpr const char* slDescriptions[] = {
+    "SL0 (none)", "SL1 (user)", "SL2 (secure)", "SL3 (dponly)"};
 
-const std::map<std::string, SLDetails> slMap{{"none", {0, "SL0 (none)"}},
-                                             {"user", {1, "SL1 (user)"}},
-                                             {"secure", {2, "SL2 (secure)"}},
-                                             {"dponly", {3, "SL3 (dponly)"}}};
+/// Whether the error is from a device (or domain) that got disconnected while
+/// being read or written
+bool isDisconnection(const std::error_code& code)
+{
+    return code.category() == std::system_category()
+           && (code.value() == ENOENT || code.value() == ENODEV);
+}
 
 int findSL()
 {
     if (fs::exists(sysfsDevicesPath))
     {
-        for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+        tbtadm::Directory bus(sysfsDevicesPath, isDomainName);
+        for (const auto& entry : bus)
         {
-            if (!is_directory(dir))
+            try
             {
-                continue;
+                tbtadm::Directory dir(bus, entry.name());
+                if (isDomain(dir))
+                {
+                    return readAttribute(dir, attr::security);
+                }
             }
-            if (isDomain(dir.path()))
+            catch (std::system_error& e)
             {
-                return slMap.find(readAndTrim(dir.path() / securityFilename))
-                    ->second.num;
+                // Removed meanwhile; try the next one
+                if (!isDisconnection(e.code()))
+                {
+                    throw;
+                }
             }
         }
     }
@@ -240,6 +307,266 @@ int findSL()
     return tbtadm::Controller::UnkownSL;
 }
 
+/// The security level of the domain of the given device (in the bus directory)
+tbtadm::security_level domainSL(const fs::path& device)
+{
+    const auto routeString = device.filename().string();
+    const auto domainName =
+        domain + routeString.substr(0, routeString.find('-'));
+    return readAttribute(sysfsDevicesPath / domainName, attr::security);
+}
+
+/// Checks if there is an ACL entry for the given UUID (with a key, in SL2)
+/// @return @p in, @p notIn, or @p noKey for an SL2 entry with no key
+template <typename Result>
+Result aclStatus(const tbtadm::Directory* acl,
+                 const std::string& uuid,
+                 int sl,
+                 Result in,
+                 Result notIn,
+                 Result noKey)
+{
+    if (!acl || !acl->exists(uuid))
+    {
+        return notIn;
+    }
+    if (sl == tbtadm::SECURITY_LEVEL_SECURE
+        && !acl->exists(uuid + '/' + attr::key.name))
+    {
+        return noKey;
+    }
+    return in;
+}
+
+const char* const inACLStatus = "in ACL";
+
+/// A connected device for `devices`; its attributes are read when first needed
+/// and kept for printing
+class DeviceRow : public tbtadm::Filter::Row
+{
+public:
+    DeviceRow(const tbtadm::Directory& dir,
+              const std::string& routeString,
+              const tbtadm::Directory* acl,
+              int sl)
+        : m_dir(dir), m_acl(acl), m_sl(sl)
+    {
+        m_device.routeString = routeString;
+    }
+
+    std::string domain() override
+    {
+        return m_device.routeString.substr(0, m_device.routeString.find('-'));
+    }
+
+    bool connected() override { return true; }
+
+    bool authorized() override
+    {
+        if (!(m_read & readAuthorized))
+        {
+            m_device.authorized = readAttribute(m_dir, attr::authorized);
+            m_read |= readAuthorized;
+        }
+        return m_device.authorized;
+    }
+
+    bool inACL() override { return aclStatus() == inACLStatus; }
+
+    std::string vendor() override
+    {
+        if (!(m_read & readVendorName))
+        {
+            m_device.vendor = readVendor(m_dir);
+            m_read |= readVendorName;
+        }
+        return m_device.vendor;
+    }
+
+    const char* aclStatus()
+    {
+        if (!m_aclStatus)
+        {
+            m_aclStatus = ::aclStatus<const char*>(m_acl,
+                                                   uuid(),
+                                                   m_sl,
+                                                   inACLStatus,
+                                                   "not in ACL",
+                                                   "not in ACL (no key)");
+        }
+        return m_aclStatus;
+    }
+
+    /// Reads whatever wasn't read yet
+    const tbtadm::CachedDevice& state()
+    {
+        authorized();
+        uuid();
+        vendor();
+        m_device.device = readDevice(m_dir);
+        return m_device;
+    }
+
+private:
+    const std::string& uuid()
+    {
+        if (!(m_read & readUUID))
+        {
+            m_device.uuid = readAttribute(m_dir, attr::uniqueID);
+            m_read |= readUUID;
+        }
+        return m_device.uuid;
+    }
+
+    enum : unsigned
+    {
+        readAuthorized = 1,
+        readUUID       = 2,
+        readVendorName = 4
+    };
+
+    const tbtadm::Directory& m_dir;
+    const tbtadm::Directory* m_acl;
+    int m_sl;
+    unsigned m_read         = 0;
+    const char* m_aclStatus = nullptr;
+    tbtadm::CachedDevice m_device;
+};
+
+/// A device of a suspended domain for `devices`, as found in the device cache
+/// (if at all)
+class CachedRow : public tbtadm::Filter::Row
+{
+public:
+    CachedRow(const std::string& domainNum,
+              const tbtadm::CachedDevice* device,
+              const tbtadm::Directory* acl,
+              int sl)
+        : m_domain(domainNum), m_device(device), m_acl(acl), m_sl(sl)
+    {
+    }
+
+    bool known(tbtadm::Filter::Field field) override
+    {
+        return m_device || field == tbtadm::Filter::Field::Domain;
+    }
+
+    std::string domain() override { return m_domain; }
+    bool connected() override { return true; }
+    bool authorized() override { return m_device->authorized; }
+    std::string vendor() override { return m_device->vendor; }
+
+    bool inACL() override
+    {
+        return aclStatus(m_acl, m_device->uuid, m_sl, true, false, false);
+    }
+
+private:
+    std::string m_domain;
+    const tbtadm::CachedDevice* m_device;
+    const tbtadm::Directory* m_acl;
+    int m_sl;
+};
+
+/// Connected device, as `acl` sees it
+struct ConnectedDevice
+{
+    std::string routeString;
+    bool authorized;
+};
+
+/// An ACL entry for `acl`; its names are read when first needed
+class ACLRow : public tbtadm::Filter::Row
+{
+public:
+    ACLRow(const tbtadm::Directory& acl,
+           std::string uuid,
+           const ConnectedDevice* device)
+        : m_acl(acl), m_uuid(std::move(uuid)), m_device(device)
+    {
+    }
+
+    bool known(tbtadm::Filter::Field field) override
+    {
+        // Only connected devices have a domain
+        return m_device || field != tbtadm::Filter::Field::Domain;
+    }
+
+    std::string domain() override
+    {
+        return m_device->routeString.substr(0,
+                                            m_device->routeString.find('-'));
+    }
+
+    bool connected() override { return m_device; }
+    bool authorized() override { return m_device && m_device->authorized; }
+    bool inACL() override { return true; }
+
+    std::string vendor() override
+    {
+        if (m_vendor.empty())
+        {
+            m_vendor = readVendor(m_acl, m_uuid + '/' + attr::vendorName.name);
+        }
+        return m_vendor;
+    }
+
+    const std::string& uuid() const { return m_uuid; }
+    const ConnectedDevice* device() const { return m_device; }
+
+private:
+    const tbtadm::Directory& m_acl;
+    std::string m_uuid;
+    const ConnectedDevice* m_device;
+    std::string m_vendor;
+};
+
+/// Formats bandwidth given in Mb/s, e.g. "17.28 Gb/s"
+std::string gbps(long mbps)
+{
+    std::ostringstream out;
+    out << mbps / 1000;
+    if (mbps % 1000)
+    {
+        out << '.' << std::setw(2) << std::setfill('0') << (mbps % 1000) / 10;
+    }
+    out << " Gb/s";
+    return out.str();
+}
+
+/// Formats a duration, e.g. "12.3 ms"
+std::string milliseconds(std::chrono::steady_clock::duration duration)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1)
+        << std::chrono::duration<double, std::milli>(duration).count()
+        << " ms";
+    return out.str();
+}
+
+/// Exports the authorization to the metrics; they're best effort, so failures
+/// (e.g. no permissions) are ignored. The executor runs it concurrently, so the
+/// gauges are left to the end of the command.
+void recordAuthorization(unsigned attempts,
+                         std::chrono::steady_clock::time_point start,
+                         int error)
+{
+    tbtadm::Metrics(false).authorization(
+        "tbtadm", attempts, std::chrono::steady_clock::now() - start, error);
+}
+
+/// Throws if the kernel can't de-authorize devices of the given domain
+void checkDeauthorization(const std::string& domainName)
+{
+    const auto path = sysfsDevicesPath / domainName;
+    if (!fs::exists(path / attr::deauthorization.name)
+        || !readAttribute(path, attr::deauthorization))
+    {
+        throw std::runtime_error("De-authorization isn't supported by "
+                                 + domainName);
+    }
+}
+
 bool sysfsDeviceExists()
 {
     if (!fs::exists(sysfsDevicesPath))
@@ -256,36 +583,157 @@ tbtadm::Controller::Controller(int argc,
                                char* argv[],
                                std::ostream& out,
                                std::ostream& err)
-    : m_argc(argc), m_argv(argv), m_out(out), m_err(err)
+    : m_argc(argc),
+      m_argv(argv),
+      m_out(out),
+      m_err(err),
+      m_useColor(::isatty(STDOUT_FILENO)),
+      m_store(acltree)
 {
 }
 
 void tbtadm::Controller::run()
+{
+    auto exportGauges = [this] {
+        if (m_gaugesStale.exchange(false))
+        {
+            Metrics().update();
+        }
+    };
+    try
+    {
+        dispatch();
+    }
+    catch (...)
+    {
+        exportGauges();
+        throw;
+    }
+    exportGauges();
+}
+
+void tbtadm::Controller::dispatch()
 {
     if (m_argc >= 2)
     {
         if (m_argv[1] == opt_devices)
         {
+            for (int i = 2; i < m_argc; ++i)
+            {
+                if (m_argv[i] == opt_unaligned)
+                {
+                    m_unaligned = true;
+                }
+                else if (m_argv[i] == opt_no_wake)
+                {
+                    m_noWake = true;
+                }
+                else if (m_argv[i] == opt_filter && i + 1 < m_argc)
+                {
+                    m_filter.add(m_argv[++i]);
+                }
+            }
             return devices();
         }
         if (m_argv[1] == opt_peers)
         {
+            if (m_argc == 3 && m_argv[2] == opt_unaligned)
+            {
+                m_unaligned = true;
+            }
             return peers();
         }
         if (m_argv[1] == opt_topology)
         {
-            return topology();
+            bool valid = true;
+            for (int i = 2; valid && i < m_argc; ++i)
+            {
+                if (m_argv[i] == opt_domain && i + 1 < m_argc)
+                {
+                    m_scopeDomain = m_argv[++i];
+                }
+                else if (m_argv[i] == opt_root && i + 1 < m_argc)
+                {
+                    m_scopeRoot = m_argv[++i];
+                }
+                else if (m_argv[i] == opt_depth && i + 1 < m_argc)
+                {
+                    valid = parseUnsigned(m_argv[++i], m_scopeDepth);
+                }
+                else
+                {
+                    valid = false;
+                }
+            }
+            if (valid)
+            {
+                return topology();
+            }
+            if (m_argc == 4 && m_argv[2] == opt_save)
+            {
+                return saveTopology(m_argv[3]);
+            }
+            if (m_argc == 4 && m_argv[2] == opt_diff)
+            {
+                return diffTopology(m_argv[3]);
+            }
+        }
+        if (m_argv[1] == opt_links)
+        {
+            if (m_argc == 3 && m_argv[2] == opt_unaligned)
+            {
+                m_unaligned = true;
+            }
+            return links();
+        }
+        if (m_argv[1] == opt_bandwidth)
+        {
+            for (int i = 2; i < m_argc; ++i)
+            {
+                if (m_argv[i] == opt_unaligned)
+                {
+                    m_unaligned = true;
+                }
+                else if (m_argv[i] == opt_json)
+                {
+                    m_json = true;
+                }
+            }
+            return bandwidth();
         }
         if (m_argv[1] == opt_approve)
         {
-            if (m_argc == 3 || m_argc == 4)
+            bool valid = m_argc >= 3;
+            for (int i = 2; valid && i < m_argc - 1; ++i)
             {
-                if (m_argv[2] == opt_once_flag)
+                if (m_argv[i] == opt_once_flag)
                 {
                     m_once = true;
                 }
-                m_sl = findSL();
-                return approve(sysfsDevicesPath / m_argv[m_argc - 1]);
+                else if (m_argv[i] == opt_wait_ready)
+                {
+                    m_waitReady = true;
+                }
+                else if (m_argv[i] == opt_timeout && i + 1 < m_argc - 1)
+                {
+                    unsigned seconds = 0;
+                    valid            = parseUnsigned(m_argv[++i], seconds);
+                    m_readyTimeout   = std::chrono::seconds(seconds);
+                }
+                else
+                {
+                    valid = false;
+                }
+            }
+            if (valid)
+            {
+                const auto dir = sysfsDevicesPath / m_argv[m_argc - 1];
+                if (m_waitReady)
+                {
+                    return approveAndWait(dir);
+                }
+                approve(dir);
+                return updateDeviceCache({dir.filename().string()});
             }
         }
         if (m_argv[1] == opt_approve_all)
@@ -294,10 +742,33 @@ void tbtadm::Controller::run()
             {
                 m_once = true;
             }
-            return approveAll();
+            // The devices added to the ACL make a single ACL update
+            return aclBatch([this] { approveAll(); });
+        }
+        if (m_argv[1] == opt_deauth)
+        {
+            if (m_argc == 3)
+            {
+                return deauthorize(m_argv[2]);
+            }
+        }
+        if (m_argv[1] == opt_deauth_all)
+        {
+            return deauthorizeAll();
         }
         if (m_argv[1] == opt_acl)
         {
+            for (int i = 2; i < m_argc; ++i)
+            {
+                if (m_argv[i] == opt_unaligned)
+                {
+                    m_unaligned = true;
+                }
+                else if (m_argv[i] == opt_filter && i + 1 < m_argc)
+                {
+                    m_filter.add(m_argv[++i]);
+                }
+            }
             return acl();
         }
         if (m_argv[1] == opt_add)
@@ -319,15 +790,66 @@ void tbtadm::Controller::run()
         {
             return removeAll();
         }
+        if (m_argv[1] == opt_batch)
+        {
+            if (m_argc <= 3)
+            {
+                return batch(m_argc == 3 ? m_argv[2] : batchStdin);
+            }
+        }
+        if (m_argv[1] == opt_policy)
+        {
+            if (m_argc == 4 && m_argv[2] == opt_policy_test)
+            {
+                return policyTest(m_argv[3]);
+            }
+        }
+        if (m_argv[1] == opt_capture)
+        {
+            if (m_argc == 3)
+            {
+                return capture(m_argv[2], std::chrono::seconds(0));
+            }
+            unsigned seconds = 0;
+            if (m_argc == 5 && m_argv[2] == opt_events
+                && parseUnsigned(m_argv[3], seconds))
+            {
+                return capture(m_argv[4], std::chrono::seconds(seconds));
+            }
+        }
+        if (m_argv[1] == opt_nvm)
+        {
+            if (m_argc == 5 && m_argv[2] == opt_nvm_upgrade)
+            {
+                return nvmUpgrade(sysfsDevicesPath / m_argv[3], m_argv[4]);
+            }
+        }
     }
 
     // TODO: help
-    const std::string sep = " | ";
-    m_out << "Usage: " << opt_devices << sep << opt_peers << sep << opt_topology
-          << sep << opt_approve << " [" << opt_once_flag << "] <route-string>"
-          << sep << opt_approve_all << " [" << opt_once_flag << ']' << sep
-          << opt_acl << sep << opt_add << " <route-string>" << sep << opt_remove
-          << " <uuid>|<route-string>" << sep << opt_remove_all << "\n";
+    const std::string sep       = " | ";
+    const std::string unaligned = " [" + opt_unaligned + ']';
+    const std::string filter    = " [" + opt_filter + " <term>]...";
+    m_out << "Usage: " << opt_devices << unaligned << " [" << opt_no_wake
+          << ']' << filter << sep << opt_peers << unaligned << sep
+          << opt_topology
+          << " [" << opt_domain << " <domain>] [" << opt_root
+          << " <route-string>] [" << opt_depth << " <levels>]" << sep
+          << opt_topology << " " << opt_save << '|' << opt_diff << " <file>"
+          << sep
+          << opt_links << unaligned << sep << opt_bandwidth << unaligned
+          << " [" << opt_json << ']' << sep << opt_approve << " ["
+          << opt_once_flag << "] [" << opt_wait_ready << " [" << opt_timeout
+          << " <seconds>]] <route-string>" << sep << opt_approve_all
+          << " [" << opt_once_flag << ']' << sep << opt_deauth
+          << " <route-string>" << sep << opt_deauth_all << sep << opt_acl
+          << unaligned << filter << sep
+          << opt_add << " <route-string>" << sep << opt_remove
+          << " <uuid>|<route-string>" << sep << opt_remove_all << sep
+          << opt_nvm << ' ' << opt_nvm_upgrade << " <route-string> <image>"
+          << sep << opt_batch << " [<file>]" << sep << opt_capture << " ["
+          << opt_events << " <seconds>] <file>" << sep << opt_policy << ' '
+          << opt_policy_test << " <route-string>\n";
     throw std::runtime_error("Wrong usage");
 }
 
@@ -340,73 +862,195 @@ void tbtadm::Controller::devices()
 
     m_sl = findSL();
 
+    DeviceCache cache(deviceCachePath);
+    cache.load();
+
+    auto acl = openACL();
+    m_filter.order({Filter::Field::Domain,
+                    Filter::Field::Connected,
+                    Filter::Field::Authorized,
+                    Filter::Field::InACL,
+                    Filter::Field::Vendor});
+
+    Table table(m_out, m_useColor, m_unaligned);
+    std::map<std::string, CachedDevice> seen;
+    std::map<std::string, bool> suspended;
+
+    // Suspended domains are only kept away from if listing would wake them up
+    const bool noWake = m_noWake && readingStateWakes;
+
     // Find and print devices
-    for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+    Directory bus(sysfsDevicesPath, isConnectedRouteString);
+    for (const auto& entry : bus)
     {
-        if (!is_directory(dir))
-        {
-            continue;
-        }
-        if (!isDevice(dir.path()))
+        const std::string routeString = entry.name();
+        const auto domainNum = routeString.substr(0, routeString.find('-'));
+        if (!m_filter.allows(domainNum))
         {
             continue;
         }
 
-        bool authorized = stoi(readAndTrim(dir.path() / authorizedFilename));
-
-        auto inACL = [sl = m_sl] (const auto& dir)
+        try
         {
-            auto aclDir = acltree / readAndTrim(dir.path() / uniqueIDFilename);
-
-            if (!fs::exists(aclDir))
+            Directory dir(bus, entry.name());
+            if (!isDevice(dir))
             {
-                return "not in ACL";
+                continue;
             }
-            if (sl == 2 && !fs::exists(aclDir / keyFilename))
+
+            if (noWake && !suspended.count(domainNum))
             {
-                return "not in ACL (no key)";
+                suspended[domainNum] = isSuspended(domainNum);
             }
-            return "in ACL";
-        };
-
-        // TODO: better formatting
-        const auto routeString = dir.path().filename().string();
 
-        Highlight highlight(m_out, authorized ? green : normal);
+            if (!noWake || !suspended[domainNum])
+            {
+                DeviceRow row(dir, routeString, acl.get(), m_sl);
+                if (!m_filter.matches(row))
+                {
+                    continue;
+                }
+                const auto& device = row.state();
+                table.add({routeString,
+                           device.vendor,
+                           device.device,
+                           device.authorized ? "authorized" : "non-authorized",
+                           row.aclStatus()},
+                          device.authorized ? Table::Color::Green
+                                            : Table::Color::Normal);
+                seen.emplace(routeString, device);
+                continue;
+            }
 
-        m_out << routeString << '\t' << readVendor(dir.path() / vendorFilename)
-              << '\t' << readDevice(dir.path() / deviceFilename)
-              << '\t' << (authorized ? "authorized" : "non-authorized")
-              << '\t' << inACL(dir) << '\n';
-    }
+            // The domain is asleep; report what we know without waking it up
+            const auto* device = cache.find(routeString);
+            CachedRow row(domainNum, device, acl.get(), m_sl);
+            if (!m_filter.matches(row))
+            {
+                continue;
+            }
+            if (!device)
+            {
+                table.add({routeString,
+                           "Unknown vendor",
+                           "Unknown device",
+                           "unknown (suspended)",
+                           "unknown"});
+                continue;
+            }
+            table.add({routeString,
+                       device->vendor,
+                       device->device,
+                       device->authorized ? "authorized (cached)"
+                                          : "non-authorized (cached)",
+                       aclStatus<const char*>(acl.get(),
+                                              device->uuid,
+                                              m_sl,
+                                              inACLStatus,
+                                              "not in ACL",
+                                              "not in ACL (no key)")},
+                      device->authorized ? Table::Color::Green
+                                         : Table::Color::Normal);
+            seen.emplace(routeString, *device);
+        }
+        catch (std::system_error& e)
+        {
+            // Disconnected while being read
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
+        }
+    }
+    table.print();
+
+    if (m_filter.empty())
+    {
+        replaceDeviceCache(cache, std::move(seen));
+    }
 }
 
-void tbtadm::Controller::peers()
+bool tbtadm::Controller::isSuspended(const std::string& domainNum)
 {
-    if (!sysfsDeviceExists())
+    try
     {
-        return;
+        auto status = readAndTrim(sysfsDevicesPath / (domain + domainNum)
+                                  / runtimeStatusFilename);
+        return status == "suspended" || status == "suspending";
+    }
+    catch (std::exception&)
+    {
+        // No runtime PM support
+        return false;
     }
+}
 
-    for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+void tbtadm::Controller::updateDeviceCache(
+    const std::vector<std::string>& routeStrings)
+{
+    // Only the given devices are read, so other domains aren't woken up
+    std::vector<CachedDevice> devices;
+    std::vector<std::string> gone;
+    for (const auto& routeString : routeStrings)
     {
-        if (!is_directory(dir))
+        try
         {
-            continue;
+            Directory dir(sysfsDevicesPath / routeString);
+            devices.push_back(readDeviceState(dir, routeString));
         }
-        if (!isXDomain(dir.path()))
+        catch (std::exception&)
         {
-            continue;
+            gone.push_back(routeString);
         }
+    }
+
+    try
+    {
+        DeviceCache(deviceCachePath).update(devices, gone);
+    }
+    catch (std::exception&)
+    {
+        // See replaceDeviceCache()
+    }
+}
+
+void tbtadm::Controller::replaceDeviceCache(
+    DeviceCache& cache, std::map<std::string, CachedDevice> devices)
+{
+    try
+    {
+        cache.replace(std::move(devices));
+    }
+    catch (std::exception&)
+    {
+        // The cache is only an optimization; e.g. a non-root user can still
+        // list the devices, they just can't update it
+    }
+}
+
+void tbtadm::Controller::peers()
+{
+    if (!sysfsDeviceExists())
+    {
+        return;
+    }
 
-        chdir(dir.path());
+    Table table(m_out, m_useColor, m_unaligned);
 
-        // TODO: better formatting
-        const auto routeString = dir.path().filename().string();
+    Directory bus(sysfsDevicesPath, isConnectedRouteString);
+    for (const auto& entry : bus)
+    {
+        // Reading relative to the opened directory, so all the attributes are
+        // of the same device even if it's replaced in the meantime
+        Directory dir(bus, entry.name());
+        if (!isXDomain(dir))
+        {
+            continue;
+        }
 
-        m_out << routeString << '\t' << readVendor(vendorFilename) << '\t'
-              << readDevice(deviceFilename) << std::endl;
+        table.add({entry.name(), readVendor(dir), readDevice(dir)});
     }
+    table.print();
 }
 
 struct tbtadm::Controller::ControllerInTree
@@ -418,6 +1062,74 @@ struct tbtadm::Controller::ControllerInTree
     std::map<std::string, ControllerInTree> m_children;
 };
 
+tbtadm::Controller::ControllerInTree
+tbtadm::Controller::domainTree(const Directory& bus,
+                               const std::string& hostName,
+                               const Directory* acl)
+{
+    const auto num       = hostName.substr(0, hostName.find('-'));
+    const auto domainDir = sysfsDevicesPath / (domain + num);
+    const auto sl        = readAttribute(domainDir, attr::security);
+    m_sl                 = sl;
+
+    Directory dir(bus, hostName, isRouteString);
+    std::vector<std::string> desc;
+    desc.emplace_back("Controller " + num + '\n');
+    desc.emplace_back("Name: " + readDevice(dir) + ", " + readVendor(dir)
+                      + '\n');
+    desc.emplace_back("Security level: "s + slDescriptions[sl] + '\n');
+    BootACL bootACL(domainDir);
+    if (bootACL.supported())
+    {
+        desc.emplace_back("Boot ACL: " + std::to_string(bootACL.capacity())
+                          + " slots\n");
+    }
+    ControllerInTree controller(std::move(desc));
+    if (m_scopeRoot.empty())
+    {
+        createTree(controller,
+                   dir,
+                   acl,
+                   bootACL,
+                   readLink(dir).generation,
+                   {},
+                   m_scopeDepth);
+        return controller;
+    }
+
+    // Only the links on the way down to the root are read, for its path
+    // bandwidth
+    std::vector<std::string> ancestors;
+    for (auto route = parentRouteString(m_scopeRoot);
+         route != hostName;
+         route = parentRouteString(route))
+    {
+        ancestors.push_back(route);
+    }
+    auto generation = readLink(dir).generation;
+    PathBandwidth path;
+    for (auto route = ancestors.rbegin(); route != ancestors.rend(); ++route)
+    {
+        Directory next(dir, *route, isRouteString);
+        auto link = readLink(next);
+        if (link.known())
+        {
+            path = analyzeHop(*route, link, generation, path).path;
+        }
+        generation = link.generation;
+        dir        = std::move(next);
+    }
+    addToTree(controller,
+              dir,
+              m_scopeRoot,
+              acl,
+              bootACL,
+              generation,
+              path,
+              m_scopeDepth);
+    return controller;
+}
+
 void tbtadm::Controller::topology()
 {
     std::map<int, ControllerInTree> controllers;
@@ -427,29 +1139,41 @@ void tbtadm::Controller::topology()
         return;
     }
 
-    for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+    // The route-string starts with the domain number
+    auto scopeDomain = m_scopeRoot.empty()
+                           ? m_scopeDomain
+                           : m_scopeRoot.substr(0, m_scopeRoot.find('-'));
+    if (!m_scopeRoot.empty() && !fs::exists(sysfsDevicesPath / m_scopeRoot))
+    {
+        throw std::runtime_error(m_scopeRoot + " isn't connected");
+    }
+
+    auto acl = openACL();
+    Directory bus(sysfsDevicesPath, isHostRouteString);
+    for (const auto& entry : bus)
     {
-        if (!is_directory(dir))
+        const std::string name = entry.name();
+        const auto num         = name.substr(0, name.find('-'));
+        if (!scopeDomain.empty() && scopeDomain != num)
         {
             continue;
         }
-        auto p           = dir.path();
-        auto routeString = p.filename().string();
-        if (isHost(routeString))
+        try
+        {
+            controllers.emplace(std::stoi(num),
+                                domainTree(bus, name, acl.get()));
+        }
+        catch (std::system_error& e)
         {
-            auto num      = routeString[0];
-            auto security = p.parent_path() / (domain + num) / securityFilename;
-            m_sl          = slMap.find(readAndTrim(security))->second.num;
-            std::vector<std::string> desc;
-            desc.emplace_back("Controller "s + num + '\n');
-            desc.emplace_back("Name: " + readDevice(p / deviceFilename) + ", "
-                              + readVendor(p / vendorFilename)
-                              + '\n');
-            desc.emplace_back("Security level: "
-                              + slMap.find(readAndTrim(security))->second.desc
-                              + '\n');
-            auto i = controllers.emplace(num, std::move(desc)).first;
-            createTree(i->second, dir.path());
+            // The domain (or the root) was removed while being read
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
+            if (!m_scopeRoot.empty())
+            {
+                throw std::runtime_error(m_scopeRoot + " was disconnected");
+            }
         }
     }
 
@@ -468,324 +1192,1239 @@ void tbtadm::Controller::topology()
 }
 
 void tbtadm::Controller::createTree(ControllerInTree& controller,
-                                    const fs::path& path)
+                                    Directory& parent,
+                                    const Directory* acl,
+                                    const BootACL& bootACL,
+                                    unsigned parentGeneration,
+                                    const PathBandwidth& parentPath,
+                                    unsigned depth)
 {
-    auto authorized = [](const auto& path) -> std::string {
-        return stoi(readAndTrim(path / authorizedFilename)) ? "Yes" : "No";
-    };
-    auto inACL = [sl = m_sl](const auto& path)->std::string
+    if (!depth)
     {
-        auto aclDir = acltree / readAndTrim(path / uniqueIDFilename);
-        if (!fs::exists(aclDir))
-        {
-            return "No";
-        }
-        if (sl == 2 && !fs::exists(aclDir / keyFilename))
-        {
-            return "No (no key)";
-        }
-        return "Yes";
-    };
+        return;
+    }
 
-    for (auto& dir : fs::directory_iterator(path))
+    for (const auto& entry : parent)
     {
-        if (!is_directory(dir))
+        if (!entry.isDirectory())
         {
             continue;
         }
-        auto p           = dir.path();
-        auto routeString = p.filename().string();
-        std::vector<std::string> desc;
-
-        if (isDevice(p))
+        try
         {
-            desc.emplace_back(readDevice(p / deviceFilename) + ", "
-                              + readVendor(p / vendorFilename)
-                              + "\n");
-            desc.emplace_back("Route-string: " + routeString + "\n");
-            desc.emplace_back("Authorized: " + authorized(p) + "\n");
-            desc.emplace_back("In ACL: " + inACL(p) + "\n");
-            desc.emplace_back("UUID: " + readAndTrim(p / uniqueIDFilename)
-                              + "\n");
+            addToTree(controller,
+                      parent,
+                      entry.name(),
+                      acl,
+                      bootACL,
+                      parentGeneration,
+                      parentPath,
+                      depth);
         }
-        else if (isXDomain(p))
+        catch (std::system_error& e)
         {
-            desc.emplace_back(readDevice(p / deviceFilename) + ", "
-                              + readVendor(p / vendorFilename)
-                              + "\n");
-            desc.emplace_back("Route-string: " + routeString + "\n");
-            desc.emplace_back("UUID: " + readAndTrim(p / uniqueIDFilename)
-                              + "\n");
+            // Disconnected while being read; it's added only when complete
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
         }
-        else
+    }
+}
+
+void tbtadm::Controller::addToTree(ControllerInTree& controller,
+                                   Directory& parent,
+                                   const std::string& routeString,
+                                   const Directory* acl,
+                                   const BootACL& bootACL,
+                                   unsigned parentGeneration,
+                                   const PathBandwidth& parentPath,
+                                   unsigned depth)
+{
+    auto authorized = [](const auto& dir) -> std::string {
+        return readAttribute(dir, attr::authorized) ? "Yes" : "No";
+    };
+    auto inACL = [acl, sl = m_sl](const auto& dir) -> std::string {
+        return aclStatus<std::string>(acl,
+                                      readAttribute(dir, attr::uniqueID),
+                                      sl,
+                                      "Yes",
+                                      "No",
+                                      "No (no key)");
+    };
+
+    Directory dir(parent, routeString, isRouteString);
+    std::vector<std::string> desc;
+
+    if (isDevice(dir))
+    {
+        desc.emplace_back(readDevice(dir) + ", " + readVendor(dir) + "\n");
+        desc.emplace_back("Route-string: " + routeString + "\n");
+        desc.emplace_back("Authorized: " + authorized(dir) + "\n");
+        desc.emplace_back("In ACL: " + inACL(dir) + "\n");
+        const auto uuid = readAttribute(dir, attr::uniqueID);
+        if (bootACL.supported())
         {
-            continue;
+            desc.emplace_back("In boot ACL: "s
+                              + (bootACL.contains(uuid) ? "Yes" : "No")
+                              + "\n");
         }
+        desc.emplace_back("UUID: " + uuid + "\n");
+    }
+    else if (isXDomain(dir))
+    {
+        desc.emplace_back(readDevice(dir) + ", " + readVendor(dir) + "\n");
+        desc.emplace_back("Route-string: " + routeString + "\n");
+        desc.emplace_back("UUID: " + readAttribute(dir, attr::uniqueID) + "\n");
+    }
+    else
+    {
+        return;
+    }
 
-        auto i =
-            controller.m_children.emplace(routeString, std::move(desc)).first;
-        createTree(i->second, dir.path());
+    // Link details are there only with newer kernels
+    auto link = readLink(dir);
+    auto path = parentPath;
+    if (link.known())
+    {
+        auto analysis = analyzeHop(routeString, link, parentGeneration, path);
+        path          = analysis.path;
+        desc.emplace_back("Link: " + describe(link) + "\n");
+        desc.emplace_back("Path bandwidth: " + describe(path) + "\n");
+        for (const auto& bottleneck : analysis.bottlenecks)
+        {
+            desc.emplace_back("Bottleneck: " + bottleneck + "\n");
+        }
     }
+
+    auto i = controller.m_children.emplace(routeString, std::move(desc)).first;
+    createTree(i->second, dir, acl, bootACL, link.generation, path, depth - 1);
 }
 
-void tbtadm::Controller::printTree(
-    std::string& indentation,
-    const std::map<std::string, ControllerInTree>& map)
+void tbtadm::Controller::saveTopology(const fs::path& path)
 {
-    for (const auto& device : map)
-    {
-        auto last = device.first == map.rbegin()->first;
-        m_out << indentation << SYMBOL_PIPE << "\n";
-        m_out << indentation << (last ? SYMBOL_L : SYMBOL_PLUS)
-              << device.second.m_desc[0];
-        indentation += last ? indentLast : indent;
-        printDetails(device.second.m_children.empty(),
-                     indentation,
-                     device.second.m_desc);
-        printTree(indentation, device.second.m_children);
-        indentation.resize(indentation.size() - indentLength);
-    }
+    takeSnapshot().save(path);
 }
 
-void tbtadm::Controller::printDetails(bool last,
-                                      std::string& indentation,
-                                      const std::vector<std::string>& details)
+void tbtadm::Controller::diffTopology(const fs::path& path)
 {
-    m_out << indentation << (last ? SYMBOL_L : SYMBOL_PLUS)
-          << "Details:\n";
+    TopologySnapshot saved;
+    saved.load(path);
 
-    indentation += last ? indentLast : indent;
+    const auto changes = saved.diff(takeSnapshot());
+    if (changes.empty())
+    {
+        m_out << "No changes\n";
+        return;
+    }
 
-    size_t detailsSize = details.size();
-    for (size_t i = 1; i < detailsSize; ++i)
+    Table table(m_out, m_useColor, m_unaligned);
+    for (const auto& change : changes)
     {
-        if (i == detailsSize - 1)
-            m_out << indentation << SYMBOL_L << details[i];
-        else
-            m_out << indentation << SYMBOL_PLUS << details[i];
+        const auto& device = change.device;
+        std::string kind;
+        auto color = Table::Color::Normal;
+        switch (change.kind)
+        {
+            case SnapshotChange::Kind::Added:
+                kind  = "added";
+                color = Table::Color::Green;
+                break;
+            case SnapshotChange::Kind::Removed:
+                kind  = "removed";
+                color = Table::Color::Yellow;
+                break;
+            case SnapshotChange::Kind::Moved:
+                kind = "moved";
+                break;
+            case SnapshotChange::Kind::Changed:
+                kind = "changed";
+                break;
+        }
+
+        std::string details;
+        for (const auto& detail : change.details)
+        {
+            details += (details.empty() ? "" : "; ") + detail;
+        }
+        table.add({kind,
+                   device.routeString,
+                   device.vendor + ' ' + device.device,
+                   device.uuid,
+                   details},
+                  color);
     }
-    indentation.resize(indentation.size() - indent.size());
+    table.print();
 }
 
-void tbtadm::Controller::approveAll()
+tbtadm::TopologySnapshot tbtadm::Controller::takeSnapshot()
 {
+    TopologySnapshot snapshot;
     if (!sysfsDeviceExists())
     {
-        return;
+        return snapshot;
     }
 
-    for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+    auto acl = openACL();
+    Directory bus(sysfsDevicesPath, isHostRouteString);
+    for (const auto& entry : bus)
     {
-        if (!is_directory(dir))
+        const std::string name = entry.name();
+        const auto num         = name.substr(0, name.find('-'));
+        try
         {
-            continue;
-        }
-        if (!isDomain(dir.path()))
-        {
-            continue;
+            m_sl = readAttribute(sysfsDevicesPath / (domain + num),
+                                 attr::security);
+
+            Directory dir(bus, entry.name(), isRouteString);
+            addToSnapshot(snapshot, num, dir, acl.get());
         }
-        m_out << "Found domain " << dir << '\n';
-        auto domainNum = dir.path().filename().string().substr(domain.size());
-        m_sl =
-            slMap.find(readAndTrim(dir.path() / securityFilename))->second.num;
-        switch (m_sl)
+        catch (std::system_error& e)
         {
-            case SECURITY_LEVEL_USER:
-            case SECURITY_LEVEL_SECURE:
-                break;
-            case SECURITY_LEVEL_NONE:
-            case SECURITY_LEVEL_DPONLY:
-                m_out << "Approval not relevant in SL" << m_sl << '\n';
-                return;
-            default:
-                m_out << "Unknown Security level " << m_sl << '\n';
-                return;
+            // The domain was removed while being read
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
         }
-        approveAll(dir / (domainNum + hostRouteString));
     }
+    return snapshot;
 }
 
-void tbtadm::Controller::approveAll(const fs::path& dir)
+void tbtadm::Controller::addToSnapshot(TopologySnapshot& snapshot,
+                                       const std::string& domainNum,
+                                       Directory& parent,
+                                       const Directory* acl)
 {
-    for (auto& child : fs::directory_iterator(dir))
+    for (const auto& entry : parent)
     {
-        if (!is_directory(child))
+        if (!entry.isDirectory())
         {
             continue;
         }
-        if (fs::exists(child / authorizedFilename))
+        try
+        {
+            Directory dir(parent, entry.name(), isRouteString);
+
+            SnapshotDevice device;
+            if (isDevice(dir))
+            {
+                device.authorized =
+                    readAttribute(dir, attr::authorized) ? "Yes" : "No";
+                device.uuid  = readAttribute(dir, attr::uniqueID);
+                device.inACL = aclStatus<std::string>(
+                    acl, device.uuid, m_sl, "Yes", "No", "No (no key)");
+            }
+            else if (isXDomain(dir))
+            {
+                device.authorized = "-";
+                device.inACL      = "-";
+                device.uuid       = readAttribute(dir, attr::uniqueID);
+            }
+            else
+            {
+                continue;
+            }
+
+            device.domain      = domainNum;
+            device.routeString = entry.name();
+            device.vendor      = readVendor(dir);
+            device.device      = readDevice(dir);
+            auto link          = readLink(dir);
+            if (link.known())
+            {
+                device.link = describe(link);
+            }
+            snapshot.add(std::move(device));
+
+            addToSnapshot(snapshot, domainNum, dir, acl);
+        }
+        catch (std::system_error& e)
         {
-            m_out << "Found child " << child << '\n';
-            approve(child);
-            approveAll(child);
+            // Disconnected while being read; it's added only when complete
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
         }
     }
 }
 
-// TODO: move to tbtadm-helper
-void tbtadm::Controller::approve(const fs::path& dir) try
+void tbtadm::Controller::capture(const fs::path& path,
+                                 std::chrono::seconds events)
 {
-    m_out << "Authorizing " << dir << '\n';
-
-    File authorized(dir / authorizedFilename, File::Mode::Read);
-    if (std::stoi(authorized.read()))
+    Capture capture;
+    if (sysfsDeviceExists())
     {
-        m_out << "Already authorized\n";
-        return;
+        capture.addSysfs(sysfsDevicesPath);
     }
-
-    if (!m_once)
+    capture.addACL(acltree);
+    if (events.count())
     {
-        addToACL(dir);
+        m_out << "Recording uevents for " << events.count() << " seconds\n";
+        capture.addEvents(events);
     }
+    capture.save(path);
 
-    std::ostringstream keyStream;
-    if (m_sl == SECURITY_LEVEL_SECURE && !m_once)
-    {
-        std::default_random_engine eng(std::random_device{}());
-        std::uniform_int_distribution<> dist(0, 0xF);
-        keyStream << std::hex;
-        std::generate_n(std::ostream_iterator<int>(keyStream), 64, [&] {
-            return dist(eng);
-        });
+    m_out << "Captured " << capture.devices() << " devices, "
+          << capture.aclEntries() << " ACL entries and " << capture.events()
+          << " uevents to " << path.string() << '\n';
+}
 
-        File key(dir / keyFilename, File::Mode::Write);
-        key << keyStream.str();
+void tbtadm::Controller::policyTest(const std::string& routeString)
+{
+    Policy policy;
+
+    Directory dir(sysfsDevicesPath / routeString);
+    const auto domainName =
+        domain + routeString.substr(0, routeString.find('-'));
+    const auto security = securityLevelNames[readAttribute(
+        sysfsDevicesPath / domainName, attr::security)];
+    const auto device = readPolicyDevice(dir, routeString, security);
+    m_out << std::hex << std::showbase
+          << "vendor=" << readAttribute(dir, attr::vendorID).value
+          << " device=" << readAttribute(dir, attr::deviceID).value
+          << std::dec << std::noshowbase << " vendor-name=\""
+          << device.vendorName << "\" device-name=\"" << device.deviceName
+          << "\" domain=" << device.domain << " security=" << device.security
+          << " depth=" << device.depth << '\n';
+
+    auto acl = openACL();
+    if (acl && acl->exists(readAttribute(dir, attr::uniqueID)))
+    {
+        m_out << "In ACL, which takes precedence over the policy\n";
     }
 
-    authorized = File(dir / authorizedFilename, File::Mode::Write);
-    authorized << 1;
-
-    m_out << "Authorized\n";
-    if (m_sl == SECURITY_LEVEL_SECURE && !m_once)
+    const auto* rule = policy.match(device);
+    if (!rule)
     {
-        File keyACL(acltree / readAndTrim(dir / uniqueIDFilename) / keyFilename,
-                    File::Mode::Write,
-                    O_CREAT,
-                    S_IRUSR);
-        keyACL << keyStream.str();
-        m_out << "Key saved in ACL\n";
+        m_out << "No policy rule matches\n";
+        return;
+    }
+    m_out << (rule->decision == Policy::Decision::Allow ? "Allowed" : "Denied")
+          << " by policy line " << rule->line << ": " << rule->text << '\n';
+    if (rule->decision == Policy::Decision::Allow
+        && device.security == securityLevelNames[SECURITY_LEVEL_SECURE]
+        && !rule->secure)
+    {
+        m_out << "Not applied: the rule doesn't say security=secure\n";
     }
-}
-catch (std::system_error& e)
-{
-    m_err << e.code() << ' ' << e.what() << '\n';
-}
-catch (std::exception& e)
-{
-    m_err << "Exception: " << e.what() << '\n';
-}
-catch (...)
-{
-    m_err << "Unknown exception\n";
 }
 
-void tbtadm::Controller::addToACL(const fs::path& dir)
+void tbtadm::Controller::links()
 {
-    auto acl = acltree / readAndTrim(dir / uniqueIDFilename);
-    if (fs::exists(acl))
+    if (!sysfsDeviceExists())
     {
-        m_out << "Already in ACL\n";
         return;
     }
 
-    fs::create_directories(acl);
-    fs::copy(dir / vendorFilename, acl / vendorFilename);
-    fs::copy(dir / deviceFilename, acl / deviceFilename);
-
-    m_out << "Added to ACL\n";
-}
-
-void tbtadm::Controller::acl()
-{
-    if (!fs::exists(acltree) || fs::is_empty(acltree))
+    Table table(m_out, m_useColor, m_unaligned);
+    Directory bus(sysfsDevicesPath, isHostRouteString);
+    for (const auto& entry : bus)
     {
-        m_out << "ACL is empty\n";
-        return;
+        Directory host(bus, entry.name(), isRouteString);
+        addLinks(table, host, readLink(host).generation, {});
     }
+    table.print();
+}
 
-    // Get UUID of all connected devices
-    std::map<std::string, bool> uuids;
-    if (fs::exists(sysfsDevicesPath))
+void tbtadm::Controller::addLinks(Table& table,
+                                  Directory& parent,
+                                  unsigned parentGeneration,
+                                  const PathBandwidth& parentPath)
+{
+    for (const auto& entry : parent)
     {
-        for (auto& dir : fs::directory_iterator(sysfsDevicesPath))
+        if (!entry.isDirectory())
         {
-            if (!is_directory(dir))
+            continue;
+        }
+        const std::string routeString = entry.name();
+        try
+        {
+            Directory dir(parent, routeString, isRouteString);
+            if (!isDevice(dir) && !isXDomain(dir))
             {
                 continue;
             }
-            if (!isDevice(dir.path()))
+            addLink(table, dir, routeString, parentGeneration, parentPath);
+        }
+        catch (std::system_error& e)
+        {
+            // Disconnected while being read
+            if (!isDisconnection(e.code()))
             {
-                continue;
+                throw;
             }
-            File authorizedFile(dir.path() / authorizedFilename,
-                                File::Mode::Read);
-            bool authorized = std::stoi(authorizedFile.read());
-            std::string uuid(readAndTrim(dir.path() / uniqueIDFilename));
-            uuids.insert(std::make_pair(uuid, authorized));
         }
-        m_sl = findSL();
     }
+}
 
-    // Print ACL
-    bool doNoKey = false;
-    for (auto& dir : fs::directory_iterator(acltree))
+void tbtadm::Controller::addLink(Table& table,
+                                 Directory& dir,
+                                 const std::string& routeString,
+                                 unsigned parentGeneration,
+                                 const PathBandwidth& parentPath)
+{
+    auto link = readLink(dir);
+    auto path = parentPath;
+    if (!link.known())
     {
-        const auto p = dir.path();
-        if (m_sl != SECURITY_LEVEL_SECURE || fs::exists(p / keyFilename))
-        {
-            const auto uuid   = p.filename().string();
-            auto entry        = uuids.find(uuid);
-            bool connected    = entry != uuids.end();
-            std::string color = normal;
-
-            if (connected)
-                color = entry->second ? green : yellow;
-
-            Highlight highlight(m_out, color);
-
-            m_out << uuid << '\t' << readVendor(p / vendorFilename) << '\t'
-                  << readDevice(p / deviceFilename) << '\t'
-                  << (connected ? "connected" : "not connected") << "\n";
-        }
-        else
-        {
-            doNoKey = true;
-        }
+        table.add({routeString, readDevice(dir), "link details unknown"});
     }
-    if (doNoKey)
+    else
     {
-        m_out << "\nACL entries with no key (not for current security mode):\n";
-        for (auto& dir : fs::directory_iterator(acltree))
+        auto analysis = analyzeHop(routeString, link, parentGeneration, path);
+        path          = analysis.path;
+
+        std::string status = "ok";
+        if (!analysis.bottlenecks.empty())
         {
-            const auto p = dir.path();
-            if (!fs::exists(p / keyFilename))
+            status = "bottleneck: " + analysis.bottlenecks[0];
+            for (size_t i = 1; i < analysis.bottlenecks.size(); ++i)
             {
-                const auto uuid   = p.filename().string();
-                auto entry        = uuids.find(uuid);
-                bool connected    = entry != uuids.end();
-                std::string color = normal;
-
-                if (connected)
-                    color = entry->second ? green : yellow;
-
-                Highlight highlight(m_out, color);
-
-                m_out << uuid << '\t' << readVendor(p / vendorFilename) << '\t'
-                      << readDevice(p / deviceFilename) << '\t'
-                      << (connected ? "connected" : "not connected") << "\n";
+                status += "; " + analysis.bottlenecks[i];
             }
         }
+        table.add({routeString,
+                   readDevice(dir),
+                   describe(link),
+                   "path " + describe(path),
+                   status},
+                  analysis.bottlenecks.empty() ? Table::Color::Normal
+                                               : Table::Color::Yellow);
     }
+    addLinks(table, dir, link.generation, path);
 }
 
-void tbtadm::Controller::add(const fs::path& dir)
+void tbtadm::Controller::printTree(
+    std::string& indentation,
+    const std::map<std::string, ControllerInTree>& map)
 {
-    switch (m_sl)
+    for (const auto& device : map)
     {
-        case SECURITY_LEVEL_SECURE:
-            m_out << "Adding to ACL on SL2 must be done together with device "
-                    "approval\n";
+        auto last = device.first == map.rbegin()->first;
+        m_out << indentation << SYMBOL_PIPE << "\n";
+        m_out << indentation << (last ? SYMBOL_L : SYMBOL_PLUS)
+              << device.second.m_desc[0];
+        indentation += last ? indentLast : indent;
+        printDetails(device.second.m_children.empty(),
+                     indentation,
+                     device.second.m_desc);
+        printTree(indentation, device.second.m_children);
+        indentation.resize(indentation.size() - indentLength);
+    }
+}
+
+void tbtadm::Controller::printDetails(bool last,
+                                      std::string& indentation,
+                                      const std::vector<std::string>& details)
+{
+    m_out << indentation << (last ? SYMBOL_L : SYMBOL_PLUS)
+          << "Details:\n";
+
+    indentation += last ? indentLast : indent;
+
+    size_t detailsSize = details.size();
+    for (size_t i = 1; i < detailsSize; ++i)
+    {
+        if (i == detailsSize - 1)
+            m_out << indentation << SYMBOL_L << details[i];
+        else
+            m_out << indentation << SYMBOL_PLUS << details[i];
+    }
+    indentation.resize(indentation.size() - indent.size());
+}
+
+void tbtadm::Controller::bandwidth()
+{
+    if (!sysfsDeviceExists())
+    {
+        return;
+    }
+    if (!fs::exists(debugfsPath))
+    {
+        throw std::runtime_error("Tunnel information isn't available, debugfs "
+                                 "isn't mounted or not accessible");
+    }
+
+    std::vector<HopUsage> hops;
+    Directory bus(sysfsDevicesPath, isHostRouteString);
+    for (const auto& entry : bus)
+    {
+        Directory host(bus, entry.name(), isRouteString);
+        addHops(hops, host);
+    }
+
+    if (m_json)
+    {
+        return writeJSON(m_out, hops);
+    }
+
+    Table table(m_out, m_useColor, m_unaligned);
+    for (const auto& hop : hops)
+    {
+        const auto& tunnels = hop.tunnels;
+        std::string available = "link bandwidth unknown";
+        if (hop.linkBandwidth)
+        {
+            available = hop.available() < 0
+                            ? "oversubscribed by " + gbps(-hop.available())
+                            : gbps(hop.available()) + " available";
+        }
+        table.add({hop.routeString,
+                   hop.device,
+                   "link " + gbps(hop.linkBandwidth),
+                   "DP " + gbps(tunnels.dpBandwidth) + " ("
+                       + std::to_string(tunnels.dpTunnels) + " tunnels)",
+                   "PCIe " + std::to_string(tunnels.pcieTunnels) + ", USB3 "
+                       + std::to_string(tunnels.usb3Tunnels),
+                   available},
+                  hop.available() < 0 && hop.linkBandwidth
+                      ? Table::Color::Yellow
+                      : Table::Color::Normal);
+    }
+    table.print();
+}
+
+tbtadm::RouterTunnels tbtadm::Controller::addHops(std::vector<HopUsage>& hops,
+                                                  Directory& parent)
+{
+    RouterTunnels total;
+    for (const auto& entry : parent)
+    {
+        if (!entry.isDirectory())
+        {
+            continue;
+        }
+        const std::string routeString = entry.name();
+        const auto index              = hops.size();
+        try
+        {
+            Directory dir(parent, routeString, isRouteString);
+            if (!isDevice(dir) && !isXDomain(dir))
+            {
+                continue;
+            }
+
+            HopUsage hop;
+            hop.routeString = routeString;
+            hop.device      = readDevice(dir);
+            // Downstream, where DisplayPort goes
+            hop.linkBandwidth = readLink(dir).rxBandwidth() * 1000;
+            hops.push_back(std::move(hop));
+
+            auto tunnels = readRouterTunnels(debugfsPath / routeString);
+            tunnels += addHops(hops, dir);
+            hops[index].tunnels = tunnels;
+            total += tunnels;
+        }
+        catch (std::system_error& e)
+        {
+            // Disconnected while being read; so are the hops under it
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
+            hops.erase(hops.begin() + index, hops.end());
+        }
+    }
+    return total;
+}
+
+void tbtadm::Controller::approveAll()
+{
+    if (!sysfsDeviceExists())
+    {
+        return;
+    }
+
+    AuthorizationExecutor executor(maxAuthorizationsPerDomain);
+    Policy policy;
+    auto acl = openACL();
+
+    Directory bus(sysfsDevicesPath, isDomainName);
+    for (const auto& entry : bus)
+    {
+        const std::string domainName = entry.name();
+        security_level sl;
+        try
+        {
+            Directory dir(bus, domainName);
+            if (!isDomain(dir))
+            {
+                continue;
+            }
+            sl = readAttribute(dir, attr::security);
+        }
+        catch (std::system_error& e)
+        {
+            if (!isDisconnection(e.code()))
+            {
+                throw;
+            }
+            m_out << "Domain " << domainName << " was removed\n";
+            continue;
+        }
+        m_out << "Found domain " << sysfsDevicesPath / domainName << '\n';
+        auto domainNum = domainName.substr(domain.size());
+        switch (sl)
+        {
+            case SECURITY_LEVEL_USER:
+            case SECURITY_LEVEL_SECURE:
+                break;
+            case SECURITY_LEVEL_NONE:
+            case SECURITY_LEVEL_DPONLY:
+                m_out << "Approval not relevant in SL" << sl << '\n';
+                continue;
+            default:
+                m_out << "Unknown Security level " << sl << '\n';
+                continue;
+        }
+        const auto host = domainNum + hostRouteString;
+        approveAll(executor,
+                   domainName,
+                   sl,
+                   policy,
+                   acl.get(),
+                   sysfsDevicesPath / domainName / host,
+                   {});
+    }
+
+    runTasks(executor, "authorized");
+}
+
+void tbtadm::Controller::runTasks(AuthorizationExecutor& executor,
+                                  const std::string& done)
+{
+    auto results = executor.run([this](const auto& result) {
+        m_out << result.log;
+        if (isDisconnection(result.error))
+        {
+            m_out << result.name << " was disconnected\n";
+        }
+        else if (result.skipped)
+        {
+            m_out << "Skipping " << result.name << ": " << result.message
+                  << '\n';
+        }
+        else if (result.error)
+        {
+            m_err << result.error << ' ' << result.message << '\n';
+        }
+        else if (!result.message.empty())
+        {
+            m_err << "Exception: " << result.message << '\n';
+        }
+        m_out.flush();
+    });
+
+    std::vector<std::string> touched;
+    for (const auto& result : results)
+    {
+        if (!result.skipped)
+        {
+            touched.push_back(result.name);
+        }
+    }
+    updateDeviceCache(touched);
+
+    if (results.empty())
+    {
+        return;
+    }
+
+    size_t failed = 0;
+    Table table(m_out, m_useColor);
+    for (const auto& result : results)
+    {
+        if (result.message.empty())
+        {
+            table.add({result.name, done, milliseconds(result.duration)},
+                      Table::Color::Green);
+            continue;
+        }
+        // Not a failure: there is nothing left to handle
+        if (isDisconnection(result.error))
+        {
+            table.add({result.name, "disconnected"});
+            continue;
+        }
+        ++failed;
+        table.add({result.name,
+                   (result.skipped ? "skipped: " : "failed: ")
+                       + result.message},
+                  Table::Color::Yellow);
+    }
+    m_out << "\nSummary:\n";
+    table.print();
+
+    if (failed)
+    {
+        throw std::runtime_error(std::to_string(failed) + " of "
+                                 + std::to_string(results.size())
+                                 + " devices weren't " + done);
+    }
+}
+
+void tbtadm::Controller::approveAll(AuthorizationExecutor& executor,
+                                    const std::string& domainName,
+                                    security_level sl,
+                                    const Policy& policy,
+                                    const Directory* acl,
+                                    const fs::path& dir,
+                                    const std::vector<size_t>& after)
+try
+{
+    Directory parent(dir, isRouteString);
+    for (const auto& child : parent)
+    {
+        if (!child.isDirectory())
+        {
+            continue;
+        }
+        if (parent.exists(child.name() + "/"s + attr::authorized.name))
+        {
+            const auto path = dir / child.name();
+            m_out << "Found child " << path << '\n';
+            if (!policy.empty())
+            {
+                const Policy::Rule* rule = nullptr;
+                try
+                {
+                    Directory device(parent, child.name());
+                    if (!acl
+                        || !acl->exists(readAttribute(device, attr::uniqueID)))
+                    {
+                        rule = policy.match(readPolicyDevice(
+                            device, child.name(), securityLevelNames[sl]));
+                    }
+                }
+                catch (std::system_error& e)
+                {
+                    if (!isDisconnection(e.code()))
+                    {
+                        throw;
+                    }
+                    m_out << path << " was disconnected\n";
+                    continue;
+                }
+                if (rule && rule->decision == Policy::Decision::Deny)
+                {
+                    m_out << "Denied by policy line " << rule->line << ": "
+                          << rule->text << '\n';
+                    continue;
+                }
+            }
+            auto id = executor.add(
+                domainName,
+                path.filename().string(),
+                [this, path, sl](std::ostream& out) {
+                    authorize(path, sl, out);
+                },
+                after);
+            approveAll(
+                executor, domainName, sl, policy, acl, path, {id});
+        }
+    }
+}
+catch (std::system_error& e)
+{
+    // Disconnected since it was found, together with its descendants; the
+    // children already queued find that out by themselves
+    if (!isDisconnection(e.code()))
+    {
+        throw;
+    }
+    m_out << dir << " was disconnected\n";
+}
+
+void tbtadm::Controller::deauthorize(const std::string& routeString)
+{
+    if (!isConnectedRouteString(routeString.c_str()))
+    {
+        throw std::runtime_error("Invalid route-string " + routeString);
+    }
+    const auto domainName =
+        domain + routeString.substr(0, routeString.find('-'));
+    checkDeauthorization(domainName);
+
+    AuthorizationExecutor executor(maxAuthorizationsPerDomain);
+    const auto dir = sysfsDevicesPath / routeString;
+    executor.add(
+        domainName,
+        routeString,
+        [this, dir](std::ostream& out) { deauthorize(dir, out); },
+        deauthorizeAll(executor, domainName, dir));
+    runTasks(executor, "de-authorized");
+}
+
+void tbtadm::Controller::deauthorizeAll()
+{
+    if (!sysfsDeviceExists())
+    {
+        return;
+    }
+
+    AuthorizationExecutor executor(maxAuthorizationsPerDomain);
+    size_t domains = 0;
+    size_t skipped = 0;
+
+    Directory bus(sysfsDevicesPath, isDomainName);
+    for (const auto& entry : bus)
+    {
+        Directory dir(bus, entry.name());
+        if (!isDomain(dir))
+        {
+            continue;
+        }
+        ++domains;
+        const std::string domainName = entry.name();
+        try
+        {
+            checkDeauthorization(domainName);
+        }
+        catch (std::runtime_error& e)
+        {
+            // The devices of the other domains are de-authorized anyway
+            m_err << e.what() << ", skipping it\n";
+            ++skipped;
+            continue;
+        }
+
+        const auto host = domainName.substr(domain.size()) + hostRouteString;
+        deauthorizeAll(executor, domainName, sysfsDevicesPath / host);
+    }
+
+    runTasks(executor, "de-authorized");
+
+    if (skipped)
+    {
+        throw std::runtime_error(std::to_string(skipped) + " of "
+                                 + std::to_string(domains)
+                                 + " domains don't support de-authorization");
+    }
+}
+
+std::vector<size_t>
+tbtadm::Controller::deauthorizeAll(AuthorizationExecutor& executor,
+                                   const std::string& domainName,
+                                   const fs::path& dir)
+{
+    std::vector<size_t> ids;
+    Directory parent(dir, isRouteString);
+    for (const auto& child : parent)
+    {
+        if (!child.isDirectory()
+            || !parent.exists(child.name() + "/"s + attr::authorized.name))
+        {
+            continue;
+        }
+        // The devices behind the child go first; devices in other branches
+        // don't depend on each other and run in parallel
+        const auto path = dir / child.name();
+        auto after      = deauthorizeAll(executor, domainName, path);
+        ids.push_back(executor.add(
+            domainName,
+            child.name(),
+            [this, path](std::ostream& out) { deauthorize(path, out); },
+            after));
+    }
+    return ids;
+}
+
+void tbtadm::Controller::deauthorize(const fs::path& dir, std::ostream& out)
+{
+    if (!readAttribute(dir, attr::authorized))
+    {
+        out << dir.filename().string() << ": not authorized\n";
+        return;
+    }
+
+    m_retry.run([&dir] {
+        File authorized(dir / attr::authorized.name, File::Mode::Write);
+        authorized << 0;
+    });
+    m_gaugesStale = true;
+}
+
+// TODO: move to tbtadm-helper
+void tbtadm::Controller::approve(const fs::path& dir) try
+{
+    authorize(dir, domainSL(dir), m_out);
+}
+catch (std::system_error& e)
+{
+    if (!isDisconnection(e.code()))
+    {
+        throw;
+    }
+    throw std::runtime_error(dir.filename().string() + " was disconnected");
+}
+
+void tbtadm::Controller::approveAndWait(const fs::path& dir)
+{
+    // The snapshot must be taken before the tunnel may come up
+    PciReadiness readiness(dir);
+
+    const auto start = PciReadiness::Clock::now();
+    if (!authorize(dir, domainSL(dir), m_out))
+    {
+        return;
+    }
+    const auto authorized = PciReadiness::Clock::now();
+    updateDeviceCache({dir.filename().string()});
+
+    PciReadiness::Timeouts timeouts;
+    timeouts.total  = m_readyTimeout;
+    timeouts.tunnel = std::min(timeouts.tunnel, timeouts.total);
+    readiness.wait(m_out, start, authorized, timeouts);
+}
+
+bool tbtadm::Controller::authorize(const fs::path& dir,
+                                   int sl,
+                                   std::ostream& out)
+{
+    out << "Authorizing " << dir << '\n';
+
+    if (readAttribute(dir, attr::authorized))
+    {
+        out << "Already authorized\n";
+        return false;
+    }
+
+    // In SL2 the entry is of no use without the key, so the UUID is read
+    // upfront: the key is saved even if the device is gone by then
+    const bool withKey = sl == SECURITY_LEVEL_SECURE && !m_once;
+    const auto uuid = withKey ? readAttribute(dir, attr::uniqueID) : "";
+    const bool added = !m_once && addToACL(dir, out);
+
+    // ...and an entry added here is removed again if the authorization fails
+    auto rollback = [this, withKey, added, &uuid, &out] {
+        if (withKey && added && m_store.remove(uuid))
+        {
+            out << "Removed from ACL\n";
+            aclChanged(out);
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::ostringstream keyStream;
+    if (withKey)
+    {
+        std::default_random_engine eng(std::random_device{}());
+        std::uniform_int_distribution<> dist(0, 0xF);
+        keyStream << std::hex;
+        std::generate_n(std::ostream_iterator<int>(keyStream), 64, [&] {
+            return dist(eng);
+        });
+
+        try
+        {
+            File key(dir / attr::key.name, File::Mode::Write);
+            key << keyStream.str();
+        }
+        catch (std::exception&)
+        {
+            rollback();
+            throw;
+        }
+    }
+
+    // The connection manager may be busy with other devices, so give it some
+    // time before giving up
+    unsigned writes = 0;
+    unsigned attempts;
+    try
+    {
+        attempts = m_retry.run([&dir, &writes] {
+            ++writes;
+            File authorized(dir / attr::authorized.name, File::Mode::Write);
+            authorized << 1;
+        });
+    }
+    catch (std::system_error& e)
+    {
+        recordAuthorization(writes, start, e.code().value());
+        rollback();
+        throw;
+    }
+    recordAuthorization(attempts, start, 0);
+    m_gaugesStale = true;
+
+    out << "Authorized";
+    if (attempts > 1)
+    {
+        out << " (after " << attempts << " attempts)";
+    }
+    out << '\n';
+    if (withKey)
+    {
+        m_store.write(uuid, attr::key.name, keyStream.str(), S_IRUSR);
+        out << "Key saved in ACL\n";
+    }
+    return true;
+}
+
+bool tbtadm::Controller::addToACL(const fs::path& dir, std::ostream& out)
+{
+    const auto uuid = readAttribute(dir, attr::uniqueID);
+    const auto acl  = openACL();
+    bool added      = false;
+    if (acl && acl->exists(uuid))
+    {
+        // Being used again makes the entry more relevant for the boot ACL
+        m_store.touch(uuid);
+        out << "Already in ACL\n";
+    }
+    else if (m_store.add(
+                 uuid,
+                 {{attr::vendorName.name,
+                   File(dir / attr::vendorName.name, File::Mode::Read).read()},
+                  {attr::deviceName.name,
+                   File(dir / attr::deviceName.name, File::Mode::Read)
+                       .read()}}))
+    {
+        out << "Added to ACL\n";
+        added = true;
+    }
+    else
+    {
+        out << "Already in ACL\n";
+    }
+
+    aclChanged(out);
+    return added;
+}
+
+void tbtadm::Controller::aclChanged(std::ostream& out)
+{
+    if (m_batch)
+    {
+        m_aclChanged = true;
+        return;
+    }
+    syncBootACL(out);
+    m_gaugesStale = true;
+}
+
+std::shared_ptr<tbtadm::Directory> tbtadm::Controller::openACL()
+{
+    if (!m_batch)
+    {
+        return m_store.open();
+    }
+    // The ACL batch builds a single snapshot, so this sees its changes
+    if (!m_acl)
+    {
+        m_acl = m_store.open();
+    }
+    return m_acl;
+}
+
+void tbtadm::Controller::aclBatch(const std::function<void()>& commands)
+{
+    m_batch   = true;
+    auto done = [this] {
+        m_batch = false;
+        m_acl.reset();
+        m_domainSLs.clear();
+        if (m_aclChanged)
+        {
+            m_aclChanged = false;
+            syncBootACL(m_out);
+            m_gaugesStale = true;
+        }
+    };
+    try
+    {
+        m_store.batch(commands);
+    }
+    catch (...)
+    {
+        done();
+        throw;
+    }
+    done();
+}
+
+void tbtadm::Controller::syncBootACL(std::ostream& out)
+{
+    if (!fs::exists(sysfsDevicesPath))
+    {
+        return;
+    }
+
+    std::unique_ptr<std::vector<std::string>> uuids;
+    Directory bus(sysfsDevicesPath, isDomainName);
+    for (const auto& entry : bus)
+    {
+        const std::string name = entry.name();
+        try
+        {
+            BootACL bootACL(sysfsDevicesPath / name);
+            if (!bootACL.supported())
+            {
+                continue;
+            }
+            if (!uuids)
+            {
+                uuids = std::make_unique<std::vector<std::string>>(
+                    aclByLastUse(acltree));
+            }
+            if (bootACL.assign(*uuids))
+            {
+                out << "Boot ACL of " << name << " updated ("
+                    << std::min(uuids->size(), bootACL.capacity()) << '/'
+                    << bootACL.capacity() << " slots used)\n";
+            }
+        }
+        catch (std::system_error& e)
+        {
+            m_err << "Can't update the boot ACL of " << name << ": "
+                  << e.what() << '\n';
+        }
+    }
+}
+
+void tbtadm::Controller::acl()
+{
+    auto aclDir = openACL();
+    if (!aclDir || aclDir->begin() == aclDir->end())
+    {
+        m_out << "ACL is empty\n";
+        return;
+    }
+
+    // Get UUID of all connected devices
+    std::map<std::string, ConnectedDevice> uuids;
+    if (fs::exists(sysfsDevicesPath))
+    {
+        Directory bus(sysfsDevicesPath, isConnectedRouteString);
+        for (const auto& entry : bus)
+        {
+            try
+            {
+                Directory dir(bus, entry.name());
+                if (!isDevice(dir))
+                {
+                    continue;
+                }
+                bool authorized = readAttribute(dir, attr::authorized);
+                std::string uuid(readAttribute(dir, attr::uniqueID));
+                uuids.emplace(std::move(uuid),
+                              ConnectedDevice{entry.name(), authorized});
+            }
+            catch (std::system_error& e)
+            {
+                // Disconnected meanwhile, so not connected
+                if (!isDisconnection(e.code()))
+                {
+                    throw;
+                }
+            }
+        }
+        m_sl = findSL();
+    }
+
+    // Boot ACLs of the domains that support them
+    std::vector<BootACL> bootACLs;
+    if (fs::exists(sysfsDevicesPath))
+    {
+        Directory bus(sysfsDevicesPath, isDomainName);
+        for (const auto& entry : bus)
+        {
+            BootACL bootACL(sysfsDevicesPath / entry.name());
+            if (bootACL.supported())
+            {
+                bootACLs.push_back(std::move(bootACL));
+            }
+        }
+    }
+    auto preapproved = [&bootACLs](const std::string& uuid) {
+        return std::any_of(
+            bootACLs.begin(), bootACLs.end(), [&uuid](const auto& bootACL) {
+                return bootACL.contains(uuid);
+            });
+    };
+
+    auto addEntry = [&](Table& table, ACLRow& row) {
+        const auto& uuid = row.uuid();
+        bool connected   = row.connected();
+        auto color       = Table::Color::Normal;
+
+        if (connected)
+            color = row.authorized() ? Table::Color::Green
+                                     : Table::Color::Yellow;
+
+        std::vector<std::string> columns{
+            uuid,
+            row.vendor(),
+            readDevice(*aclDir, uuid + '/' + attr::deviceName.name),
+            connected ? "connected" : "not connected"};
+        if (!bootACLs.empty())
+        {
+            columns.emplace_back(preapproved(uuid) ? "boot pre-approved" : "-");
+        }
+        table.add(std::move(columns), color);
+    };
+
+    m_filter.order({Filter::Field::InACL,
+                    Filter::Field::Connected,
+                    Filter::Field::Authorized,
+                    Filter::Field::Domain,
+                    Filter::Field::Vendor});
+
+    // Print ACL
+    Table table(m_out, m_useColor, m_unaligned);
+    std::vector<ACLRow> noKey;
+    for (const auto& entry : *aclDir)
+    {
+        if (!entry.isDirectory())
+        {
+            continue;
+        }
+        std::string uuid = entry.name();
+        auto connected   = uuids.find(uuid);
+        ACLRow row(*aclDir,
+                   std::move(uuid),
+                   connected != uuids.end() ? &connected->second : nullptr);
+        if (!m_filter.matches(row))
+        {
+            continue;
+        }
+
+        if (m_sl != SECURITY_LEVEL_SECURE
+            || aclDir->exists(row.uuid() + '/' + attr::key.name))
+        {
+            addEntry(table, row);
+        }
+        else
+        {
+            noKey.push_back(std::move(row));
+        }
+    }
+    table.print();
+
+    if (!noKey.empty())
+    {
+        m_out << "\nACL entries with no key (not for current security mode):\n";
+        Table noKeyTable(m_out, m_useColor, m_unaligned);
+        for (auto& row : noKey)
+        {
+            addEntry(noKeyTable, row);
+        }
+        noKeyTable.print();
+    }
+}
+
+void tbtadm::Controller::add(const fs::path& dir)
+{
+    switch (m_sl)
+    {
+        case SECURITY_LEVEL_SECURE:
+            m_out << "Adding to ACL on SL2 must be done together with device "
+                    "approval\n";
             return;
         case SECURITY_LEVEL_NONE:
         case SECURITY_LEVEL_DPONLY:
@@ -798,38 +2437,313 @@ void tbtadm::Controller::add(const fs::path& dir)
             return;
     }
 
-    addToACL(dir);
+    addToACL(dir, m_out);
 }
 
 // TODO: move to tbtadm-helper
 void tbtadm::Controller::remove(std::string uuid)
 {
     // Identify route-string argument and replace it with the UUID
-    if (isRouteString(uuid))
+    if (isRouteString(uuid.c_str()))
     {
-        uuid = readAndTrim(sysfsDevicesPath / uuid / uniqueIDFilename);
+        uuid = readAttribute(sysfsDevicesPath / uuid, attr::uniqueID);
     }
 
-    auto acl = acltree / uuid;
-    if (!fs::exists(acl))
+    const auto acl = openACL();
+    if (!acl || !acl->exists(uuid) || !m_store.remove(uuid))
     {
         m_out << "ACL entry doesn't exist\n";
+        return;
     }
-    fs::remove_all(acl);
+    aclChanged(m_out);
 }
 
 // TODO: move to tbtadm-helper
 void tbtadm::Controller::removeAll()
 {
-    if (!fs::exists(acltree) || fs::is_empty(acltree))
+    const auto acl = openACL();
+    if (!acl || acl->begin() == acl->end())
     {
         m_out << "ACL is empty\n";
         return;
     }
-    auto count =
-        std::count_if(fs::directory_iterator(acltree),
-                      {},
-                      [](const auto& dir) { return fs::is_directory(dir); });
-    fs::remove_all(acltree);
+    auto count = m_store.clear();
     m_out << count << " entries removed\n";
+    aclChanged(m_out);
+}
+
+void tbtadm::Controller::batch(const std::string& source)
+{
+    std::ifstream file;
+    if (source != batchStdin)
+    {
+        file.open(source);
+        if (!file)
+        {
+            throw std::system_error(errno, std::system_category(), source);
+        }
+    }
+    std::istream& in = source == batchStdin ? std::cin : file;
+
+    // None of the commands changes the security level, so the bus is scanned
+    // for it once (and the domains are read once); the ACL is opened once and
+    // its changes make a single ACL update, and the boot ACL and the device
+    // cache are updated once at the end, if needed
+    m_sl = findSL();
+
+    size_t lineNum = 0;
+    size_t count   = 0;
+    size_t failed  = 0;
+    std::vector<std::string> approved;
+    aclBatch([&] {
+        std::string line;
+        while (std::getline(in, line))
+        {
+            ++lineNum;
+            std::istringstream stream(line);
+            std::vector<std::string> args(
+                (std::istream_iterator<std::string>(stream)),
+                std::istream_iterator<std::string>());
+            if (args.empty() || args[0][0] == '#')
+            {
+                continue;
+            }
+
+            ++count;
+            std::string status = "ok";
+            try
+            {
+                if (runBatchCommand(args))
+                {
+                    approved.push_back(args.back());
+                }
+            }
+            catch (std::system_error& e)
+            {
+                status = "failed: " + e.code().message();
+            }
+            catch (std::exception& e)
+            {
+                status = "failed: "s + e.what();
+            }
+            if (status != "ok")
+            {
+                ++failed;
+            }
+            m_out << "Line " << lineNum << ": " << status << '\n';
+            m_out.flush();
+        }
+    });
+
+    if (!approved.empty())
+    {
+        updateDeviceCache(approved);
+    }
+
+    if (failed)
+    {
+        throw std::runtime_error(std::to_string(failed) + " of "
+                                 + std::to_string(count)
+                                 + " batch commands failed");
+    }
+}
+
+bool tbtadm::Controller::runBatchCommand(const std::vector<std::string>& args)
+{
+    const auto& command = args[0];
+    if (command == opt_approve && args.size() >= 2 && args.size() <= 3)
+    {
+        m_once = args.size() == 3;
+        if (m_once && args[1] != opt_once_flag)
+        {
+            throw std::runtime_error("unknown option " + args[1]);
+        }
+        // None of the commands changes the security level, see batch()
+        const auto dir       = sysfsDevicesPath / args.back();
+        const auto domainNum = args.back().substr(0, args.back().find('-'));
+        auto sl              = m_domainSLs.find(domainNum);
+        if (sl == m_domainSLs.end())
+        {
+            sl = m_domainSLs.emplace(domainNum, domainSL(dir)).first;
+        }
+        authorize(dir, sl->second, m_out);
+        return true;
+    }
+    if (command == opt_add && args.size() == 2)
+    {
+        add(sysfsDevicesPath / args[1]);
+        return false;
+    }
+    if (command == opt_remove && args.size() == 2)
+    {
+        remove(args[1]);
+        return false;
+    }
+    if (command == opt_remove_all && args.size() == 1)
+    {
+        removeAll();
+        return false;
+    }
+    throw std::runtime_error("unsupported batch command");
+}
+
+void tbtadm::Controller::nvmUpgrade(const fs::path& dir, const fs::path& path)
+{
+    using namespace std::chrono;
+
+    File image(path, File::Mode::Read);
+    const auto info = validateNvmImage(image);
+    m_out << "Image " << path << ": " << info.size << " bytes, device ID 0x"
+          << std::hex << info.deviceID << std::dec << '\n';
+
+    fs::path nvmem;
+    Directory device(dir, [](const char* name) {
+        return std::strncmp(name,
+                            nvmNonActivePrefix.c_str(),
+                            nvmNonActivePrefix.size())
+               == 0;
+    });
+    for (const auto& entry : device)
+    {
+        nvmem = dir / entry.name() / nvmemFilename;
+        break;
+    }
+    if (nvmem.empty())
+    {
+        throw std::runtime_error("Device doesn't support NVM upgrade");
+    }
+
+    std::string oldVersion;
+    try
+    {
+        oldVersion = readAttribute(dir, attr::nvmVersion);
+        m_out << "Current NVM version: " << oldVersion << '\n';
+    }
+    catch (std::exception&)
+    {
+        // Not available e.g. in safe mode
+    }
+
+    // As the kernel does; in safe mode the device ID can't be trusted
+    if (!oldVersion.empty())
+    {
+        const auto deviceID = readAttribute(dir, attr::deviceID).value;
+        if (deviceID != info.deviceID)
+        {
+            std::ostringstream message;
+            message << "NVM image is for device ID 0x" << std::hex
+                    << info.deviceID << ", not for 0x" << deviceID;
+            throw std::runtime_error(message.str());
+        }
+    }
+
+    // Stream the image in big chunks; the kernel buffers it until
+    // authentication is requested
+    const bool interactive = ::isatty(STDOUT_FILENO);
+    const auto start       = steady_clock::now();
+    size_t written         = 0;
+    size_t reported        = 0;
+    {
+        File target(nvmem, File::Mode::Write);
+        while (written < info.size)
+        {
+            auto count = target.copyFrom(
+                image, std::min(nvmChunkSize, info.size - written));
+            if (!count)
+            {
+                throw std::runtime_error("NVM image got truncated");
+            }
+            written += count;
+
+            const auto percent = written * 100 / info.size;
+            if (interactive)
+            {
+                m_out << "\rWriting NVM: " << percent << '%' << std::flush;
+            }
+            else if (percent / 10 > reported / 10)
+            {
+                m_out << "Writing NVM: " << percent << "%\n";
+                reported = percent;
+            }
+        }
+    }
+    const auto elapsed =
+        duration_cast<duration<double>>(steady_clock::now() - start).count();
+    if (interactive)
+    {
+        m_out << '\n';
+    }
+    std::ostringstream seconds;
+    seconds << std::fixed << std::setprecision(2) << elapsed;
+    m_out << "Wrote " << written << " bytes in " << seconds.str() << " s";
+    if (elapsed > 0)
+    {
+        m_out << " (" << static_cast<size_t>(written / 1024 / elapsed)
+              << " KiB/s)";
+    }
+    m_out << '\n';
+
+    m_out << "Authenticating the new NVM\n";
+    {
+        File authenticate(dir / attr::nvmAuthenticate.name, File::Mode::Write);
+        authenticate << 1;
+    }
+
+    // The device disconnects to run the new NVM; wait for it to come back
+    const auto deadline = steady_clock::now() + nvmAuthTimeout;
+    bool restarted      = false;
+    auto restarting     = [this, &restarted] {
+        if (!restarted)
+        {
+            m_out << "Waiting for the device to restart\n";
+            restarted = true;
+        }
+    };
+    while (steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(nvmAuthPollInterval);
+
+        std::string status;
+        try
+        {
+            status = readAttribute(dir, attr::nvmAuthenticate);
+        }
+        catch (std::exception&)
+        {
+            restarting();
+            continue;
+        }
+
+        // A failure is reported without a restart
+        if (status != "0")
+        {
+            throw std::runtime_error("NVM authentication failed with status "
+                                     + status);
+        }
+
+        std::string version;
+        try
+        {
+            version = readAttribute(dir, attr::nvmVersion);
+        }
+        catch (std::exception&)
+        {
+            // Unreadable while the device restarts, and in safe mode
+            if (!oldVersion.empty())
+            {
+                restarting();
+            }
+            continue;
+        }
+        if (!restarted && version == oldVersion)
+        {
+            // Authentication didn't start the restart yet
+            continue;
+        }
+
+        m_out << "NVM authenticated, version: " << version << '\n';
+        return;
+    }
+
+    throw std::runtime_error("Timed out waiting for NVM authentication");
 }
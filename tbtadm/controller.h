@@ -31,15 +31,34 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iosfwd>
+#include <limits>
 #include <map>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 
+#include "aclstore.h"
+#include "authorizer.h"
+#include "bandwidth.h"
+#include "filter.h"
+#include "links.h"
+#include "sysfs.h"
+
 namespace fs = boost::filesystem;
 
 namespace tbtadm
 {
+class BootACL;
+struct CachedDevice;
+class DeviceCache;
+class Directory;
+class Policy;
+class Table;
+class TopologySnapshot;
 
 class Controller
 {
@@ -47,21 +66,84 @@ public:
     static constexpr int UnkownSL = -1;
 
     Controller(int argc, char* argv[], std::ostream& out, std::ostream& err);
+    /// Runs the command and then exports the metrics gauges, if it changed them
     void run();
 
 private:
-    /// Prints all connected devices
+    /// Runs the command given by the arguments
+    void dispatch();
+
+    /**
+     * @brief Prints all connected devices
+     *
+     * With a filter, the device cache isn't updated: the devices filtered out
+     * aren't read.
+     */
     void devices();
 
+    /// Checks the runtime PM status of the given domain
+    bool isSuspended(const std::string& domainNum);
+
+    /// Saves the current state of the given devices in the device cache
+    void updateDeviceCache(const std::vector<std::string>& routeStrings);
+
+    /// Replaces the device cache with the devices of a full listing
+    void replaceDeviceCache(DeviceCache& cache,
+                            std::map<std::string, CachedDevice> devices);
+
     /// Prints all connected peers (hosts)
     void peers();
 
-    /// Prints all connected devices in a tree
+    /**
+     * @brief Prints all connected devices in a tree
+     *
+     * Only the domain, subtree and depth asked for are walked; devices outside
+     * of them aren't read at all.
+     */
     void topology();
 
-    /// Add to tree all devices under a given path
+    /// Saves a snapshot of the connected devices to the given file
+    void saveTopology(const fs::path& path);
+
+    /// Prints the devices added, removed, moved or changed since the given
+    /// snapshot was saved
+    void diffTopology(const fs::path& path);
+
+    /// Takes a snapshot of the connected devices of all domains
+    TopologySnapshot takeSnapshot();
+
+    /// Adds to the snapshot all devices under the given device
+    void addToSnapshot(TopologySnapshot& snapshot,
+                       const std::string& domainNum,
+                       Directory& parent,
+                       const Directory* acl);
+
+    /// Add to tree all devices under a given path, up to the given depth
     struct ControllerInTree;
-    void createTree(ControllerInTree& controller, const fs::path& path);
+    void createTree(ControllerInTree& controller,
+                    Directory& parent,
+                    const Directory* acl,
+                    const BootACL& bootACL,
+                    unsigned parentGeneration,
+                    const PathBandwidth& parentPath,
+                    unsigned depth);
+
+    /// Adds to tree the given device and the devices under it, up to the given
+    /// depth (1 for the device only)
+    void addToTree(ControllerInTree& controller,
+                   Directory& parent,
+                   const std::string& routeString,
+                   const Directory* acl,
+                   const BootACL& bootACL,
+                   unsigned parentGeneration,
+                   const PathBandwidth& parentPath,
+                   unsigned depth);
+
+    /// Builds the tree of the given domain, from its host down to the devices
+    /// in scope
+    ControllerInTree domainTree(const Directory& bus,
+                                const std::string& hostName,
+                                const Directory* acl);
 
     void printTree(std::string& indentation,
                    const std::map<std::string, ControllerInTree>& map);
@@ -70,19 +152,121 @@ private:
                       std::string& indentation,
                       const std::vector<std::string>& details);
 
+    /// Prints the negotiated link of every device and the bottlenecks found
+    void links();
+
+    /// Adds to the table the links of all devices under the given device
+    void addLinks(Table& table,
+                  Directory& parent,
+                  unsigned parentGeneration,
+                  const PathBandwidth& parentPath);
+
+    /// Adds to the table the link of the given device, then the ones under it
+    void addLink(Table& table,
+                 Directory& dir,
+                 const std::string& routeString,
+                 unsigned parentGeneration,
+                 const PathBandwidth& parentPath);
+
+    /// Prints the bandwidth used by tunnels on every link
+    void bandwidth();
+
+    /**
+     * @brief Adds the usage of the links of all devices under the given device
+     *
+     * @return the tunnels going through the link of the given device
+     */
+    RouterTunnels addHops(std::vector<HopUsage>& hops, Directory& parent);
+
     /// Goes over all domains and approves all the connected devices
     void approveAll();
 
-    /// Approves the given device and its descendants
-    void approveAll(const fs::path& dir);
+    /// Queues approval of the descendants of the given device, skipping the
+    /// ones not in the ACL that the policy denies (with their descendants)
+    void approveAll(AuthorizationExecutor& executor,
+                    const std::string& domainName,
+                    security_level sl,
+                    const Policy& policy,
+                    const Directory* acl,
+                    const fs::path& dir,
+                    const std::vector<size_t>& after);
 
-    /// Approves the given device
+    /**
+     * @brief Runs the queued tasks, then prints a summary with the time each
+     * device took
+     *
+     * @param done  the result of a successful task, e.g. "authorized"
+     */
+    void runTasks(AuthorizationExecutor& executor, const std::string& done);
+
+    /// De-authorizes the given device and the devices behind it, leaves first
+    void deauthorize(const std::string& routeString);
+
+    /// De-authorizes all the connected devices of all domains, leaves first
+    void deauthorizeAll();
+
+    /**
+     * @brief Queues de-authorization of the descendants of the given device
+     *
+     * @return the tasks of its direct children, for the device to wait for
+     */
+    std::vector<size_t> deauthorizeAll(AuthorizationExecutor& executor,
+                                       const std::string& domainName,
+                                       const fs::path& dir);
+
+    /// De-authorizes the given device, if it's authorized
+    void deauthorize(const fs::path& dir, std::ostream& out);
+
+    /// Prints the policy rule that decides about the given device
+    void policyTest(const std::string& routeString);
+
+    /// Approves the given device; a device disconnected meanwhile is reported
+    /// as such
     void approve(const fs::path& dir);
 
-    /// Adds to ACL the given device
-    void addToACL(const fs::path& dir);
+    /**
+     * @brief Approves the given device, throwing on failure
+     *
+     * In SL2, an ACL entry added for the device is removed again on failure,
+     * as it has no key.
+     *
+     * @return false if the device was already authorized
+     */
+    bool authorize(const fs::path& dir, int sl, std::ostream& out);
+
+    /// Approves the given device and waits for its PCI devices to be usable
+    void approveAndWait(const fs::path& dir);
+
+    /// Adds to ACL the given device; returns false if it was there already
+    bool addToACL(const fs::path& dir, std::ostream& out);
 
-    /// Prints ACL
+    /// Mirrors the most recently used ACL entries into the boot ACL of every
+    /// domain that has one
+    void syncBootACL(std::ostream& out);
+
+    /// Syncs the boot ACL after an ACL change, or only notes the change in
+    /// batch mode
+    void aclChanged(std::ostream& out);
+
+    /**
+     * @brief Opens the ACL
+     *
+     * In batch mode it's opened once, and shared by the commands (and their
+     * threads).
+     *
+     * @return null if there is no ACL yet
+     */
+    std::shared_ptr<Directory> openACL();
+
+    /**
+     * @brief Runs the given commands in batch mode
+     *
+     * Their ACL changes are published as a single ACL update, and the boot
+     * ACL is synced once, at the end.
+     */
+    void aclBatch(const std::function<void()>& commands);
+
+    /// Prints ACL, the entries matching the filter only
     void acl();
 
     /// Add the given device to ACL
@@ -94,12 +278,53 @@ private:
     /// Clears the ACL
     void removeAll();
 
+    /**
+     * @brief Runs the commands in the given file (or stdin for "-"), one per
+     * line, in a single process
+     *
+     * Each line gets its status; fails if any command failed.
+     */
+    void batch(const std::string& source);
+
+    /**
+     * @brief Runs a single batch command (approve, add, remove, remove-all)
+     *
+     * @return whether devices may have been authorized
+     */
+    bool runBatchCommand(const std::vector<std::string>& args);
+
+    /**
+     * @brief Records the sysfs state, the ACL (without keys) and, for the
+     * given time, the uevents into the given file
+     */
+    void capture(const fs::path& path, std::chrono::seconds events);
+
+    /// Flashes the given NVM image to the device and authenticates it
+    void nvmUpgrade(const fs::path& dir, const fs::path& path);
+
     int m_argc;
     char** m_argv;
     std::ostream& m_out;
     std::ostream& m_err;
-    int m_sl    = UnkownSL; // FIXME: Consider moving to a local var
-    bool m_once = false;
+    int m_sl          = UnkownSL; // FIXME: Consider moving to a local var
+    bool m_once       = false;
+    bool m_useColor   = false;
+    bool m_unaligned  = false;
+    bool m_noWake     = false;
+    bool m_json       = false;
+    bool m_waitReady  = false;
+    bool m_batch = false;
+    std::atomic<bool> m_aclChanged{false};
+    std::atomic<bool> m_gaugesStale{false}; ///< exported once, by run()
+    std::chrono::seconds m_readyTimeout{60};
+    std::string m_scopeDomain; ///< topology: only this domain, if set
+    std::string m_scopeRoot;   ///< topology: only the subtree of this device
+    unsigned m_scopeDepth = std::numeric_limits<unsigned>::max();
+    Filter m_filter; ///< devices, acl: only the rows matching it
+    RetryPolicy m_retry;
+    AclStore m_store;
+    std::shared_ptr<Directory> m_acl; ///< batch mode: the ACL, opened once
+    std::map<std::string, security_level> m_domainSLs; ///< batch mode
 };
 
 } // namespace tbtadm
@@ -0,0 +1,142 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "filter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <strings.h>
+
+namespace
+{
+const std::string vendorPrefix = "vendor=";
+const std::string domainPrefix = "domain=";
+const std::string domainName   = "domain";
+
+bool startsWith(const std::string& s, const std::string& prefix)
+{
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+} // namespace
+
+void tbtadm::Filter::add(const std::string& term)
+{
+    if (term == "authorized" || term == "unauthorized")
+    {
+        m_terms.push_back({Field::Authorized, term == "authorized", {}});
+    }
+    else if (term == "in-acl" || term == "not-in-acl")
+    {
+        m_terms.push_back({Field::InACL, term == "in-acl", {}});
+    }
+    else if (term == "connected" || term == "not-connected")
+    {
+        m_terms.push_back({Field::Connected, term == "connected", {}});
+    }
+    else if (startsWith(term, vendorPrefix))
+    {
+        m_terms.push_back(
+            {Field::Vendor, true, term.substr(vendorPrefix.size())});
+    }
+    else if (startsWith(term, domainPrefix))
+    {
+        // Both "domain=0" and "domain=domain0" are fine
+        auto num = term.substr(domainPrefix.size());
+        if (startsWith(num, domainName))
+        {
+            num.erase(0, domainName.size());
+        }
+        m_terms.push_back({Field::Domain, true, std::move(num)});
+    }
+    else
+    {
+        throw std::runtime_error("Unknown filter: " + term);
+    }
+}
+
+void tbtadm::Filter::order(std::initializer_list<Field> cheapestFirst)
+{
+    auto rank = [cheapestFirst](Field field) {
+        return std::find(cheapestFirst.begin(), cheapestFirst.end(), field)
+               - cheapestFirst.begin();
+    };
+    std::stable_sort(m_terms.begin(),
+                     m_terms.end(),
+                     [&rank](const Term& a, const Term& b) {
+                         return rank(a.field) < rank(b.field);
+                     });
+}
+
+bool tbtadm::Filter::allows(const std::string& domainNum) const
+{
+    return std::all_of(
+        m_terms.begin(), m_terms.end(), [&domainNum](const Term& term) {
+            return term.field != Field::Domain || term.value == domainNum;
+        });
+}
+
+bool tbtadm::Filter::matches(Row& row) const
+{
+    for (const auto& term : m_terms)
+    {
+        if (!row.known(term.field))
+        {
+            return false;
+        }
+
+        bool match = false;
+        switch (term.field)
+        {
+            case Field::Domain:
+                match = row.domain() == term.value;
+                break;
+            case Field::Connected:
+                match = row.connected() == term.expected;
+                break;
+            case Field::Authorized:
+                match = row.authorized() == term.expected;
+                break;
+            case Field::InACL:
+                match = row.inACL() == term.expected;
+                break;
+            case Field::Vendor:
+                match = ::strcasecmp(row.vendor().c_str(), term.value.c_str())
+                        == 0;
+                break;
+        }
+        if (!match)
+        {
+            return false;
+        }
+    }
+    return true;
+}
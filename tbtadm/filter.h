@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace tbtadm
+{
+/**
+ * @brief Selects the rows of `devices` and `acl` by the terms given with
+ * --filter
+ *
+ * A row matches if it matches all the terms. The row provides its fields on
+ * demand, so the terms are checked from the cheapest field to the most
+ * expensive one and a row that fails a cheap term never reads the rest.
+ */
+class Filter
+{
+public:
+    enum class Field
+    {
+        Domain,
+        Connected,
+        Authorized,
+        InACL,
+        Vendor
+    };
+
+    /// A row to filter; each field is read when first asked for
+    class Row
+    {
+    public:
+        virtual ~Row() = default;
+
+        /// Whether the given field is known, e.g. not for a device in a
+        /// suspended domain with no cached state; unknown fields match nothing
+        virtual bool known(Field) { return true; }
+
+        /// The domain number, e.g. "0"
+        virtual std::string domain() = 0;
+        virtual bool connected()     = 0;
+        virtual bool authorized()    = 0;
+        virtual bool inACL()         = 0;
+        virtual std::string vendor() = 0;
+    };
+
+    /**
+     * @brief Adds a term: authorized, unauthorized, in-acl, not-in-acl,
+     * connected, not-connected, vendor=<vendor name> or domain=<number>
+     *
+     * Throws std::runtime_error for anything else.
+     */
+    void add(const std::string& term);
+
+    /// Orders the terms so those on cheaper fields are checked first
+    void order(std::initializer_list<Field> cheapestFirst);
+
+    bool empty() const { return m_terms.empty(); }
+
+    /// Whether rows of the given domain may match at all; lets the caller
+    /// skip them before reading anything
+    bool allows(const std::string& domainNum) const;
+
+    bool matches(Row& row) const;
+
+private:
+    struct Term
+    {
+        Field field;
+        bool expected;
+        std::string value; ///< of vendor and domain
+    };
+
+    std::vector<Term> m_terms;
+};
+} // namespace tbtadm
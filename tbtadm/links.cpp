@@ -0,0 +1,166 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "links.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "directory.h"
+#include "file.h"
+
+using namespace std::string_literals;
+
+namespace
+{
+const std::string generationFilename = "generation";
+const std::string rxSpeedFilename    = "rx_speed";
+const std::string rxLanesFilename    = "rx_lanes";
+const std::string txSpeedFilename    = "tx_speed";
+const std::string txLanesFilename    = "tx_lanes";
+
+/// What a hop between two ends of the given generation should negotiate
+struct Capability
+{
+    unsigned speed; // Gb/s per lane
+    unsigned lanes;
+};
+
+/// Index is the generation; Thunderbolt 1 doesn't bond its lanes,
+/// Thunderbolt 3 doubles the lane speed and USB4 keeps at least that
+const Capability capabilities[] = {{0, 0}, {10, 1}, {10, 2}, {20, 2}, {20, 2}};
+
+/// Reads a numeric attribute, e.g. "20.0 Gb/s"; 0 if missing or malformed
+unsigned readNumber(const tbtadm::Directory& dir, const std::string& name)
+{
+    if (!dir.exists(name))
+    {
+        return 0;
+    }
+    try
+    {
+        tbtadm::File file(dir, name, tbtadm::File::Mode::Read);
+        return std::stoul(file.read());
+    }
+    catch (std::exception&)
+    {
+        return 0;
+    }
+}
+
+/// Bandwidth of a path including a hop of the given bandwidth
+unsigned limit(unsigned path, unsigned hop)
+{
+    return path ? std::min(path, hop) : hop;
+}
+
+std::string gbps(unsigned bandwidth)
+{
+    return std::to_string(bandwidth) + " Gb/s";
+}
+} // namespace
+
+tbtadm::Link tbtadm::readLink(const Directory& device)
+{
+    Link link;
+    link.generation = readNumber(device, generationFilename);
+    link.rxSpeed    = readNumber(device, rxSpeedFilename);
+    link.rxLanes    = readNumber(device, rxLanesFilename);
+    link.txSpeed    = readNumber(device, txSpeedFilename);
+    link.txLanes    = readNumber(device, txLanesFilename);
+    return link;
+}
+
+tbtadm::HopAnalysis tbtadm::analyzeHop(const std::string& routeString,
+                                       const Link& link,
+                                       unsigned parentGeneration,
+                                       const PathBandwidth& parentPath)
+{
+    HopAnalysis analysis;
+    auto& path = analysis.path;
+
+    path.rx        = limit(parentPath.rx, link.rxBandwidth());
+    path.tx        = limit(parentPath.tx, link.txBandwidth());
+    path.limitedBy = parentPath.limitedBy;
+    if (path.rx < parentPath.rx || path.tx < parentPath.tx
+        || path.limitedBy.empty())
+    {
+        path.limitedBy = routeString;
+    }
+
+    const auto generation = std::min(link.generation, parentGeneration);
+    if (!generation)
+    {
+        return analysis;
+    }
+    const auto& expected = capabilities[std::min<size_t>(
+        generation, std::extent<decltype(capabilities)>::value - 1)];
+
+    const auto speed = std::min(link.rxSpeed, link.txSpeed);
+    if (speed < expected.speed)
+    {
+        analysis.bottlenecks.push_back(
+            "negotiated " + gbps(speed) + " per lane, both ends support "
+            + gbps(expected.speed));
+    }
+    const auto lanes = std::min(link.rxLanes, link.txLanes);
+    if (lanes < expected.lanes)
+    {
+        analysis.bottlenecks.push_back(
+            (lanes == 1 ? "single lane"s : std::to_string(lanes) + " lanes")
+            + ", both ends support " + std::to_string(expected.lanes));
+    }
+
+    return analysis;
+}
+
+std::string tbtadm::describe(const Link& link)
+{
+    auto desc = "RX " + gbps(link.rxSpeed) + " x "
+                + std::to_string(link.rxLanes) + ", TX " + gbps(link.txSpeed)
+                + " x " + std::to_string(link.txLanes);
+    if (link.generation)
+    {
+        desc += " (Gen " + std::to_string(link.generation) + ')';
+    }
+    return desc;
+}
+
+std::string tbtadm::describe(const PathBandwidth& path)
+{
+    auto desc = "RX " + gbps(path.rx) + ", TX " + gbps(path.tx);
+    if (!path.limitedBy.empty())
+    {
+        desc += " (limited by " + path.limitedBy + ')';
+    }
+    return desc;
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace tbtadm
+{
+class Directory;
+
+/// The link of a device to its parent, as negotiated by the hardware
+struct Link
+{
+    unsigned generation = 0; // Of the device, 0 if unknown
+    unsigned rxSpeed    = 0; // Gb/s per lane, 0 if unknown
+    unsigned rxLanes    = 0;
+    unsigned txSpeed    = 0;
+    unsigned txLanes    = 0;
+
+    /// Older kernels don't expose the link attributes
+    bool known() const { return rxSpeed && txSpeed; }
+
+    unsigned rxBandwidth() const { return rxSpeed * rxLanes; }
+    unsigned txBandwidth() const { return txSpeed * txLanes; }
+};
+
+/// Reads the generation and the link attributes of the given device
+Link readLink(const Directory& device);
+
+/// Bandwidth available along the path from the host to a device
+struct PathBandwidth
+{
+    unsigned rx = 0; // Gb/s, 0 if not limited (at the host)
+    unsigned tx = 0;
+    std::string limitedBy; // Route-string of the hop limiting the path
+};
+
+struct HopAnalysis
+{
+    PathBandwidth path; // Including the analyzed hop
+
+    /// Why the hop negotiated less than both its ends support, if it did
+    std::vector<std::string> bottlenecks;
+};
+
+/**
+ * @brief Analyzes the link of a device to its parent
+ *
+ * The expected speed and width are derived from the lower generation of both
+ * ends of the hop, so e.g. a Thunderbolt 3 device behind a Thunderbolt 3 dock
+ * running in single lane (bad cable or connector) or at 10 Gb/s (older cable)
+ * is reported as a bottleneck, while a Thunderbolt 2 device isn't.
+ *
+ * @param routeString       route-string of the device
+ * @param link              the link of the device to its parent
+ * @param parentGeneration  generation of the parent, 0 if unknown
+ * @param parentPath        bandwidth along the path to the parent
+ */
+HopAnalysis analyzeHop(const std::string& routeString,
+                       const Link& link,
+                       unsigned parentGeneration,
+                       const PathBandwidth& parentPath);
+
+/// Formats the link, e.g. "RX 20 Gb/s x 2, TX 20 Gb/s x 2 (Gen 3)"
+std::string describe(const Link& link);
+
+/// Formats the path bandwidth, e.g. "RX 40 Gb/s, TX 40 Gb/s (limited by 0-1)"
+std::string describe(const PathBandwidth& path);
+} // namespace tbtadm
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "nvm.h"
+
+#include <stdexcept>
+
+#include "file.h"
+
+namespace
+{
+const size_t minImageSize = 32 * 1024;
+const size_t maxImageSize = 512 * 1024;
+
+const size_t farbPointerSize  = 3;
+const size_t deviceIDOffset   = 0x05;
+const size_t sectionAlignment = 4096;
+
+/// Reads a little-endian number of the given size at the given offset
+uint32_t readLE(tbtadm::File& image, off_t offset, size_t size)
+{
+    unsigned char buffer[sizeof(uint32_t)] = {};
+    if (image.read(reinterpret_cast<char*>(buffer), size, offset) != size)
+    {
+        throw std::runtime_error("NVM image is truncated");
+    }
+
+    uint32_t value = 0;
+    for (size_t i = size; i > 0; --i)
+    {
+        value = value << 8 | buffer[i - 1];
+    }
+    return value;
+}
+} // namespace
+
+tbtadm::NvmImage tbtadm::validateNvmImage(File& image)
+{
+    NvmImage info;
+    info.size = image.size();
+    if (info.size < minImageSize || info.size > maxImageSize)
+    {
+        throw std::runtime_error("NVM image size is out of range");
+    }
+
+    // The FARB pointer must point inside the image, at least far enough to
+    // include the parts of the digital section that are checked here
+    info.headerSize = readLE(image, 0, farbPointerSize);
+    if (info.headerSize + deviceIDOffset + sizeof(info.deviceID) >= info.size)
+    {
+        throw std::runtime_error("NVM image header points outside the image");
+    }
+    if (info.headerSize % sectionAlignment)
+    {
+        throw std::runtime_error("NVM image digital section isn't aligned");
+    }
+
+    auto sectionSize = readLE(image, info.headerSize, sizeof(uint16_t));
+    if (sectionSize >= info.size)
+    {
+        throw std::runtime_error("NVM image digital section is too big");
+    }
+
+    info.deviceID = readLE(
+        image, info.headerSize + deviceIDOffset, sizeof(info.deviceID));
+    return info;
+}
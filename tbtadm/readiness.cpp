@@ -0,0 +1,246 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "readiness.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "directory.h"
+#include "file.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const std::string classFilename  = "class";
+const std::string driverFilename = "driver";
+
+/// PCI-to-PCI bridges, PCI class code 0x0604xx
+const std::string bridgeClass = "0x0604";
+
+/// PCI device names look like 0000:05:00.0
+bool isPciName(const char* name)
+{
+    return std::strlen(name) == 12 && name[4] == ':' && name[7] == ':'
+           && name[10] == '.';
+}
+
+std::string seconds(tbtadm::PciReadiness::Clock::duration duration)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2)
+        << std::chrono::duration<double>(duration).count() << " s";
+    return out.str();
+}
+} // namespace
+
+tbtadm::PciReadiness::PciReadiness(const fs::path& device)
+{
+    // <NHI>/domainN/<host route-string>/.../<route-string>
+    auto domain = findDomain(fs::canonical(device));
+    if (domain.empty())
+    {
+        throw std::runtime_error("Can't find the domain of " + device.string());
+    }
+
+    // A discrete controller's NHI is behind a downstream port of its switch,
+    // and the tunnels come out of the sibling ports, under the upstream one;
+    // an integrated NHI is on the root bus, with the tunnels' root ports
+    const auto parent = domain.parent_path().parent_path();
+    m_root   = isPciName(parent.filename().c_str()) ? parent.parent_path()
+                                                    : parent;
+    m_before = scan();
+}
+
+void tbtadm::PciReadiness::scan(const fs::path& relative,
+                                std::set<std::string>& devices) const
+{
+    Directory dir(m_root / relative, isPciName);
+    for (const auto& entry : dir)
+    {
+        if (!entry.isDirectory())
+        {
+            continue;
+        }
+        const auto device = relative / entry.name();
+        devices.insert(device.string());
+        scan(device, devices);
+    }
+}
+
+std::set<std::string> tbtadm::PciReadiness::scan() const
+{
+    std::set<std::string> devices;
+    scan({}, devices);
+    return devices;
+}
+
+std::set<std::string>
+tbtadm::PciReadiness::unbound(const std::set<std::string>& devices) const
+{
+    std::set<std::string> result;
+    for (const auto& device : devices)
+    {
+        Directory dir(m_root / device);
+        if (dir.exists(driverFilename))
+        {
+            continue;
+        }
+        try
+        {
+            File pciClass(dir, classFilename, File::Mode::Read);
+            if (pciClass.read().compare(0, bridgeClass.size(), bridgeClass)
+                == 0)
+            {
+                continue;
+            }
+        }
+        catch (std::exception&)
+        {
+            // Assuming it's still being set up
+        }
+        result.insert(device);
+    }
+    return result;
+}
+
+void tbtadm::PciReadiness::wait(std::ostream& out,
+                                Clock::time_point start,
+                                Clock::time_point authorized,
+                                const Timeouts& timeouts) const
+{
+    auto report = [&out, start](const std::string& phase,
+                                Clock::time_point from,
+                                Clock::time_point to,
+                                const std::string& details = {}) {
+        out << phase << ": " << seconds(to - from) << " (at "
+            << seconds(to - start) << ')' << details << '\n';
+    };
+
+    report("Authorize write", start, authorized);
+
+    auto names = [](const std::set<std::string>& devices) {
+        std::string result;
+        for (const auto& device : devices)
+        {
+            result += ' ' + fs::path(device).filename().string();
+        }
+        return result;
+    };
+
+    std::set<std::string> seen;
+    auto tunnelUp   = Clock::time_point();
+    auto lastChange = authorized;
+    auto boundAt    = Clock::time_point();
+
+    for (;;)
+    {
+        const auto now = Clock::now();
+
+        std::set<std::string> current;
+        const auto all = scan();
+        std::set_difference(all.begin(),
+                            all.end(),
+                            m_before.begin(),
+                            m_before.end(),
+                            std::inserter(current, current.end()));
+        if (current != seen)
+        {
+            seen       = std::move(current);
+            lastChange = now;
+            boundAt    = {};
+            if (tunnelUp == Clock::time_point() && !seen.empty())
+            {
+                tunnelUp = now;
+                report("Tunnel up",
+                       authorized,
+                       now,
+                       ", first PCI device: "
+                           + fs::path(*seen.begin()).filename().string());
+            }
+        }
+
+        if (tunnelUp == Clock::time_point())
+        {
+            if (now - authorized >= timeouts.tunnel)
+            {
+                out << "No PCI devices appeared in "
+                    << seconds(timeouts.tunnel) << ", not waiting further\n";
+                return;
+            }
+        }
+        else
+        {
+            const auto missing = unbound(seen);
+            if (boundAt == Clock::time_point() && missing.empty())
+            {
+                boundAt = now;
+            }
+            const auto settled = now - lastChange >= timeouts.settle;
+            if (settled
+                && (boundAt != Clock::time_point()
+                    || now - lastChange >= timeouts.bind))
+            {
+                report("PCI enumeration",
+                       tunnelUp,
+                       lastChange,
+                       ", " + std::to_string(seen.size()) + " devices");
+                if (boundAt == Clock::time_point())
+                {
+                    // Not every function has a driver
+                    out << "No driver bound to:" << names(missing) << '\n';
+                    boundAt = now;
+                }
+                report("Driver bind", lastChange, boundAt);
+                out << "Ready after " << seconds(boundAt - start) << '\n';
+                return;
+            }
+        }
+
+        if (now - start >= timeouts.total)
+        {
+            const auto missing = names(unbound(seen));
+            throw std::runtime_error(
+                "Not ready after " + seconds(timeouts.total)
+                + (missing.empty() ? std::string()
+                                   : ", no driver bound to:" + missing));
+        }
+
+        std::this_thread::sleep_for(timeouts.poll);
+    }
+}
@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <set>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/**
+ * @brief Waits until the PCIe devices behind a Thunderbolt device are usable
+ *
+ * Authorizing a device only makes the connection manager set up its PCIe
+ * tunnel; then the PCIe hot-plug port notices the link, the PCI devices
+ * behind it are enumerated and finally drivers bind to them. The tunnelled
+ * devices appear under the PCIe downstream ports of the host controller, that
+ * are siblings of the port the NHI (the Thunderbolt host interface) sits
+ * behind, or under root ports next to an integrated NHI on the root bus, so
+ * this class snapshots the PCI hierarchy there before authorization and
+ * watches the new devices after it.
+ */
+class PciReadiness
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timeouts
+    {
+        /// Give up if no PCI device appeared in that time after authorization,
+        /// e.g. the device has no PCIe at all
+        Clock::duration tunnel = std::chrono::seconds(10);
+
+        /// Fail if not everything is usable in that time
+        Clock::duration total = std::chrono::seconds(60);
+
+        /// Enumeration is considered done when no device appeared for that long
+        Clock::duration settle = std::chrono::milliseconds(500);
+
+        /// The devices with no driver that long after the enumeration are
+        /// reported as such rather than waited for; some never get one
+        Clock::duration bind = std::chrono::seconds(5);
+
+        Clock::duration poll = std::chrono::milliseconds(50);
+    };
+
+    /**
+     * @brief Takes the snapshot of the PCI hierarchy
+     *
+     * @param device    the sysfs directory of the Thunderbolt device, before
+     *                  its authorization
+     */
+    explicit PciReadiness(const boost::filesystem::path& device);
+
+    /**
+     * @brief Waits for the new PCI devices and reports the phases timing
+     *
+     * Throws std::runtime_error if the enumeration doesn't finish in time.
+     *
+     * @param out           where the phases are reported
+     * @param start         when the authorization started
+     * @param authorized    when the authorization write completed
+     * @param timeouts      how long to wait
+     */
+    void wait(std::ostream& out,
+              Clock::time_point start,
+              Clock::time_point authorized,
+              const Timeouts& timeouts) const;
+
+private:
+    /// Collects the PCI devices under the root, as paths relative to it
+    void scan(const boost::filesystem::path& relative,
+              std::set<std::string>& devices) const;
+
+    std::set<std::string> scan() const;
+
+    /// The new devices that are neither bridges nor bound to a driver
+    std::set<std::string> unbound(const std::set<std::string>& devices) const;
+
+    boost::filesystem::path m_root;
+    std::set<std::string> m_before;
+};
+} // namespace tbtadm
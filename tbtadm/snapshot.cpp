@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+const char separator    = '\t';
+const std::string magic = "# tbtadm topology snapshot v1";
+
+/// Makes sure a field can't break the line format
+std::string sanitize(std::string field)
+{
+    std::replace_if(field.begin(),
+                    field.end(),
+                    [](char c) { return c == separator || c == '\n'; },
+                    ' ');
+    return field;
+}
+
+/// Adds a detail line if the given field differs
+void compare(std::vector<std::string>& details,
+             const std::string& name,
+             const std::string& older,
+             const std::string& newer)
+{
+    if (older != newer)
+    {
+        details.push_back(name + ": " + (older.empty() ? "-" : older) + " -> "
+                          + (newer.empty() ? "-" : newer));
+    }
+}
+} // namespace
+
+void tbtadm::TopologySnapshot::add(SnapshotDevice device)
+{
+    auto uuid = device.uuid;
+    m_devices[std::move(uuid)] = std::move(device);
+}
+
+void tbtadm::TopologySnapshot::load(const fs::path& path)
+{
+    std::istringstream stream(File(path, File::Mode::Read).read());
+    std::string line;
+    if (!std::getline(stream, line) || line != magic)
+    {
+        throw std::runtime_error(path.string()
+                                 + " isn't a topology snapshot");
+    }
+
+    m_devices.clear();
+    while (std::getline(stream, line))
+    {
+        std::istringstream fields(line);
+        SnapshotDevice device;
+        if (!std::getline(fields, device.uuid, separator)
+            || !std::getline(fields, device.domain, separator)
+            || !std::getline(fields, device.routeString, separator)
+            || !std::getline(fields, device.authorized, separator)
+            || !std::getline(fields, device.inACL, separator)
+            || !std::getline(fields, device.vendor, separator)
+            || !std::getline(fields, device.device, separator))
+        {
+            continue;
+        }
+        // The link is the last field, and may be empty
+        std::getline(fields, device.link);
+        add(std::move(device));
+    }
+}
+
+void tbtadm::TopologySnapshot::save(const fs::path& path) const
+{
+    std::string content = magic + '\n';
+    for (const auto& entry : m_devices)
+    {
+        const auto& device = entry.second;
+        content += sanitize(device.uuid) + separator + sanitize(device.domain)
+                   + separator + sanitize(device.routeString) + separator
+                   + sanitize(device.authorized) + separator
+                   + sanitize(device.inACL) + separator
+                   + sanitize(device.vendor) + separator
+                   + sanitize(device.device) + separator
+                   + sanitize(device.link) + '\n';
+    }
+
+    writeAtomically(path, content);
+}
+
+std::vector<tbtadm::SnapshotChange>
+tbtadm::TopologySnapshot::diff(const TopologySnapshot& newer) const
+{
+    std::vector<SnapshotChange> changes;
+
+    // Both maps are sorted by UUID, so a single merge pass finds everything
+    auto older = m_devices.begin();
+    auto now   = newer.m_devices.begin();
+    while (older != m_devices.end() || now != newer.m_devices.end())
+    {
+        if (now == newer.m_devices.end()
+            || (older != m_devices.end() && older->first < now->first))
+        {
+            changes.push_back(
+                {SnapshotChange::Kind::Removed, older->second, {}});
+            ++older;
+            continue;
+        }
+        if (older == m_devices.end() || now->first < older->first)
+        {
+            changes.push_back({SnapshotChange::Kind::Added, now->second, {}});
+            ++now;
+            continue;
+        }
+
+        const auto& a = older->second;
+        const auto& b = now->second;
+        SnapshotChange change{SnapshotChange::Kind::Changed, b, {}};
+        if (a.domain != b.domain || a.routeString != b.routeString)
+        {
+            change.kind = SnapshotChange::Kind::Moved;
+            change.details.push_back("moved from " + a.routeString
+                                     + " (domain " + a.domain + ")");
+        }
+        compare(change.details, "authorized", a.authorized, b.authorized);
+        compare(change.details, "in ACL", a.inACL, b.inACL);
+        compare(change.details, "vendor", a.vendor, b.vendor);
+        compare(change.details, "name", a.device, b.device);
+        compare(change.details, "link", a.link, b.link);
+        if (!change.details.empty())
+        {
+            changes.push_back(std::move(change));
+        }
+        ++older;
+        ++now;
+    }
+
+    return changes;
+}
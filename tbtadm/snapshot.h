@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/// A device (or peer host) as recorded in a topology snapshot
+struct SnapshotDevice
+{
+    std::string uuid;
+    std::string domain;
+    std::string routeString;
+    std::string vendor;
+    std::string device;
+    std::string authorized; ///< "Yes", "No" or "-" for peers
+    std::string inACL;      ///< "Yes", "No", "No (no key)" or "-" for peers
+    std::string link;       ///< empty if the kernel doesn't report it
+};
+
+/// A difference between two snapshots, of a single device
+struct SnapshotChange
+{
+    enum class Kind
+    {
+        Added,
+        Removed,
+        Moved,
+        Changed
+    };
+
+    Kind kind;
+    /// The device as found in the newer snapshot (the older one if removed)
+    SnapshotDevice device;
+    /// What changed, e.g. "authorized: No -> Yes"
+    std::vector<std::string> details;
+};
+
+/**
+ * @brief The connected devices, as saved by topology --save
+ *
+ * Devices are keyed by UUID, so a device keeps its identity when it moves to
+ * another port or domain.
+ *
+ * The file is line based; after a header line, each line holds the fields of
+ * a single device separated by tabs, with the UUID first. Lines are sorted by
+ * UUID, so the file is stable and two files may be compared with a merge.
+ */
+class TopologySnapshot
+{
+public:
+    /// Adds a connected device
+    void add(SnapshotDevice device);
+
+    /// Loads the given snapshot file, throwing if it isn't one
+    void load(const boost::filesystem::path& path);
+
+    /// Writes the snapshot to the given file, atomically
+    void save(const boost::filesystem::path& path) const;
+
+    /**
+     * @brief Compares with a newer snapshot
+     *
+     * @return the added, removed, moved and changed devices, by UUID
+     */
+    std::vector<SnapshotChange> diff(const TopologySnapshot& newer) const;
+
+private:
+    std::map<std::string, SnapshotDevice> m_devices;
+};
+} // namespace tbtadm
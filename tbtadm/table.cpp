@@ -0,0 +1,149 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "table.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace
+{
+const std::string green  = "\x1b[0;32m";
+const std::string yellow = "\x1b[0;33m";
+const std::string normal = "\x1b[0m";
+
+const char columnSeparator = '\t';
+const size_t columnGap     = 2;
+
+const std::string& colorCode(tbtadm::Table::Color color)
+{
+    switch (color)
+    {
+        case tbtadm::Table::Color::Green:
+            return green;
+        case tbtadm::Table::Color::Yellow:
+            return yellow;
+        case tbtadm::Table::Color::Normal:
+        default:
+            return normal;
+    }
+}
+
+/// Counts UTF-8 code points, so vendor/device names with non-ASCII
+/// characters don't break the alignment
+size_t displayWidth(const std::string& str)
+{
+    return std::count_if(
+        str.begin(), str.end(), [](char c) { return (c & 0xC0) != 0x80; });
+}
+} // namespace
+
+tbtadm::Table::Table(std::ostream& out, bool useColor, bool stream)
+    : m_out(out), m_useColor(useColor), m_stream(stream)
+{
+}
+
+void tbtadm::Table::add(std::vector<std::string> columns, Color color)
+{
+    Row row{std::move(columns), color};
+    if (!m_stream)
+    {
+        m_rows.push_back(std::move(row));
+        return;
+    }
+
+    // The stream does its own buffering; flushing is left for print()
+    std::string buffer;
+    render(buffer, row, {});
+    m_out << buffer;
+}
+
+void tbtadm::Table::print()
+{
+    std::vector<size_t> widths;
+    size_t total = 0;
+    for (const auto& row : m_rows)
+    {
+        if (widths.size() < row.columns.size())
+        {
+            widths.resize(row.columns.size());
+        }
+        for (size_t i = 0; i < row.columns.size(); ++i)
+        {
+            widths[i] = std::max(widths[i], displayWidth(row.columns[i]));
+            total += row.columns[i].size() + columnGap;
+        }
+    }
+
+    std::string buffer;
+    buffer.reserve(total + m_rows.size() * (green.size() + normal.size() + 1));
+    for (const auto& row : m_rows)
+    {
+        render(buffer, row, widths);
+    }
+    m_rows.clear();
+
+    m_out.write(buffer.data(), buffer.size());
+    m_out.flush();
+}
+
+void tbtadm::Table::render(std::string& buffer,
+                           const Row& row,
+                           const std::vector<size_t>& widths) const
+{
+    const bool colored = m_useColor && row.color != Color::Normal;
+    if (colored)
+    {
+        buffer += colorCode(row.color);
+    }
+
+    const auto& columns = row.columns;
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        buffer += columns[i];
+        if (i == columns.size() - 1)
+        {
+            break;
+        }
+        if (widths.empty())
+        {
+            buffer += columnSeparator;
+            continue;
+        }
+        buffer.append(widths[i] - displayWidth(columns[i]) + columnGap, ' ');
+    }
+
+    if (colored)
+    {
+        buffer += normal;
+    }
+    buffer += '\n';
+}
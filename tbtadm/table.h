@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtadm tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace tbtadm
+{
+/**
+ * @brief Renders the rows of the list commands (devices, peers, acl)
+ *
+ * In the default (aligned) mode the rows are collected first, so the column
+ * widths can be computed once all of them are known, and the whole table is
+ * then written to the stream as a single block.
+ *
+ * In streaming mode every row is written as soon as it's added, with the
+ * columns separated by tabs. This is intended for very big outputs (e.g. a
+ * huge ACL) where keeping all the rows in memory isn't desired.
+ *
+ * Colors are applied per row, and only if the caller decided they are
+ * supported, so the terminal check is done once and not per row.
+ */
+class Table
+{
+public:
+    enum class Color
+    {
+        Normal,
+        Green,
+        Yellow
+    };
+
+    /**
+     * @brief Construct the renderer
+     *
+     * @param out       stream to write the rows to
+     * @param useColor  whether to wrap rows with terminal color sequences
+     * @param stream    write each row immediately, with no alignment
+     */
+    Table(std::ostream& out, bool useColor, bool stream = false);
+
+    /**
+     * @brief Add a row to the table
+     *
+     * @param columns   the row's fields
+     * @param color     the color to use for the whole row
+     */
+    void add(std::vector<std::string> columns, Color color = Color::Normal);
+
+    /**
+     * @brief Write the collected rows and flush the stream
+     *
+     * Can be called more than once; each call writes only the rows added
+     * since the previous one.
+     */
+    void print();
+
+private:
+    struct Row
+    {
+        std::vector<std::string> columns;
+        Color color;
+    };
+
+    void render(std::string& buffer,
+                const Row& row,
+                const std::vector<size_t>& widths) const;
+
+    std::ostream& m_out;
+    bool m_useColor;
+    bool m_stream;
+    std::vector<Row> m_rows;
+};
+} // namespace tbtadm
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <syslog.h>
+
+#include "policy.h"
+#include "tuning.h"
+#include "xdomain.h"
+
+/*
+ * Triggered by udev (see tbtxdomain.rules) on XDomain and XDomain service
+ * addition, on drivers binding to XDomain services, and on addition of
+ * Thunderbolt networking interfaces:
+ *
+ *     tbtxdomain [options] add|service|bind|tune <devpath>
+ */
+
+namespace
+{
+void usage()
+{
+    std::cerr << "Usage: tbtxdomain [--policy <file>] [--tuning <file>] "
+                 "[--dry-run] add|service|bind|tune <devpath>\n";
+}
+} // namespace
+
+int main(int argc, char* argv[]) try
+{
+    openlog("tbtxdomain", LOG_PID, LOG_DAEMON);
+
+    auto policyPath = tbtadm::ServicePolicy::defaultPath;
+    auto tuningPath = tbtadm::TuningProfiles::defaultPath;
+    bool dryRun     = false;
+    int arg         = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg)
+    {
+        if (std::strcmp(argv[arg], "--dry-run") == 0)
+        {
+            dryRun = true;
+        }
+        else if (arg + 1 < argc && std::strcmp(argv[arg], "--policy") == 0)
+        {
+            policyPath = argv[++arg];
+        }
+        else if (arg + 1 < argc && std::strcmp(argv[arg], "--tuning") == 0)
+        {
+            tuningPath = argv[++arg];
+        }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc != arg + 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const std::string action  = argv[arg];
+    const std::string devpath = argv[arg + 1];
+
+    // udev may run us with a minimal PATH
+    std::string path = getenv("PATH") ? getenv("PATH") : "";
+    setenv("PATH", (path + ":/sbin:/usr/sbin").c_str(), 1);
+
+    tbtadm::ServicePolicy policy(policyPath);
+    tbtadm::XDomainHandler handler(policy, std::cout);
+    if (action == "add")
+    {
+        handler.peerAdded(devpath);
+    }
+    else if (action == "service")
+    {
+        handler.serviceAdded(devpath);
+    }
+    else if (action == "bind")
+    {
+        handler.serviceBound(devpath);
+    }
+    else if (action == "tune")
+    {
+        tbtadm::TuningProfiles profiles(tuningPath);
+        tbtadm::NetTuner tuner(std::cout, dryRun);
+        handler.tune(devpath, profiles, tuner);
+    }
+    else
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+}
+catch (std::system_error& e)
+{
+    syslog(LOG_ERR, "%s", e.what());
+    std::cerr << e.code() << ' ' << e.what() << '\n';
+    return e.code().value();
+}
+catch (std::exception& e)
+{
+    syslog(LOG_ERR, "%s", e.what());
+    std::cerr << "Exception: " << e.what() << '\n';
+    return EXIT_FAILURE;
+}
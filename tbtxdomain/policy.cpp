@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "policy.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+const fs::path tbtadm::ServicePolicy::defaultPath = TBTXDOMAIN_POLICY;
+
+namespace
+{
+const std::string anyPrefix    = "*";
+const std::string uuidPrefix   = "uuid:";
+const std::string vendorPrefix = "vendor:";
+
+bool startsWith(const std::string& str, const std::string& prefix)
+{
+    return str.compare(0, prefix.size(), prefix) == 0;
+}
+} // namespace
+
+tbtadm::PeerMatch::PeerMatch(const std::string& match)
+{
+    if (match == anyPrefix)
+    {
+        m_kind = Kind::Any;
+    }
+    else if (startsWith(match, uuidPrefix))
+    {
+        m_kind  = Kind::UUID;
+        m_value = match.substr(uuidPrefix.size());
+    }
+    else if (startsWith(match, vendorPrefix))
+    {
+        m_kind  = Kind::Vendor;
+        m_value = match.substr(vendorPrefix.size());
+    }
+    else
+    {
+        throw std::invalid_argument("unknown match '" + match + '\'');
+    }
+}
+
+bool tbtadm::PeerMatch::matches(const Peer& peer) const
+{
+    switch (m_kind)
+    {
+        case Kind::UUID:
+            return m_value == peer.uuid;
+        case Kind::Vendor:
+            return m_value == peer.vendor;
+        case Kind::Any:
+            break;
+    }
+    return true;
+}
+
+tbtadm::ServicePolicy::ServicePolicy(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    if (!file)
+    {
+        return;
+    }
+
+    std::string line;
+    for (int lineNum = 1; std::getline(file, line); ++lineNum)
+    {
+        std::istringstream stream(line);
+        std::vector<std::string> words;
+        for (std::string word; stream >> word;)
+        {
+            words.push_back(std::move(word));
+        }
+        if (words.empty() || words[0][0] == '#')
+        {
+            continue;
+        }
+
+        auto error = [&](const std::string& msg) {
+            return std::runtime_error(path.string() + ':'
+                                      + std::to_string(lineNum) + ": " + msg);
+        };
+
+        if (words.size() < 3)
+        {
+            throw error("expected '<match> <service> allow|deny'");
+        }
+
+        const auto& action = words.back();
+        if (action != "allow" && action != "deny")
+        {
+            throw error("unknown action '" + action + '\'');
+        }
+
+        // Everything before the service is the match, vendor names may have
+        // spaces in them
+        std::string match = words[0];
+        for (size_t i = 1; i < words.size() - 2; ++i)
+        {
+            match += ' ' + words[i];
+        }
+
+        try
+        {
+            m_rules.push_back(
+                {PeerMatch(match), words[words.size() - 2], action == "allow"});
+        }
+        catch (std::invalid_argument& e)
+        {
+            throw error(e.what());
+        }
+    }
+}
+
+bool tbtadm::ServicePolicy::allowed(const Peer& peer,
+                                    const std::string& service) const
+{
+    bool allow = true;
+    int best   = -1;
+
+    for (const auto& rule : m_rules)
+    {
+        if (rule.service != anyPrefix && rule.service != service)
+        {
+            continue;
+        }
+        if (!rule.match.matches(peer))
+        {
+            continue;
+        }
+
+        int specificity = rule.match.specificity() * 2
+                          + (rule.service == anyPrefix ? 0 : 1);
+        if (specificity >= best)
+        {
+            best  = specificity;
+            allow = rule.allow;
+        }
+    }
+
+    return allow;
+}
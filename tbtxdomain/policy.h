@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace tbtadm
+{
+/// The identity of an XDomain peer, as advertised in its properties
+struct Peer
+{
+    std::string uuid;
+    std::string vendor;
+    std::string device;
+};
+
+/**
+ * @brief Selects peers by UUID or vendor, or any peer
+ *
+ * Parsed from '*' (any peer), "uuid:<UUID>" or "vendor:<vendor name>".
+ */
+class PeerMatch
+{
+public:
+    /// Throws std::invalid_argument if the match isn't one of the above
+    explicit PeerMatch(const std::string& match);
+
+    bool matches(const Peer& peer) const;
+
+    /// UUID matches are more specific than vendor ones, that are more specific
+    /// than '*'
+    int specificity() const { return static_cast<int>(m_kind); }
+
+private:
+    enum class Kind
+    {
+        Any,
+        Vendor,
+        UUID
+    };
+
+    Kind m_kind;
+    std::string m_value; // UUID or vendor name
+};
+
+/**
+ * @brief Decides which XDomain services are enabled for which peer
+ *
+ * The policy file holds one rule per line, in the form:
+ *
+ *     <match> <service> allow|deny
+ *
+ * where <match> is '*' (any peer), "uuid:<UUID>" or "vendor:<vendor name>"
+ * (the vendor name may contain spaces) and <service> is the service key the
+ * peer advertises (e.g. "network") or '*' for any service.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * The most specific rule wins: UUID rules take precedence over vendor rules
+ * that take precedence over '*', and on the same level a rule for the exact
+ * service takes precedence over '*'. Among equally specific rules the last one
+ * wins. Services with no matching rule are allowed.
+ */
+class ServicePolicy
+{
+public:
+    /// Default location of the policy file
+    static const boost::filesystem::path defaultPath;
+
+    /**
+     * @brief Load the policy
+     *
+     * A missing file is the same as an empty policy, i.e. everything allowed.
+     * Throws std::runtime_error on a malformed rule.
+     */
+    explicit ServicePolicy(const boost::filesystem::path& path);
+
+    bool allowed(const Peer& peer, const std::string& service) const;
+
+private:
+    struct Rule
+    {
+        PeerMatch match;
+        std::string service;
+        bool allow;
+    };
+
+    std::vector<Rule> m_rules;
+};
+} // namespace tbtadm
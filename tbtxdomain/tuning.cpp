@@ -0,0 +1,289 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "tuning.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <syslog.h>
+
+#include "directory.h"
+#include "file.h"
+
+namespace fs = boost::filesystem;
+
+const fs::path tbtadm::TuningProfiles::defaultPath = TBTXDOMAIN_TUNING;
+
+namespace
+{
+const std::string mtuSetting         = "mtu";
+const std::string txQueueLenSetting  = "tx_queue_len";
+const std::string rpsCPUsSetting     = "rps_cpus";
+const std::string rpsFlowCntSetting  = "rps_flow_cnt";
+const std::string xpsCPUsSetting     = "xps_cpus";
+const std::string irqAffinitySetting = "irq_affinity";
+
+const std::string whitespace = " \t\r\n";
+
+std::string trim(const std::string& str)
+{
+    auto first = str.find_first_not_of(whitespace);
+    if (first == str.npos)
+    {
+        return {};
+    }
+    return str.substr(first, str.find_last_not_of(whitespace) - first + 1);
+}
+
+bool isNumber(const std::string& value)
+{
+    auto isDigit = [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+    };
+    return !value.empty() && std::all_of(value.begin(), value.end(), isDigit);
+}
+
+/// CPU masks are hex, possibly with comma-separated 32-bit groups
+bool isCPUMask(const std::string& value)
+{
+    auto isMaskChar = [](char c) {
+        return std::isxdigit(static_cast<unsigned char>(c)) || c == ',';
+    };
+    return !value.empty()
+           && std::all_of(value.begin(), value.end(), isMaskChar);
+}
+
+using Validator = bool (*)(const std::string&);
+
+const std::map<std::string, Validator> settingValidators{
+    {mtuSetting, isNumber},
+    {txQueueLenSetting, isNumber},
+    {rpsCPUsSetting, isCPUMask},
+    {rpsFlowCntSetting, isNumber},
+    {xpsCPUsSetting, isCPUMask},
+    {irqAffinitySetting, isCPUMask}};
+
+/// Settings of the host controller, shared by all the peers
+bool isHostWide(const std::string& setting)
+{
+    return setting == irqAffinitySetting;
+}
+} // namespace
+
+tbtadm::TuningProfiles::TuningProfiles(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    if (!file)
+    {
+        return;
+    }
+
+    std::string line;
+    for (int lineNum = 1; std::getline(file, line); ++lineNum)
+    {
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        auto error = [&](const std::string& msg) {
+            return std::runtime_error(path.string() + ':'
+                                      + std::to_string(lineNum) + ": " + msg);
+        };
+
+        if (line.front() == '[')
+        {
+            if (line.back() != ']')
+            {
+                throw error("expected '[<match>]'");
+            }
+            try
+            {
+                m_profiles.push_back(
+                    {PeerMatch(line.substr(1, line.size() - 2)), {}});
+            }
+            catch (std::invalid_argument& e)
+            {
+                throw error(e.what());
+            }
+            continue;
+        }
+
+        auto eq = line.find('=');
+        if (eq == line.npos)
+        {
+            throw error("expected '<setting> = <value>'");
+        }
+
+        auto name      = trim(line.substr(0, eq));
+        auto value     = trim(line.substr(eq + 1));
+        auto validator = settingValidators.find(name);
+        if (validator == settingValidators.end())
+        {
+            throw error("unknown setting '" + name + '\'');
+        }
+        if (!validator->second(value))
+        {
+            throw error("invalid value '" + value + "' for " + name);
+        }
+
+        if (isHostWide(name))
+        {
+            if (!m_profiles.empty())
+            {
+                throw error(name + " is host-wide, set it before the first "
+                                   "profile");
+            }
+            m_hostSettings[name] = value;
+            continue;
+        }
+        if (m_profiles.empty())
+        {
+            throw error("setting outside of a profile");
+        }
+        m_profiles.back().settings[name] = value;
+    }
+}
+
+tbtadm::NetSettings tbtadm::TuningProfiles::settingsFor(const Peer& peer) const
+{
+    std::vector<const Profile*> matching;
+    for (const auto& profile : m_profiles)
+    {
+        if (profile.match.matches(peer))
+        {
+            matching.push_back(&profile);
+        }
+    }
+
+    // Apply the more specific ones last, keeping the file order otherwise
+    std::stable_sort(
+        matching.begin(), matching.end(), [](const auto& a, const auto& b) {
+            return a->match.specificity() < b->match.specificity();
+        });
+
+    auto settings = m_hostSettings;
+    for (const auto* profile : matching)
+    {
+        for (const auto& setting : profile->settings)
+        {
+            settings[setting.first] = setting.second;
+        }
+    }
+    return settings;
+}
+
+tbtadm::NetTuner::NetTuner(std::ostream& out,
+                           bool dryRun,
+                           const fs::path& procfs)
+    : m_out(out), m_dryRun(dryRun), m_procfs(procfs)
+{
+}
+
+void tbtadm::NetTuner::tune(const fs::path& interface,
+                            const fs::path& nhi,
+                            const NetSettings& settings)
+{
+    auto apply = [&](const std::string& name, auto action) {
+        auto setting = settings.find(name);
+        if (setting != settings.end())
+        {
+            action(setting->second);
+        }
+    };
+
+    // MTU first, the kernel may resize the queues on change
+    apply(mtuSetting,
+          [&](const auto& value) { this->set(interface / mtuSetting, value); });
+    apply(txQueueLenSetting, [&](const auto& value) {
+        this->set(interface / txQueueLenSetting, value);
+    });
+    apply(rpsCPUsSetting, [&](const auto& value) {
+        this->setQueues(interface, "rx-", rpsCPUsSetting, value);
+    });
+    apply(rpsFlowCntSetting, [&](const auto& value) {
+        this->setQueues(interface, "rx-", rpsFlowCntSetting, value);
+    });
+    apply(xpsCPUsSetting, [&](const auto& value) {
+        this->setQueues(interface, "tx-", xpsCPUsSetting, value);
+    });
+
+    // The rings of the networking driver use the NHI MSI-X vectors and
+    // there is no telling from sysfs which vector belongs to which ring, so
+    // the affinity is set for all of them (hence a host-wide setting)
+    apply(irqAffinitySetting, [&](const auto& value) {
+        const auto msiIRQs = nhi / "msi_irqs";
+        if (nhi.empty() || !fs::exists(msiIRQs))
+        {
+            m_out << "No MSI IRQs found for " << nhi << ", skipping "
+                  << irqAffinitySetting << '\n';
+            return;
+        }
+        for (const auto& entry : Directory(msiIRQs))
+        {
+            this->set(m_procfs / "irq" / entry.name() / "smp_affinity", value);
+        }
+    });
+}
+
+void tbtadm::NetTuner::set(const fs::path& file, const std::string& value)
+{
+    if (m_dryRun)
+    {
+        m_out << "Would write " << value << " to " << file.string() << '\n';
+        return;
+    }
+
+    File attribute(file, File::Mode::Write);
+    attribute << value;
+    syslog(LOG_INFO, "wrote %s to %s", value.c_str(), file.c_str());
+    m_out << "Wrote " << value << " to " << file.string() << '\n';
+}
+
+void tbtadm::NetTuner::setQueues(const fs::path& interface,
+                                 const char* prefix,
+                                 const std::string& attribute,
+                                 const std::string& value)
+{
+    const auto queues = interface / "queues";
+    for (const auto& entry : Directory(queues))
+    {
+        if (std::strncmp(entry.name(), prefix, std::strlen(prefix)) == 0)
+        {
+            set(queues / entry.name() / attribute, value);
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "policy.h"
+
+namespace tbtadm
+{
+/// Tuning setting name -> value, e.g. "mtu" -> "65522"
+using NetSettings = std::map<std::string, std::string>;
+
+/**
+ * @brief Tuning profiles for Thunderbolt networking interfaces, per peer
+ *
+ * The profiles file is made of sections, each starting with a peer match
+ * line (see PeerMatch) in brackets, followed by "<setting> = <value>" lines:
+ *
+ *     [uuid:<UUID>]
+ *     mtu = 65522
+ *     rps_cpus = f
+ *
+ * Supported settings:
+ * - mtu, tx_queue_len: interface attributes
+ * - rps_cpus, rps_flow_cnt: set for all the RX queues
+ * - xps_cpus: set for all the TX queues
+ *
+ * Host-wide settings come before the first profile, and are applied for
+ * every peer:
+ * - irq_affinity: CPU mask for all the interrupts of the host controller
+ *   (NHI) the peer is connected to. These are shared by all the peers and
+ *   by the control channel, so it can't be set per peer.
+ *
+ * Empty lines and lines starting with '#' are ignored. All the profiles
+ * matching a peer are applied, with settings from more specific ones (as in
+ * ServicePolicy) overriding the others.
+ */
+class TuningProfiles
+{
+public:
+    /// Default location of the profiles file
+    static const boost::filesystem::path defaultPath;
+
+    /**
+     * @brief Load the profiles
+     *
+     * A missing file means no tuning. Throws std::runtime_error on malformed
+     * lines, unknown settings or invalid values.
+     */
+    explicit TuningProfiles(const boost::filesystem::path& path);
+
+    /// The host-wide settings and those for the given peer, if any
+    NetSettings settingsFor(const Peer& peer) const;
+
+private:
+    struct Profile
+    {
+        PeerMatch match;
+        NetSettings settings;
+    };
+
+    NetSettings m_hostSettings;
+    std::vector<Profile> m_profiles;
+};
+
+/**
+ * @brief Applies tuning settings on a network interface
+ *
+ * Every write is reported; in dry-run mode the writes are only reported.
+ */
+class NetTuner
+{
+public:
+    /**
+     * @param out       where the actions are reported
+     * @param dryRun    report the actions without doing them
+     * @param procfs    the procfs mount point
+     */
+    NetTuner(std::ostream& out,
+             bool dryRun,
+             const boost::filesystem::path& procfs = "/proc");
+
+    /**
+     * @brief Tune the interface
+     *
+     * @param interface the interface sysfs directory
+     * @param nhi       the sysfs directory of the host controller PCI device,
+     *                  for IRQ affinity
+     * @param settings  what to set
+     */
+    void tune(const boost::filesystem::path& interface,
+              const boost::filesystem::path& nhi,
+              const NetSettings& settings);
+
+private:
+    void set(const boost::filesystem::path& file, const std::string& value);
+
+    /// Sets the attribute in all the queue directories starting with prefix
+    void setQueues(const boost::filesystem::path& interface,
+                   const char* prefix,
+                   const std::string& attribute,
+                   const std::string& value);
+
+    std::ostream& m_out;
+    const bool m_dryRun;
+    const boost::filesystem::path m_procfs;
+};
+} // namespace tbtadm
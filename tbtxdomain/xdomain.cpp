@@ -0,0 +1,299 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include "xdomain.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <syslog.h>
+
+#include "directory.h"
+#include "file.h"
+#include "sysfs.h"
+
+namespace fs = boost::filesystem;
+using namespace std::string_literals;
+
+extern char** environ;
+
+namespace
+{
+/// A service driver the handler knows how to load
+struct ServiceDriver
+{
+    const char* key;    // As advertised in the XDomain properties
+    const char* module; // Kernel module name
+};
+
+const ServiceDriver serviceDrivers[] = {{"network", "thunderbolt-net"}};
+
+const std::string uniqueIDFilename = "unique_id";
+const std::string vendorFilename   = "vendor_name";
+const std::string deviceFilename   = "device_name";
+const std::string keyFilename      = "key";
+const std::string driverFilename   = "driver";
+const std::string unbindFilename   = "driver/unbind";
+const std::string netDirname       = "net";
+
+/// Reads an attribute of a peer or a service, empty if it has no value
+std::string readAttribute(const tbtadm::Directory& dir, const std::string& name)
+{
+    try
+    {
+        return tbtadm::readAndTrim(dir, name);
+    }
+    // assuming this is from an empty file
+    catch (std::runtime_error&)
+    {
+        return {};
+    }
+}
+
+/// Service devices are named after the XDomain, e.g. 0-1.1
+bool isServiceName(const char* name)
+{
+    return std::strchr(name, '.');
+}
+} // namespace
+
+tbtadm::XDomainHandler::XDomainHandler(const ServicePolicy& policy,
+                                       std::ostream& out,
+                                       const fs::path& sysfs)
+    : m_policy(policy), m_out(out), m_sysfs(sysfs)
+{
+}
+
+void tbtadm::XDomainHandler::peerAdded(const std::string& devpath)
+{
+    const auto path = m_sysfs / devpath;
+    const auto peer = readPeer(path);
+
+    Directory xdomain(path, isServiceName);
+    for (const auto& entry : xdomain)
+    {
+        if (!entry.isDirectory())
+        {
+            continue;
+        }
+        handleService(peer, Directory(xdomain, entry.name()), entry.name());
+    }
+}
+
+void tbtadm::XDomainHandler::serviceAdded(const std::string& devpath)
+{
+    const auto path = m_sysfs / devpath;
+    handleService(readPeer(path.parent_path()),
+                  Directory(path),
+                  path.filename().string());
+}
+
+void tbtadm::XDomainHandler::tune(const std::string& devpath,
+                                  const TuningProfiles& profiles,
+                                  NetTuner& tuner)
+{
+    auto path = m_sysfs / devpath;
+    std::vector<fs::path> interfaces;
+
+    // <peer>/<service>/net/<interface>
+    if (path.parent_path().filename() == netDirname)
+    {
+        interfaces.push_back(path);
+        path = path.parent_path().parent_path().parent_path();
+    }
+    else
+    {
+        Directory xdomain(path, isServiceName);
+        for (const auto& service : xdomain)
+        {
+            const auto net = service.name() + ("/" + netDirname);
+            if (!xdomain.exists(net))
+            {
+                continue;
+            }
+            for (const auto& interface : Directory(xdomain, net))
+            {
+                interfaces.push_back(path / net / interface.name());
+            }
+        }
+    }
+
+    const auto peer     = readPeer(path);
+    const auto settings = profiles.settingsFor(peer);
+    if (settings.empty())
+    {
+        m_out << "No tuning profile for " << peer.uuid << " (" << peer.vendor
+              << ")\n";
+        return;
+    }
+
+    // The domain is a child of the NHI PCI device
+    const auto nhi = findDomain(path).parent_path();
+
+    for (const auto& interface : interfaces)
+    {
+        m_out << "Tuning " << interface.filename().string() << " of "
+              << peer.uuid << " (" << peer.vendor << ")\n";
+        tuner.tune(interface, nhi, settings);
+    }
+}
+
+tbtadm::Peer tbtadm::XDomainHandler::readPeer(const fs::path& path) const
+{
+    Directory dir(path);
+    return {readAttribute(dir, uniqueIDFilename),
+            readAttribute(dir, vendorFilename),
+            readAttribute(dir, deviceFilename)};
+}
+
+void tbtadm::XDomainHandler::handleService(const Peer& peer,
+                                           const Directory& service,
+                                           const std::string& name)
+{
+    const auto key = readAttribute(service, keyFilename);
+    if (!m_policy.allowed(peer, key))
+    {
+        deny(peer, service, name, key);
+        return;
+    }
+
+    auto driver = std::find_if(std::begin(serviceDrivers),
+                               std::end(serviceDrivers),
+                               [&key](const auto& d) { return key == d.key; });
+    if (driver == std::end(serviceDrivers))
+    {
+        report(LOG_INFO, peer, name, key, "allowed, no known driver");
+        return;
+    }
+
+    if (moduleLoaded(driver->module))
+    {
+        report(LOG_INFO,
+               peer,
+               name,
+               key,
+               "allowed, "s + driver->module + " already loaded");
+        return;
+    }
+    loadModule(driver->module);
+    report(LOG_NOTICE,
+           peer,
+           name,
+           key,
+           "allowed, "s + driver->module + " loaded");
+}
+
+void tbtadm::XDomainHandler::serviceBound(const std::string& devpath)
+{
+    const auto path = m_sysfs / devpath;
+    const auto peer = readPeer(path.parent_path());
+    Directory service(path);
+    const auto key = readAttribute(service, keyFilename);
+    if (!m_policy.allowed(peer, key))
+    {
+        deny(peer, service, path.filename().string(), key);
+    }
+}
+
+void tbtadm::XDomainHandler::deny(const Peer& peer,
+                                  const Directory& service,
+                                  const std::string& name,
+                                  const std::string& key)
+{
+    if (!service.exists(driverFilename))
+    {
+        // A driver loaded later (e.g. by its modalias) binds to the service
+        // anyway; its bind event brings us back to unbind it
+        report(LOG_INFO, peer, name, key, "denied by policy");
+        return;
+    }
+    File unbind(service, unbindFilename, File::Mode::Write);
+    unbind << name;
+    report(LOG_NOTICE,
+           peer,
+           name,
+           key,
+           "denied by policy, unbound from its driver");
+}
+
+void tbtadm::XDomainHandler::report(int priority,
+                                    const Peer& peer,
+                                    const std::string& name,
+                                    const std::string& key,
+                                    const std::string& message)
+{
+    const auto line = name + ": " + key + " service of " + peer.uuid + " ("
+                      + peer.vendor + "): " + message;
+    syslog(priority, "%s", line.c_str());
+    m_out << line << '\n';
+}
+
+bool tbtadm::XDomainHandler::moduleLoaded(const std::string& module) const
+{
+    // sysfs uses underscores in module names
+    auto sysfsName = module;
+    std::replace(sysfsName.begin(), sysfsName.end(), '-', '_');
+    return fs::exists(m_sysfs / "module" / sysfsName);
+}
+
+void tbtadm::XDomainHandler::loadModule(const std::string& module)
+{
+    const char* argv[] = {"modprobe", "-q", module.c_str(), nullptr};
+
+    pid_t pid;
+    int err = posix_spawnp(&pid,
+                           argv[0],
+                           nullptr,
+                           nullptr,
+                           const_cast<char* const*>(argv),
+                           environ);
+    if (err)
+    {
+        throw std::system_error(err, std::system_category(), "modprobe");
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            throw std::system_error(errno, std::system_category(), "waitpid");
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        throw std::runtime_error("Failed to load " + module);
+    }
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * Thunderbolt(TM) tbtxdomain tool
+ * This code is distributed under the following BSD-style license:
+ *
+ * Copyright(c) 2017 Intel Corporation.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Intel Corporation nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "policy.h"
+#include "tuning.h"
+
+namespace tbtadm
+{
+class Directory;
+
+/**
+ * @brief Handles XDomain (host-to-host) connections
+ *
+ * Applies the service policy on the services an XDomain peer advertises:
+ * the driver module of an allowed service is loaded if it isn't already,
+ * and a denied service is unbound from its driver. The driver may be bound
+ * already (e.g. loaded for another peer) or only later (e.g. loaded by its
+ * modalias after the service was handled), so the bind events of the
+ * services are handled too.
+ *
+ * Checking /sys/module first saves the modprobe spawn on every reconnection.
+ */
+class XDomainHandler
+{
+public:
+    /**
+     * @param policy    the service policy to apply
+     * @param out       where the actions taken are reported
+     * @param sysfs     the sysfs mount point
+     */
+    XDomainHandler(const ServicePolicy& policy,
+                   std::ostream& out,
+                   const boost::filesystem::path& sysfs = "/sys");
+
+    /// Handles a new XDomain peer, given by its devpath (relative to sysfs)
+    void peerAdded(const std::string& devpath);
+
+    /// Handles a single service (the peer's services may appear after it)
+    void serviceAdded(const std::string& devpath);
+
+    /// Unbinds the driver just bound to the given service, if it's denied
+    void serviceBound(const std::string& devpath);
+
+    /**
+     * @brief Tunes the networking interfaces of a peer
+     *
+     * @param devpath   devpath of the interface, or of the peer for tuning all
+     *                  its interfaces
+     * @param profiles  the tuning profiles to choose from, by peer
+     * @param tuner     applies the settings
+     */
+    void tune(const std::string& devpath,
+              const TuningProfiles& profiles,
+              NetTuner& tuner);
+
+private:
+    Peer readPeer(const boost::filesystem::path& path) const;
+    void handleService(const Peer& peer,
+                       const Directory& service,
+                       const std::string& name);
+
+    /// Unbinds a denied service from its driver, if it has one
+    void deny(const Peer& peer,
+              const Directory& service,
+              const std::string& name,
+              const std::string& key);
+
+    /// Logs and prints the action taken for a service
+    void report(int priority,
+                const Peer& peer,
+                const std::string& name,
+                const std::string& key,
+                const std::string& message);
+
+    bool moduleLoaded(const std::string& module) const;
+    void loadModule(const std::string& module);
+
+    const ServicePolicy& m_policy;
+    std::ostream& m_out;
+    const boost::filesystem::path m_sysfs;
+};
+} // namespace tbtadm
@@ -11,3 +11,4 @@ rm -rf build && mkdir build
 cd build && cmake .. && cmake --build .
 
 LC_ALL=C.UTF-8 make check
+LC_ALL=C.UTF-8 make stress
@@ -0,0 +1,320 @@
+#!/usr/bin/python3
+#
+# thunderbolt-tools hotplug churn stress test: devices and whole domains are
+# connected and disconnected at random on the mock tree of the integration
+# tests while tbtadm and tbtacl run against it.
+#
+# Copyright © 2017 Intel Corp
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# Usage (from the build directory):
+#       python3 tests/stress-hotplug-mock.py
+#
+# Environment:
+#       TBT_STRESS_SECONDS  how long to run (default: 10)
+#       TBT_STRESS_SEED     seed of the churn, to reproduce a run
+#
+# Fails if a command crashes, hangs or fails for any reason other than a
+# device disconnected under its feet, or if an ACL entry is left half-written.
+
+import contextlib
+import importlib.util
+import io
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import threading
+import time
+
+# The mock tree and the configuration of the integration tests; exits (as
+# skipped) if umockdev isn't available
+spec = importlib.util.spec_from_file_location(
+    "mock", os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         "test-integration-mock.py"))
+mock = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(mock)
+
+DURATION = float(os.environ.get("TBT_STRESS_SECONDS", "10"))
+SEED = int(os.environ.get("TBT_STRESS_SEED", int(time.time())))
+TIMEOUT = 30
+
+# A device is added behind a free port of a random device up to that depth
+MAX_DEPTH = 3
+MAX_DEVICES = 12
+PORTS = range(1, 5)
+
+# Domain index -> security level; the keys of SL2 devices must be in the ACL
+SECURITY = {0: mock.TbDomain.SECURITY_SECURE, 1: mock.TbDomain.SECURITY_USER}
+VENDORS = [mock.VENDOR, "Other Vendor"]
+
+# Error of a run that failed only because a device or a domain was gone
+DISCONNECTED = re.compile(r"was (disconnected|removed)$")
+
+# Hotplug churn on the mock tree; runs in the main thread as umockdev isn't
+# meant to be used from several threads
+class Churn:
+    def __init__(self, bed, rng):
+        self.bed = bed
+        self.rng = rng
+        self.domains = {}
+        self.lock = threading.Lock()
+        self.devpaths = []  # of the connected devices, for tbtacl
+        self.uuids = {}     # of every device ever connected -> security
+        self.stats = dict.fromkeys(["connected", "disconnected",
+                                    "domains added", "domains removed"], 0)
+
+    def _devices(self):
+        return [d for tree in self.domains.values() for d in tree.devices]
+
+    def _update(self):
+        sysdir = self.bed.get_sys_dir()
+        with self.lock:
+            self.devpaths = [d.syspath[len(sysdir):] for d in self._devices()
+                             if not isinstance(d, mock.TbHost)]
+
+    def add_domain(self, index):
+        tree = mock.TbDomain(security=SECURITY[index], index=index,
+                             host=mock.TbHost([], index=index))
+        tree.connect_tree(self.bed)
+        self.domains[index] = tree
+        self.stats["domains added"] += 1
+
+    def remove_domain(self, index):
+        self.domains.pop(index).disconnect(self.bed)
+        self.stats["domains removed"] += 1
+
+    def connect(self):
+        tree = self.domains[self.rng.choice(sorted(self.domains))]
+        parents = [d for d in tree.devices
+                   if len(d.name.split('-')[1]) < MAX_DEPTH]
+        parent = self.rng.choice(parents)
+        used = {c.name for c in parent.children}
+        index, route = parent.name.split('-')
+        prefix = '%s-' % index
+        suffix = '' if isinstance(parent, mock.TbHost) else route
+        free = [prefix + str(port) + suffix for port in PORTS
+                if prefix + str(port) + suffix not in used]
+        if not free:
+            return
+        device = mock.TbDevice(self.rng.choice(free),
+                               vendor=self.rng.choice(VENDORS))
+        parent.children.append(parent._adopt(device))
+        device.connect(self.bed)
+        self.uuids[device.unique_id] = tree.security
+        self.stats["connected"] += 1
+
+    def disconnect(self):
+        devices = [d for d in self._devices()
+                   if not isinstance(d, mock.TbHost)]
+        device = self.rng.choice(devices)
+        device.disconnect(self.bed)
+        device.parent.children.remove(device)
+        self.stats["disconnected"] += 1
+
+    def step(self):
+        devices = len(self._devices()) - len(self.domains)
+        choice = self.rng.random()
+        # Device connection and removal print their syspath
+        with contextlib.redirect_stdout(io.StringIO()):
+            if choice < 0.05 or not self.domains:
+                missing = [i for i in SECURITY if i not in self.domains]
+                if missing:
+                    self.add_domain(self.rng.choice(missing))
+                else:
+                    self.remove_domain(self.rng.choice(sorted(self.domains)))
+            elif choice < 0.55 and devices < MAX_DEVICES:
+                self.connect()
+            elif devices:
+                self.disconnect()
+        self._update()
+
+    def random_devpath(self, rng):
+        with self.lock:
+            return rng.choice(self.devpaths) if self.devpaths else None
+
+    def stop(self):
+        with contextlib.redirect_stdout(io.StringIO()):
+            for index in sorted(self.domains):
+                self.remove_domain(index)
+
+# A command run over and over until the deadline, with the latency and the
+# outcome of every run
+class Worker(threading.Thread):
+    OUTCOMES = ["ok", "disconnected", "failed", "crashed", "hung"]
+
+    def __init__(self, name, command, deadline):
+        super(Worker, self).__init__(name=name)
+        self.command = command
+        self.deadline = deadline
+        self.latencies = []
+        self.outcomes = dict.fromkeys(self.OUTCOMES, 0)
+        self.samples = []
+
+    def run(self):
+        while time.monotonic() < self.deadline:
+            args = self.command()
+            if not args:
+                time.sleep(0.01)
+                continue
+            start = time.monotonic()
+            try:
+                proc = subprocess.run(args, stdout=subprocess.PIPE,
+                                      stderr=subprocess.STDOUT,
+                                      timeout=TIMEOUT)
+                outcome = self.classify(proc)
+            except subprocess.TimeoutExpired:
+                outcome = "hung"
+                proc = None
+            self.latencies.append(time.monotonic() - start)
+            self.outcomes[outcome] += 1
+            if outcome not in ["ok", "disconnected"] and len(self.samples) < 3:
+                output = proc.stdout.decode("utf-8", "replace") if proc else ""
+                self.samples.append("%s: %s\n%s" % (outcome, " ".join(args),
+                                                    output))
+
+    @staticmethod
+    def classify(proc):
+        if proc.returncode < 0:
+            return "crashed"
+        if proc.returncode == 0:
+            return "ok"
+        # The error is the last line
+        lines = proc.stdout.decode("utf-8", "replace").strip().splitlines()
+        if lines and DISCONNECTED.search(lines[-1]):
+            return "disconnected"
+        return "failed"
+
+    def problems(self):
+        return sum(self.outcomes[o] for o in ["failed", "crashed", "hung"])
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+def reset_state():
+    for path in [mock.ACL, mock.ACL + ".d"]:
+        if os.path.islink(path) or os.path.isfile(path):
+            os.remove(path)
+        elif os.path.isdir(path):
+            shutil.rmtree(path)
+    for path in [mock.BOOT_PLAN, mock.POLICY]:
+        if os.path.exists(path):
+            os.remove(path)
+    if os.path.isdir(mock.TBTACL_RUN):
+        shutil.rmtree(mock.TBTACL_RUN)
+
+# Every ACL entry must be complete: its names, and its key if the device was
+# approved in SL2
+def check_acl(uuids):
+    errors = []
+    if not os.path.isdir(mock.ACL):
+        return errors
+    for uuid in os.listdir(mock.ACL):
+        if uuid.startswith('.'):
+            continue
+        entry = os.path.join(mock.ACL, uuid)
+        for name in ["vendor_name", "device_name"]:
+            path = os.path.join(entry, name)
+            if not os.path.isfile(path) or not open(path).read().strip():
+                errors.append("%s: no %s" % (uuid, name))
+        if uuids.get(uuid) == mock.TbDomain.SECURITY_SECURE:
+            path = os.path.join(entry, "key")
+            key = open(path).read() if os.path.isfile(path) else ""
+            if not re.fullmatch(r"[0-9a-f]{64}", key):
+                errors.append("%s: bad key %r" % (uuid, key))
+    return errors
+
+def report(workers, churn, elapsed):
+    print("\n%-12s %6s %8s %8s %8s %8s %8s  %s" % (
+        "command", "runs", "ops/s", "p50 ms", "p95 ms", "p99 ms", "max ms",
+        "outcomes"))
+    for worker in workers:
+        latencies = worker.latencies or [0]
+        print("%-12s %6d %8.1f %8.1f %8.1f %8.1f %8.1f  %s" % (
+            worker.name, len(worker.latencies),
+            len(worker.latencies) / elapsed,
+            percentile(latencies, 0.5) * 1000,
+            percentile(latencies, 0.95) * 1000,
+            percentile(latencies, 0.99) * 1000,
+            max(latencies) * 1000,
+            " ".join("%s=%d" % (o, n) for o, n in worker.outcomes.items()
+                     if n)))
+    print("\nchurn: " + ", ".join("%s %d" % (k, v)
+                                   for k, v in churn.stats.items()))
+
+def main():
+    print("seed %d, %g seconds" % (SEED, DURATION))
+    rng = random.Random(SEED)
+    reset_state()
+
+    bed = mock.UMockdev.Testbed.new()
+    churn = Churn(bed, rng)
+    churn.step()
+
+    deadline = time.monotonic() + DURATION
+    tbtacl_rng = random.Random(SEED + 1)
+    approve_rng = random.Random(SEED + 2)
+
+    def tbtacl():
+        devpath = churn.random_devpath(tbtacl_rng)
+        return devpath and [mock.TBTACL, "add", devpath]
+
+    def approve():
+        devpath = churn.random_devpath(approve_rng)
+        return devpath and [mock.TBTADM, "approve", os.path.basename(devpath)]
+
+    workers = [
+        Worker("approve-all", lambda: [mock.TBTADM, "approve-all"], deadline),
+        Worker("approve-all", lambda: [mock.TBTADM, "approve-all"], deadline),
+        Worker("approve", approve, deadline),
+        Worker("acl", lambda: [mock.TBTADM, "acl"], deadline),
+        Worker("topology", lambda: [mock.TBTADM, "topology"], deadline),
+        Worker("devices", lambda: [mock.TBTADM, "devices"], deadline),
+        Worker("tbtacl", tbtacl, deadline),
+    ]
+
+    start = time.monotonic()
+    for worker in workers:
+        worker.start()
+    while time.monotonic() < deadline:
+        churn.step()
+        time.sleep(rng.uniform(0.002, 0.03))
+    for worker in workers:
+        worker.join()
+    elapsed = time.monotonic() - start
+    churn.stop()
+
+    report(workers, churn, elapsed)
+
+    problems = sum(worker.problems() for worker in workers)
+    for worker in workers:
+        for sample in worker.samples:
+            print("\n" + sample)
+    errors = check_acl(churn.uuids)
+    for error in errors:
+        print("half-written ACL entry " + error)
+
+    if problems or errors:
+        print("\nFAILED (seed %d)" % SEED)
+        return 1
+    print("\nOK")
+    return 0
+
+if __name__ == '__main__':
+    # run ourselves under umockdev
+    if 'umockdev' not in os.environ.get('LD_PRELOAD', ''):
+        os.execvp('umockdev-wrapper', ['umockdev-wrapper'] + sys.argv)
+
+    sys.exit(main())
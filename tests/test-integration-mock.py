@@ -21,6 +21,8 @@
 #       Andrei Emeltchenko <andrei.emeltchenko@intel.com>
 
 import binascii
+import fcntl
+import json
 import os
 import shutil
 import sys
@@ -28,6 +30,8 @@ import subprocess
 import unittest
 import uuid
 import tempfile
+import threading
+import time
 
 import re
 
@@ -51,7 +55,16 @@ except ImportError as e:
 
 # Configuration
 TBTADM = "tbtadm/tbtadm"
+TBTXDOMAIN = "tbtxdomain/tbtxdomain"
+TBTACL = "tbtacl/tbtacl"
 ACL = "/var/lib/thunderbolt/acl"
+BOOT_PLAN = "/var/lib/thunderbolt/boot.plan"
+METRICS_STATE = "/var/lib/thunderbolt/metrics.state"
+METRICS = "/var/lib/thunderbolt/thunderbolt.prom"
+METRICS_GAUGES = "/var/lib/thunderbolt/thunderbolt_devices.prom"
+DEVICE_CACHE = "/var/lib/thunderbolt/devices.cache"
+TBTACL_RUN = "/run/thunderbolt/tbtacl"
+POLICY = "@TBT_POLICY@"
 VENDOR = "Mock Vendor"
 DEVICE_NAME = "Thunderbolt Cable"
 
@@ -172,6 +185,40 @@ class TbDevice(Device):
     def is_unauthorized(d):
         return isinstance(d, TbDevice) and d.authorized == 0
 
+# Thunderbolt XDomain (host-to-host) connection
+class TbXDomain(Device):
+    subsystem = "thunderbolt"
+    devtype = "thunderbolt_xdomain"
+
+    udev_attrs = ['device_name',
+                  'unique_id',
+                  'vendor_name']
+
+    udev_props = ['DEVTYPE']
+
+    def __init__(self, name, uid=None, vendor=None, children=None):
+        super(TbXDomain, self).__init__(name, children or [])
+        self.unique_id = uid or str(uuid.uuid4())
+        self.device_name = 'Mock Host'
+        self.vendor_name = vendor or 'Mock Device'
+
+# Service advertised by an XDomain peer
+class TbService(Device):
+    subsystem = "thunderbolt"
+    devtype = "thunderbolt_service"
+
+    udev_attrs = ['key', 'prtcid', 'prtcvers', 'prtcrevs', 'prtcstns']
+
+    udev_props = ['DEVTYPE']
+
+    def __init__(self, name, key):
+        super(TbService, self).__init__(name, [])
+        self.key = key
+        self.prtcid = 1
+        self.prtcvers = 1
+        self.prtcrevs = 1
+        self.prtcstns = 0
+
 class TbHost(TbDevice):
     def __init__(self, children, index = 0):
         super(TbHost, self).__init__('%d-0' % index,
@@ -210,6 +257,95 @@ class TbDomain(Device):
     def domain(self):
         return self
 
+# Tree recorded by "tbtadm capture", recreated as a mock tree
+class CapturedTree:
+    MAGIC = "# tbtadm capture v1\n"
+
+    def __init__(self, path):
+        self.devices = []    # device paths, parents first
+        self.attrs = {}      # device path -> flat [name, value, ...]
+        self.props = {}      # device path -> flat [key, value, ...]
+        self.acl = []        # (uuid, mtime)
+        self.acl_files = []  # (uuid/name, value)
+        self.events = []     # (milliseconds, action, path)
+        self.syspaths = {}
+        with open(path) as f:
+            assert f.readline() == self.MAGIC
+            for line in f:
+                self._parse([self._unescape(field) for field
+                             in line.rstrip('\n').split('\t')])
+
+    @staticmethod
+    def _unescape(value):
+        return re.sub(r'\\(.)',
+                      lambda m: {'t': '\t', 'n': '\n'}.get(m.group(1),
+                                                           m.group(1)),
+                      value)
+
+    @staticmethod
+    def _is_device(path):
+        name = os.path.basename(path)
+        return name.startswith('domain') or name[1:2] == '-'
+
+    # The device an attribute (or a subdirectory like power) belongs to
+    def _owner(self, path):
+        while not self._is_device(path):
+            path = os.path.dirname(path)
+        return path
+
+    def _parse(self, fields):
+        kind = fields[0]
+        if kind == 'dir' and self._is_device(fields[1]):
+            self.devices.append(fields[1])
+            self.attrs[fields[1]] = []
+            self.props[fields[1]] = []
+        elif kind == 'attr':
+            owner = self._owner(os.path.dirname(fields[1]))
+            name = os.path.relpath(fields[1], owner)
+            if name == 'uevent':
+                for prop in fields[2].splitlines():
+                    self.props[owner] += prop.split('=', 1)
+            else:
+                self.attrs[owner] += [name, fields[2]]
+        elif kind == 'aclentry':
+            self.acl.append((fields[1], int(fields[2])))
+        elif kind == 'aclfile':
+            self.acl_files.append((fields[1], fields[2]))
+        elif kind == 'event':
+            self.events.append((int(fields[1]), fields[2], fields[3]))
+
+    def connect(self, bed):
+        for path in self.devices:
+            parent = self.syspaths.get(os.path.dirname(path))
+            self.syspaths[path] = bed.add_device('thunderbolt',
+                                                 os.path.basename(path),
+                                                 parent,
+                                                 self.attrs[path],
+                                                 self.props[path])
+
+    def disconnect(self, bed):
+        for path in reversed(self.devices):
+            bed.remove_device(self.syspaths.pop(path))
+
+    # Recreates the ACL entries; keys aren't captured, so they're left empty
+    def restore_acl(self, acl):
+        for uuid, _ in self.acl:
+            os.makedirs(os.path.join(acl, uuid), exist_ok=True)
+        for name, value in self.acl_files:
+            with open(os.path.join(acl, name), 'w') as f:
+                f.write(value)
+        for uuid, mtime in self.acl:
+            os.utime(os.path.join(acl, uuid), (mtime, mtime))
+
+    # Re-emits the captured uevents with their original timing
+    def replay_events(self, bed, speed=1.0):
+        start = time.monotonic()
+        for milliseconds, action, path in self.events:
+            delay = start + milliseconds / 1000.0 / speed - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            bed.uevent(self.syspaths[path], action)
+
 # Test Suite
 class thunderbolt_test(unittest.TestCase):
     @classmethod
@@ -222,11 +358,24 @@ class thunderbolt_test(unittest.TestCase):
                 os.remove(os.path.join(root, name))
             for name in dirs:
                 os.rmdir(os.path.join(root, name))
+        for path in [BOOT_PLAN, METRICS_STATE, METRICS, METRICS_GAUGES, POLICY,
+                     DEVICE_CACHE]:
+            if os.path.exists(path):
+                os.remove(path)
+        if os.path.isdir(TBTACL_RUN):
+            for name in os.listdir(TBTACL_RUN):
+                os.remove(os.path.join(TBTACL_RUN, name))
 
     def tearDown(self):
         print(self)
         log.debug("Tear down test case")
 
+    # Makes tbtacl take the next events as a new connection of the devices
+    def forget_connections(self):
+        for name in os.listdir(TBTACL_RUN):
+            if name.endswith(".done"):
+                os.remove(os.path.join(TBTACL_RUN, name))
+
     # mock tree stuff
     def default_mock_tree(self):
         # default mock tree
@@ -540,6 +689,1198 @@ class thunderbolt_test(unittest.TestCase):
         # disconnect all devices
         tree.disconnect(self.testbed)
 
+    # Build a minimal NVM image passing the header validation
+    def nvm_image(self, size = 64 * 1024, device_id = 0x15d3):
+        image = bytearray(size)
+        image[0:3] = (0x1000).to_bytes(3, 'little')
+        image[0x1000:0x1002] = (0x800).to_bytes(2, 'little')
+        image[0x1005:0x1007] = device_id.to_bytes(2, 'little')
+        return bytes(image)
+
+    # Test NVM upgrade of the host controller
+    def test_tbtadm_nvm_upgrade(self):
+        # connect all device
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        host = tree.children[0]
+
+        self.testbed.set_attribute(host.syspath, 'nvm_version', '18.0')
+        self.testbed.set_attribute(host.syspath, 'nvm_authenticate', '0')
+        self.testbed.set_attribute(host.syspath, 'device', '0x15d3')
+        self.testbed.set_attribute(host.syspath, 'nvm_non_active0/nvmem', '')
+        nvmem = os.path.join(host.syspath, 'nvm_non_active0', 'nvmem')
+        authenticate = os.path.join(host.syspath, 'nvm_authenticate')
+
+        # Invalid image is rejected before anything is written
+        with tempfile.NamedTemporaryFile() as image:
+            image.write(bytes(1000))
+            image.flush()
+            result = subprocess.run(
+                shlex.split("%s nvm upgrade 0-0 %s" % (TBTADM, image.name)),
+                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            self.assertNotEqual(result.returncode, 0)
+            self.assertTrue(b'size is out of range' in result.stderr)
+            self.assertEqual(os.path.getsize(nvmem), 0)
+
+        # ...and so is an image for another device
+        with tempfile.NamedTemporaryFile() as image:
+            image.write(self.nvm_image(device_id=0x15d4))
+            image.flush()
+            result = subprocess.run(
+                shlex.split("%s nvm upgrade 0-0 %s" % (TBTADM, image.name)),
+                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            self.assertNotEqual(result.returncode, 0)
+            self.assertTrue(b'is for device ID 0x15d4, not for 0x15d3'
+                            in result.stderr)
+            self.assertEqual(os.path.getsize(nvmem), 0)
+
+        content = self.nvm_image()
+        with tempfile.NamedTemporaryFile() as image:
+            image.write(content)
+            image.flush()
+            proc = subprocess.Popen(
+                shlex.split("%s nvm upgrade 0-0 %s" % (TBTADM, image.name)),
+                stdout=subprocess.PIPE)
+
+            # Wait for the authentication request and simulate the restart
+            # with the new NVM
+            for i in range(100):
+                with open(authenticate) as f:
+                    if f.read().strip() == '1':
+                        break
+                time.sleep(0.1)
+            self.testbed.set_attribute(host.syspath, 'nvm_authenticate', '0')
+            self.testbed.set_attribute(host.syspath, 'nvm_version', '20.0')
+
+            output, _ = proc.communicate(timeout=30)
+            log.debug(output)
+            self.assertEqual(proc.returncode, 0)
+            self.assertTrue(b'Wrote %d bytes' % len(content) in output)
+            self.assertTrue(b'NVM authenticated, version: 20.0' in output)
+
+        with open(nvmem, 'rb') as f:
+            self.assertEqual(f.read(), content)
+
+        # A failed authentication is reported right away, with no restart
+        with tempfile.NamedTemporaryFile() as image:
+            image.write(content)
+            image.flush()
+            proc = subprocess.Popen(
+                shlex.split("%s nvm upgrade 0-0 %s" % (TBTADM, image.name)),
+                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            for i in range(100):
+                with open(authenticate) as f:
+                    if f.read().strip() == '1':
+                        break
+                time.sleep(0.1)
+            self.testbed.set_attribute(host.syspath, 'nvm_authenticate',
+                                       '0x4001')
+
+            _, error = proc.communicate(timeout=10)
+            log.debug(error)
+            self.assertNotEqual(proc.returncode, 0)
+            self.assertTrue(b'failed with status 0x4001' in error)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Run tbtxdomain for the given device with the given policy
+    def run_tbtxdomain(self, policy, action, device, options = []):
+        with tempfile.NamedTemporaryFile(mode='w') as f:
+            f.write(policy)
+            f.flush()
+            devpath = device.syspath[len(self.testbed.get_sys_dir()):]
+            return subprocess.check_output(
+                [TBTXDOMAIN, '--policy', f.name] + options + [action, devpath]
+                ).decode("utf-8")
+
+    # Test XDomain service policy
+    def test_tbtxdomain_policy(self):
+        peer = TbXDomain('0-1', vendor = VENDOR,
+                         children = [TbService('0-1.1', 'network'),
+                                     TbService('0-1.2', 'other')])
+        tree = TbDomain(host = TbHost([peer]))
+        tree.connect_tree(self.testbed)
+
+        # Driver already loaded, no modprobe needed
+        os.makedirs(os.path.join(self.testbed.get_sys_dir(),
+                                 'module', 'thunderbolt_net'))
+
+        output = self.run_tbtxdomain("", 'add', peer)
+        log.debug(output)
+        self.assertTrue('0-1.1: network service of %s (%s): allowed, '
+                        'thunderbolt-net already loaded'
+                        % (peer.unique_id, VENDOR) in output)
+        self.assertTrue('0-1.2: other service' in output)
+        self.assertTrue('allowed, no known driver' in output)
+
+        # UUID rule beats the vendor rule
+        policy = ('vendor:%s * deny\n'
+                  'uuid:%s network allow\n' % (VENDOR, peer.unique_id))
+        output = self.run_tbtxdomain(policy, 'add', peer)
+        log.debug(output)
+        self.assertTrue('0-1.1: network service of %s (%s): allowed'
+                        % (peer.unique_id, VENDOR) in output)
+        self.assertTrue('0-1.2: other service of %s (%s): denied by policy'
+                        % (peer.unique_id, VENDOR) in output)
+
+        output = self.run_tbtxdomain('* network deny\n', 'service',
+                                     peer.children[0])
+        log.debug(output)
+        self.assertTrue('0-1.1: network service' in output)
+        self.assertTrue('denied by policy' in output)
+        self.assertFalse('0-1.2' in output)
+
+        # a driver binding after the service was handled is unbound again
+        service = peer.children[0]
+        self.testbed.set_attribute(service.syspath, 'driver/unbind', '')
+        output = self.run_tbtxdomain('* network allow\n', 'bind', service)
+        self.assertEqual(output.strip(), '')
+        output = self.run_tbtxdomain('* network deny\n', 'bind', service)
+        log.debug(output)
+        self.assertTrue('0-1.1: network service of %s (%s): denied by policy, '
+                        'unbound from its driver'
+                        % (peer.unique_id, VENDOR) in output)
+        with open(os.path.join(service.syspath, 'driver/unbind')) as f:
+            self.assertEqual(f.read(), '0-1.1')
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test tuning of the networking interface of an XDomain peer
+    def test_tbtxdomain_tune(self):
+        service = TbService('0-1.1', 'network')
+        peer = TbXDomain('0-1', vendor = VENDOR, children = [service])
+        tree = TbDomain(host = TbHost([peer]))
+        tree.connect_tree(self.testbed)
+
+        net = 'net/thunderbolt0/'
+        self.testbed.set_attribute(service.syspath, net + 'mtu', '1500')
+        self.testbed.set_attribute(service.syspath, net + 'tx_queue_len', '1000')
+        self.testbed.set_attribute(service.syspath,
+                                   net + 'queues/rx-0/rps_cpus', '0')
+        self.testbed.set_attribute(service.syspath,
+                                   net + 'queues/tx-0/xps_cpus', '0')
+        interface = os.path.join(service.syspath, 'net', 'thunderbolt0')
+
+        with tempfile.NamedTemporaryFile(mode='w') as tuning:
+            tuning.write('[*]\n'
+                         'mtu = 9000\n'
+                         'tx_queue_len = 2000\n'
+                         '[uuid:%s]\n'
+                         'mtu = 65522\n'
+                         'rps_cpus = f\n' % peer.unique_id)
+            tuning.flush()
+
+            # Dry-run only reports
+            output = self.run_tbtxdomain('', 'tune', peer,
+                                         ['--tuning', tuning.name, '--dry-run'])
+            log.debug(output)
+            self.assertTrue('Would write 65522 to' in output)
+            self.assertTrue('Would write 2000 to' in output)
+            self.assertTrue('queues/rx-0/rps_cpus' in output)
+            self.assertFalse('xps_cpus' in output)
+            with open(os.path.join(interface, 'mtu')) as f:
+                self.assertEqual(f.read().strip(), '1500')
+
+            output = self.run_tbtxdomain('', 'tune', peer,
+                                         ['--tuning', tuning.name])
+            log.debug(output)
+            with open(os.path.join(interface, 'mtu')) as f:
+                self.assertEqual(f.read().strip(), '65522')
+            with open(os.path.join(interface, 'queues/rx-0/rps_cpus')) as f:
+                self.assertEqual(f.read().strip(), 'f')
+
+        # The IRQ affinity is host-wide, it can't be set in a profile
+        with tempfile.NamedTemporaryFile(mode='w') as tuning:
+            tuning.write('[uuid:%s]\n'
+                         'irq_affinity = 2\n' % peer.unique_id)
+            tuning.flush()
+            with self.assertRaises(subprocess.CalledProcessError):
+                self.run_tbtxdomain('', 'tune', peer,
+                                    ['--tuning', tuning.name, '--dry-run'])
+
+        with tempfile.NamedTemporaryFile(mode='w') as tuning:
+            tuning.write('irq_affinity = 2\n'
+                         '[*]\n'
+                         'mtu = 9000\n')
+            tuning.flush()
+            output = self.run_tbtxdomain('', 'tune', peer,
+                                         ['--tuning', tuning.name, '--dry-run'])
+            log.debug(output)
+            self.assertTrue('Would write 9000 to' in output)
+            self.assertTrue('irq_affinity' in output)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test link analysis of a device running on a single lane
+    def test_tbtadm_links(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        host = tree.children[0]
+        device = host.children[0]
+
+        self.testbed.set_attribute(host.syspath, 'generation', '3')
+        for attr, value in [('generation', '3'),
+                            ('rx_speed', '20.0 Gb/s'), ('rx_lanes', '1'),
+                            ('tx_speed', '20.0 Gb/s'), ('tx_lanes', '1')]:
+            self.testbed.set_attribute(device.syspath, attr, value)
+
+        output = subprocess.check_output(
+            shlex.split("%s links" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue('RX 20 Gb/s x 1, TX 20 Gb/s x 1 (Gen 3)' in output)
+        self.assertTrue('path RX 20 Gb/s, TX 20 Gb/s (limited by 0-1)' in output)
+        self.assertTrue('bottleneck: single lane, both ends support 2' in output)
+
+        self.assertEqual(self.extract_property(self.get_info(), "Bottleneck"),
+                         'single lane, both ends support 2')
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test approve --wait-ready of a device with no PCIe tunnel
+    def test_tbtadm_approve_wait_ready(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+
+        output = subprocess.check_output(
+            shlex.split("%s approve --once --wait-ready --timeout 1 0-1"
+                        % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue("Authorized" in output)
+        self.assertTrue("Authorize write: " in output)
+        self.assertTrue("No PCI devices appeared in 1.00 s" in output)
+        self.assertEqual(self.get_authorized(), "Yes")
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test approve --wait-ready behind an integrated NHI, with a PCI function
+    # that never gets a driver
+    def test_tbtadm_approve_wait_ready_pci(self):
+        rootbus = os.path.join(self.testbed.get_sys_dir(), 'devices',
+                               'pci0000:00')
+        nhi = os.path.join(rootbus, '0000:00:0d.2')
+        os.makedirs(nhi)
+        class NHI:
+            syspath = nhi
+        device = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR)
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device]))
+        tree.parent = NHI()
+        tree.connect_tree(self.testbed)
+
+        proc = subprocess.Popen([TBTADM, 'approve', '--once', '--wait-ready',
+                                 '--timeout', '20', '0-1'],
+                                stdout=subprocess.PIPE)
+        deadline = time.time() + 10
+        while self.get_authorized() != "Yes" and time.time() < deadline:
+            time.sleep(0.05)
+
+        # The tunnel comes out of a root port next to the NHI
+        port = os.path.join(rootbus, '0000:00:07.0')
+        function = os.path.join(port, '0000:01:00.0')
+        os.makedirs(function)
+        for path, pci_class in [(port, '0x060400'), (function, '0x0c0330')]:
+            with open(os.path.join(path, 'class'), 'w') as f:
+                f.write(pci_class + '\n')
+
+        output = proc.communicate(timeout=30)[0].decode("utf-8")
+        log.debug(output)
+        self.assertEqual(proc.returncode, 0)
+        self.assertTrue("first PCI device: 0000:00:07.0" in output)
+        self.assertTrue("No driver bound to: 0000:01:00.0" in output)
+        self.assertTrue("Ready after" in output)
+
+        # Only a plain number is a timeout
+        for timeout in ['-1', 'x']:
+            output = subprocess.run([TBTADM, 'approve', '--wait-ready',
+                                     '--timeout', timeout, '0-1'],
+                                    stdout=subprocess.PIPE,
+                                    stderr=subprocess.STDOUT).stdout
+            self.assertTrue(b"Usage:" in output)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+        shutil.rmtree(rootbus)
+
+    # Write a mock debugfs dump of an adapter with the given type and
+    # DisplayPort capabilities, with an enabled path if active
+    def mock_adapter(self, route, port, adapter_type, dp_cap = 0,
+                     active = True):
+        path = os.path.join(self.testbed.get_sys_dir(), 'kernel', 'debug',
+                            'thunderbolt', route, 'port%d' % port)
+        os.makedirs(path, exist_ok = True)
+        with open(os.path.join(path, 'regs'), 'w') as f:
+            f.write('# offset relative_offset cap_id vs_cap_id value\n')
+            f.write('0x0002    2 0x00 0x00 0x%08x\n' % adapter_type)
+            f.write('0x0014    4 0x04 0x00 0x%08x\n' % dp_cap)
+        with open(os.path.join(path, 'path'), 'w') as f:
+            f.write('# offset relative_offset in_hop_index value\n')
+            f.write('0x0010    0 0x08 0x%08x\n' % (0x80000000 if active else 0))
+            f.write('0x0011    1 0x08 0x00000000\n')
+
+    # Test tunnel bandwidth report
+    def test_tbtadm_bandwidth(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        device = tree.children[0].children[0]
+        for attr, value in [('rx_speed', '20.0 Gb/s'), ('rx_lanes', '2'),
+                            ('tx_speed', '20.0 Gb/s'), ('tx_lanes', '2')]:
+            self.testbed.set_attribute(device.syspath, attr, value)
+
+        # HBR2 x 4 DisplayPort and PCIe tunnels, inactive DisplayPort adapter
+        self.mock_adapter('0-1', 9, 0x100102)
+        self.mock_adapter('0-1', 11, 0x0e0102, dp_cap = 0x2200)
+        self.mock_adapter('0-1', 12, 0x0e0102, dp_cap = 0x2200, active = False)
+
+        output = subprocess.check_output(
+            shlex.split("%s bandwidth --json" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        hop = json.loads(output)['hops'][0]
+        self.assertEqual(hop['route'], '0-1')
+        self.assertEqual(hop['link_mbps'], 40000)
+        self.assertEqual(hop['dp_mbps'], 17280)
+        self.assertEqual(hop['dp_tunnels'], 1)
+        self.assertEqual(hop['pcie_tunnels'], 1)
+        self.assertEqual(hop['available_mbps'], 22720)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test tbtacl auto-approval and the boot plan it keeps
+    def test_tbtacl_boot_plan(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+        device = tree.children[0].children[0]
+        devpath = device.syspath[len(self.testbed.get_sys_dir()):]
+
+        # Not in ACL yet
+        subprocess.call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "No")
+        self.assertFalse(os.path.exists(BOOT_PLAN))
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+        with open(BOOT_PLAN) as f:
+            plan = f.read()
+        log.debug(plan)
+        self.assertTrue('0-1\t%s\t1\t1\t' % device.unique_id in plan)
+
+        # Next boot: the device is authorized based on the plan
+        self.forget_connections()
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+        with open(METRICS) as f:
+            self.assertTrue('outcome="authorized_by_plan"} 1' in f.read())
+        with open(BOOT_PLAN) as f:
+            self.assertEqual(f.read(), plan)
+
+        # Any ACL update invalidates the plan
+        subprocess.check_output(shlex.split("%s remove %s"
+                                            % (TBTADM, device.unique_id)))
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        self.forget_connections()
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+        with open(METRICS) as f:
+            self.assertTrue('outcome="authorized_by_plan"} 1' in f.read())
+
+        # Another device at the same route isn't authorized by the plan
+        self.forget_connections()
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        self.testbed.set_attribute(device.syspath, 'unique_id',
+                                   '00000000-0000-0000-0000-000000000000')
+        subprocess.call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "No")
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test mirroring of the ACL into the domain boot ACL
+    def test_tbtadm_boot_acl(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+        tree.testbed.set_attribute(tree.syspath, "boot_acl", ",,,")
+
+        uuid = self.get_uuid()
+        output = subprocess.check_output(
+            shlex.split("%s approve 0-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue('Added to ACL' in output)
+        self.assertTrue('Boot ACL of domain0 updated (1/4 slots used)'
+                        in output)
+        self.assertTrue(self.testbed.get_sysfs_attr(tree.syspath, "boot_acl")
+                        .startswith(uuid + ',,,'))
+
+        output = subprocess.check_output(
+            shlex.split("%s acl" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue('boot pre-approved' in output)
+
+        output = self.get_info()
+        self.assertTrue('Boot ACL: 4 slots' in output)
+        self.assertEqual(self.extract_property(output, "In boot ACL"), "Yes")
+
+        output = subprocess.check_output(
+            shlex.split("%s remove 0-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue('Boot ACL of domain0 updated (0/4 slots used)'
+                        in output)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test that ACL updates are published as new snapshots
+    def test_tbtadm_acl_snapshots(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+        uuid = self.get_uuid()
+
+        subprocess.check_output(shlex.split("%s add 0-1" % TBTADM))
+        self.assertTrue(os.path.islink(ACL))
+        added = os.path.realpath(ACL)
+        self.assertTrue(os.path.isdir(os.path.join(added, uuid)))
+
+        output = subprocess.check_output(shlex.split("%s remove 0-1" % TBTADM))
+        self.assertFalse(b'ACL entry doesn\'t exist' in output)
+        self.assertNotEqual(os.path.realpath(ACL), added)
+        self.assertFalse(os.path.isdir(os.path.join(ACL, uuid)))
+        # Readers still on the previous snapshot aren't disturbed
+        self.assertTrue(os.path.isdir(os.path.join(added, uuid)))
+
+        # Old snapshots are removed once replaced long enough ago, unless a
+        # reader holds them
+        subprocess.check_output(shlex.split("%s add 0-1" % TBTADM))
+        versions = os.path.dirname(added)
+        current = int(os.path.basename(os.path.realpath(ACL)))
+        snapshot = lambda version: os.path.join(versions, str(version))
+        self.assertEqual(snapshot(current - 2), added)
+        for version in [current - 1, current]:
+            os.utime(snapshot(version), (0, 0))
+        reader = os.open(added, os.O_RDONLY)
+        fcntl.flock(reader, fcntl.LOCK_SH)
+
+        # A batch makes a single update
+        commands = 'remove 0-1\nadd 0-1\nremove 0-1\n'
+        p = subprocess.run([TBTADM, '--batch'], input = commands.encode(),
+                           stdout=subprocess.PIPE)
+        os.close(reader)
+        log.debug(p.stdout.decode("utf-8"))
+        self.assertEqual(p.returncode, 0)
+        self.assertEqual(os.path.realpath(ACL), snapshot(current + 1))
+        self.assertFalse(os.path.isdir(os.path.join(ACL, uuid)))
+        self.assertTrue(os.path.isdir(added))
+        self.assertFalse(os.path.exists(snapshot(current - 1)))
+        self.assertTrue(os.path.isdir(snapshot(current)))
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test running many commands in a single tbtadm process
+    def test_tbtadm_batch(self):
+        device2 = TbDevice('0-301', device_name = DEVICE_NAME, vendor = VENDOR)
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           children = [device2])
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1]))
+        tree.connect_tree(self.testbed)
+
+        commands = ('# provisioning\n'
+                    'approve 0-1\n'
+                    'add 0-301\n'
+                    '\n'
+                    'remove 0-999\n'
+                    'devices\n')
+        p = subprocess.run([TBTADM, '--batch'], input = commands.encode(),
+                           stdout = subprocess.PIPE)
+        output = p.stdout.decode("utf-8")
+        log.debug(output)
+        self.assertNotEqual(p.returncode, 0)
+        self.assertTrue('Line 2: ok' in output)
+        self.assertTrue('Line 3: ok' in output)
+        self.assertTrue('Line 5: failed' in output)
+        self.assertTrue('Line 6: failed: unsupported batch command' in output)
+
+        self.assertEqual(self.get_authorized(), "Yes")
+        self.assertTrue(os.path.isdir(ACL + "/" + device1.unique_id))
+        self.assertTrue(os.path.isdir(ACL + "/" + device2.unique_id))
+
+        with tempfile.NamedTemporaryFile(mode='w') as f:
+            f.write('remove 0-1\nremove %s\n' % device2.unique_id)
+            f.flush()
+            output = subprocess.check_output(
+                [TBTADM, '--batch', f.name]).decode("utf-8")
+        log.debug(output)
+        self.assertTrue('Line 1: ok' in output)
+        self.assertTrue('Line 2: ok' in output)
+        self.assertFalse(os.path.isdir(ACL + "/" + device1.unique_id))
+        self.assertFalse(os.path.isdir(ACL + "/" + device2.unique_id))
+
+        # The commands see the changes of the previous ones, all of them
+        # making a single ACL update
+        version = lambda: int(os.path.basename(os.path.realpath(ACL)))
+        before = version()
+        commands = 'add 0-301\nremove 0-301\nremove 0-301\n'
+        output = subprocess.run([TBTADM, '--batch'], input = commands.encode(),
+                                stdout = subprocess.PIPE).stdout.decode("utf-8")
+        log.debug(output)
+        self.assertEqual(output.count("ACL entry doesn't exist"), 1)
+        self.assertEqual(version(), before + 1)
+        self.assertFalse(os.path.isdir(ACL + "/" + device2.unique_id))
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test the metrics exported for the Prometheus node_exporter
+    def test_tbtadm_metrics(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        with open(METRICS_GAUGES) as f:
+            gauges = f.read()
+        log.debug(gauges)
+        self.assertTrue('thunderbolt_domain_info{domain="0",'
+                        'security_level="user"} 1' in gauges)
+        self.assertTrue('thunderbolt_devices{authorized="1",domain="0",'
+                        'security_level="user"} 1' in gauges)
+        self.assertTrue('thunderbolt_acl_entries 1' in gauges)
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertFalse('thunderbolt_devices' in metrics)
+        self.assertTrue('thunderbolt_authorization_attempts_total'
+                        '{tool="tbtadm"} 1' in metrics)
+        self.assertTrue('thunderbolt_authorization_duration_seconds_count'
+                        '{tool="tbtadm"} 1' in metrics)
+
+        # Counters survive across runs, gauges follow the current state
+        subprocess.check_output(shlex.split("%s remove 0-1" % TBTADM))
+        self.testbed.set_attribute(tree.children[0].children[0].syspath,
+                                   'authorized', '0')
+        subprocess.check_output(shlex.split("%s approve --once 0-1" % TBTADM))
+        with open(METRICS_GAUGES) as f:
+            self.assertTrue('thunderbolt_acl_entries 0' in f.read())
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertTrue('thunderbolt_authorization_attempts_total'
+                        '{tool="tbtadm"} 2' in metrics)
+
+        # tbtacl exports the counters only, it leaves the gauges to tbtadm
+        device = tree.children[0].children[0]
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        os.remove(METRICS_GAUGES)
+        devpath = device.syspath[len(self.testbed.get_sys_dir()):]
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+        self.assertFalse(os.path.exists(METRICS_GAUGES))
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertTrue('thunderbolt_authorization_attempts_total'
+                        '{tool="tbtacl"} 1' in metrics)
+        self.assertTrue('thunderbolt_acl_events_total{action="add",'
+                        'outcome="authorized"} 1' in metrics)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test de-authorization, leaves first
+    def test_tbtadm_deauthorize(self):
+        device2 = TbDevice('0-301', device_name = DEVICE_NAME, vendor = VENDOR,
+                           authorized = 1)
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           authorized = 1, children = [device2])
+        device3 = TbDevice('0-3', device_name = DEVICE_NAME, vendor = VENDOR,
+                           authorized = 1)
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1, device3]))
+        tree.connect_tree(self.testbed)
+
+        # Not supported by the kernel
+        p = subprocess.run(shlex.split("%s deauthorize 0-1" % TBTADM),
+                           stderr = subprocess.PIPE)
+        self.assertNotEqual(p.returncode, 0)
+        self.assertTrue(b"De-authorization isn't supported" in p.stderr)
+
+        self.testbed.set_attribute(tree.syspath, 'deauthorization', '1')
+        output = subprocess.check_output(
+            shlex.split("%s deauthorize 0-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        summary = output[output.index('Summary:'):]
+        self.assertTrue(re.search(r'0-301 +de-authorized +[0-9.]+ ms',
+                                  summary))
+        self.assertTrue(re.search(r'0-1 +de-authorized', summary))
+        self.assertFalse('0-3 ' in summary)
+        for device in [device1, device2]:
+            self.assertEqual(
+                self.testbed.get_sysfs_attr(device.syspath, 'authorized'), '0')
+        self.assertEqual(
+            self.testbed.get_sysfs_attr(device3.syspath, 'authorized'), '1')
+
+        # A domain with no support is reported, the others are handled
+        device4 = TbDevice('1-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           authorized = 1)
+        tree1 = TbDomain(security = TbDomain.SECURITY_USER, index = 1,
+                         host = TbHost([device4], index = 1))
+        tree1.connect_tree(self.testbed)
+        p = subprocess.run(shlex.split("%s deauthorize-all" % TBTADM),
+                           stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+        output = p.stdout.decode("utf-8")
+        log.debug(output)
+        log.debug(p.stderr)
+        self.assertNotEqual(p.returncode, 0)
+        self.assertTrue(b"De-authorization isn't supported by domain1, "
+                        b"skipping it" in p.stderr)
+        self.assertTrue(b"1 of 2 domains don't support de-authorization"
+                        in p.stderr)
+        self.assertTrue(re.search(r'0-3 +de-authorized', output))
+        self.assertEqual(
+            self.testbed.get_sysfs_attr(device3.syspath, 'authorized'), '0')
+        self.assertEqual(
+            self.testbed.get_sysfs_attr(device4.syspath, 'authorized'), '1')
+
+        # disconnect all devices
+        tree1.disconnect(self.testbed)
+        tree.disconnect(self.testbed)
+
+    # Test tbtacl event coalescing and rate limiting
+    def test_tbtacl_coalescing(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+        device = tree.children[0].children[0]
+        devpath = device.syspath[len(self.testbed.get_sys_dir()):]
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+
+        # A storm of events for the same device authorizes it once
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        procs = [subprocess.Popen([TBTACL, 'add', devpath]) for _ in range(8)]
+        for proc in procs:
+            proc.wait()
+        self.assertEqual(self.get_authorized(), "Yes")
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertTrue('thunderbolt_acl_events_total{action="add",'
+                        'outcome="authorized"} 1' in metrics)
+
+        # A device that keeps reconnecting isn't rate-limited...
+        for _ in range(6):
+            self.forget_connections()
+            self.testbed.set_attribute(device.syspath, 'authorized', '0')
+            subprocess.check_call([TBTACL, 'add', devpath])
+            self.assertEqual(self.get_authorized(), "Yes")
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertFalse('rate_limited' in metrics)
+
+        # ...one that keeps failing is (no key to authorize it with in SL2)
+        tree.testbed.set_attribute(tree.syspath, "security",
+                                   tree.SECURITY_SECURE)
+        os.remove(os.path.join(device.syspath, 'key'))
+        for _ in range(6):
+            self.forget_connections()
+            self.testbed.set_attribute(device.syspath, 'authorized', '0')
+            subprocess.call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "No")
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertTrue('thunderbolt_acl_events_total{action="add",'
+                        'outcome="failed"} 5' in metrics)
+        self.assertTrue('thunderbolt_acl_events_total{action="add",'
+                        'outcome="rate_limited"} 1' in metrics)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test that tbtacl authorizes a device once per connection
+    def test_tbtacl_once_per_connection(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+        device = tree.children[0].children[0]
+        devpath = device.syspath[len(self.testbed.get_sys_dir()):]
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+
+        # Deauthorized on purpose: not undone by a later event
+        self.testbed.set_attribute(device.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "No")
+        with open(METRICS) as f:
+            metrics = f.read()
+        log.debug(metrics)
+        self.assertTrue('thunderbolt_acl_events_total{action="add",'
+                        'outcome="duplicate"} 1' in metrics)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test topology snapshots and the diff against them
+    def test_tbtadm_topology_diff(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", tree.SECURITY_USER)
+
+        snapshot = os.path.join(tempfile.mkdtemp(), "topology")
+        subprocess.check_call(shlex.split("%s topology --save %s"
+                                          % (TBTADM, snapshot)))
+        output = subprocess.check_output(shlex.split(
+            "%s topology --diff %s" % (TBTADM, snapshot))).decode("utf-8")
+        self.assertEqual(output, "No changes\n")
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        output = subprocess.check_output(shlex.split(
+            "%s topology --diff %s" % (TBTADM, snapshot))).decode("utf-8")
+        log.debug(output)
+        self.assertTrue("changed" in output)
+        self.assertTrue("authorized: No -> Yes" in output)
+        self.assertTrue(self.get_uuid() in output)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+        shutil.rmtree(os.path.dirname(snapshot))
+
+    # Test topology limited to a subtree and a depth
+    def test_tbtadm_topology_scope(self):
+        device2 = TbDevice('0-301', device_name = DEVICE_NAME, vendor = VENDOR)
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           children = [device2])
+        device3 = TbDevice('0-3', device_name = DEVICE_NAME, vendor = VENDOR)
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1, device3]))
+        tree.connect_tree(self.testbed)
+
+        output = subprocess.check_output(shlex.split(
+            "%s topology --depth 1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue("Route-string: 0-1\n" in output)
+        self.assertTrue("Route-string: 0-3\n" in output)
+        self.assertFalse(device2.unique_id in output)
+
+        output = subprocess.check_output(shlex.split(
+            "%s topology --root 0-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue(device1.unique_id in output)
+        self.assertTrue(device2.unique_id in output)
+        self.assertFalse(device3.unique_id in output)
+
+        output = subprocess.check_output(shlex.split(
+            "%s topology --domain 1" % TBTADM)).decode("utf-8")
+        self.assertFalse("Controller 0" in output)
+
+        # Only a plain number is a depth
+        for depth in ['-1', '3x', '']:
+            output = subprocess.run([TBTADM, 'topology', '--depth', depth],
+                                    stdout=subprocess.PIPE,
+                                    stderr=subprocess.STDOUT).stdout
+            self.assertTrue(b"Usage:" in output)
+
+        # The domain of the root may have more than one digit
+        device10 = TbDevice('10-1', device_name = DEVICE_NAME,
+                            vendor = VENDOR)
+        tree10 = TbDomain(security = TbDomain.SECURITY_USER, index = 10,
+                          host = TbHost([device10], index = 10))
+        tree10.connect_tree(self.testbed)
+        output = subprocess.check_output(shlex.split(
+            "%s topology --root 10-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue(device10.unique_id in output)
+        self.assertFalse(device1.unique_id in output)
+
+        # disconnect all devices
+        tree10.disconnect(self.testbed)
+        tree.disconnect(self.testbed)
+
+    # Test capturing the state and recreating it as a mock tree
+    def test_tbtadm_capture(self):
+        device2 = TbDevice('0-301', device_name = DEVICE_NAME, vendor = VENDOR)
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           children = [device2])
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1]))
+        tree.connect_tree(self.testbed)
+        self.testbed.set_attribute(device1.syspath, 'key', 'secret')
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        before = subprocess.check_output(shlex.split(
+            "%s topology" % TBTADM)).decode("utf-8")
+
+        capture = os.path.join(tempfile.mkdtemp(), "capture")
+        subprocess.check_output(shlex.split("%s capture %s"
+                                            % (TBTADM, capture)))
+        with open(capture) as f:
+            content = f.read()
+        log.debug(content)
+        self.assertFalse("secret" in content)
+
+        tree.disconnect(self.testbed)
+        subprocess.check_output(shlex.split("%s remove-all" % TBTADM))
+
+        captured = CapturedTree(capture)
+        captured.connect(self.testbed)
+        captured.restore_acl(ACL)
+        after = subprocess.check_output(shlex.split(
+            "%s topology" % TBTADM)).decode("utf-8")
+        self.assertEqual(before, after)
+
+        captured.disconnect(self.testbed)
+
+        # Only a plain number is a duration
+        for seconds in ['-1', 'x']:
+            output = subprocess.run([TBTADM, 'capture', '--events', seconds,
+                                     capture],
+                                    stdout=subprocess.PIPE,
+                                    stderr=subprocess.STDOUT).stdout
+            self.assertTrue(b"Usage:" in output)
+        shutil.rmtree(os.path.dirname(capture))
+
+    # Test auto-approval by policy rules
+    def test_tbtacl_policy(self):
+        device2 = TbDevice('0-301', device_name = "Disk", vendor = VENDOR)
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR,
+                           children = [device2])
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1]))
+        tree.connect_tree(self.testbed)
+
+        os.makedirs(os.path.dirname(POLICY), exist_ok=True)
+        with open(POLICY, 'w') as f:
+            f.write('# test policy\n'
+                    'deny device-name=Disk\n'
+                    'allow vendor-name="%s" max-depth=1\n' % VENDOR)
+
+        output = subprocess.check_output(shlex.split(
+            "%s policy test 0-1" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue("Allowed by policy line 3" in output)
+        output = subprocess.check_output(shlex.split(
+            "%s policy test 0-301" % TBTADM)).decode("utf-8")
+        self.assertTrue("Denied by policy line 2" in output)
+
+        # Authorized by policy, without an ACL entry
+        devpath = device1.syspath[len(self.testbed.get_sys_dir()):]
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+        self.assertFalse(os.path.isdir(os.path.join(ACL, device1.unique_id)))
+
+        devpath = device2.syspath[len(self.testbed.get_sys_dir()):]
+        subprocess.call([TBTACL, 'add', devpath])
+        with open(device2.authorized_file) as f:
+            self.assertEqual(f.read().strip(), "0")
+
+        # In SL2 only a rule that says security=secure authorizes, keyless
+        devpath = device1.syspath[len(self.testbed.get_sys_dir()):]
+        tree.testbed.set_attribute(tree.syspath, "security",
+                                   tree.SECURITY_SECURE)
+        self.forget_connections()
+        self.testbed.set_attribute(device1.syspath, 'authorized', '0')
+        subprocess.call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "No")
+        output = subprocess.check_output(shlex.split(
+            "%s policy test 0-1" % TBTADM)).decode("utf-8")
+        self.assertTrue("Not applied" in output)
+
+        with open(POLICY, 'w') as f:
+            f.write('allow vendor-name="%s" security=secure\n' % VENDOR)
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+
+        # A malformed policy doesn't stop the ACL-based authorization
+        tree.testbed.set_attribute(tree.syspath, "security",
+                                   tree.SECURITY_USER)
+        subprocess.check_output(shlex.split("%s add 0-1" % TBTADM))
+        with open(POLICY, 'w') as f:
+            f.write('bogus\n')
+        self.forget_connections()
+        self.testbed.set_attribute(device1.syspath, 'authorized', '0')
+        subprocess.check_call([TBTACL, 'add', devpath])
+        self.assertEqual(self.get_authorized(), "Yes")
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test that unexpected attribute values are reported, not crashed on
+    def test_tbtadm_unexpected_attribute(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        tree.testbed.set_attribute(tree.syspath, "security", "bogus")
+
+        proc = subprocess.run(shlex.split("%s topology" % TBTADM),
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        self.assertNotEqual(proc.returncode, 0)
+        self.assertTrue(b"Unexpected value of security: bogus" in proc.stderr)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test filtering the devices and the ACL
+    def test_tbtadm_filter(self):
+        device1 = TbDevice('0-1', device_name = DEVICE_NAME, vendor = VENDOR)
+        device3 = TbDevice('0-3', device_name = DEVICE_NAME, vendor = "Other",
+                           authorized = 1)
+        tree = TbDomain(security = TbDomain.SECURITY_USER,
+                        host = TbHost([device1, device3]))
+        tree.connect_tree(self.testbed)
+
+        output = subprocess.check_output(shlex.split(
+            "%s devices --filter unauthorized" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue("0-1" in output)
+        self.assertFalse("0-3" in output)
+
+        output = subprocess.check_output(shlex.split(
+            "%s devices --filter vendor=other --filter authorized"
+            % TBTADM)).decode("utf-8")
+        self.assertTrue("0-3" in output)
+        self.assertFalse("0-1" in output)
+
+        output = subprocess.check_output(shlex.split(
+            "%s devices --filter domain=1" % TBTADM)).decode("utf-8")
+        self.assertEqual(output.strip(), "")
+
+        subprocess.check_output(shlex.split("%s add 0-3" % TBTADM))
+        output = subprocess.check_output(shlex.split(
+            "%s devices --filter not-in-acl" % TBTADM)).decode("utf-8")
+        self.assertTrue("0-1" in output)
+        self.assertFalse("0-3" in output)
+
+        output = subprocess.check_output(shlex.split(
+            "%s acl --filter connected --filter domain=0"
+            % TBTADM)).decode("utf-8")
+        self.assertTrue(device3.unique_id in output)
+        output = subprocess.check_output(shlex.split(
+            "%s acl --filter not-connected" % TBTADM)).decode("utf-8")
+        self.assertFalse(device3.unique_id in output)
+
+        proc = subprocess.run(
+            shlex.split("%s devices --filter bogus" % TBTADM),
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        self.assertNotEqual(proc.returncode, 0)
+        self.assertTrue(b"Unknown filter: bogus" in proc.stderr)
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test approving a device that is gone by then
+    def test_tbtadm_approve_disconnected(self):
+        tree = self.default_mock_tree()
+        tree.connect_tree(self.testbed)
+        device = tree.first(lambda d: d.name == '0-1')
+        device.disconnect(self.testbed)
+
+        proc = subprocess.run(shlex.split("%s approve 0-1" % TBTADM),
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        self.assertNotEqual(proc.returncode, 0)
+        self.assertTrue(b"0-1 was disconnected" in proc.stderr)
+        self.assertFalse(os.path.isdir(os.path.join(ACL, device.unique_id)))
+
+        # disconnect all devices
+        tree.children[0].children = []
+        tree.disconnect(self.testbed)
+
+    # Test the alignment of the list commands and their --unaligned output
+    def test_tbtadm_table(self):
+        tree = TbDomain(host=TbHost([
+            TbDevice('0-1', device_name=DEVICE_NAME, vendor=VENDOR),
+            TbDevice('0-3', device_name='Dock', vendor='Ünïcödé Vendor',
+                     authorized=1)]))
+        tree.connect_tree(self.testbed)
+
+        output = subprocess.check_output(
+            shlex.split("%s devices" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        lines = output.splitlines()
+        self.assertEqual(len(lines), 2)
+        self.assertFalse('\x1b' in output)
+        # Every column starts at the same character in all the rows, also
+        # after a name with non-ASCII characters
+        starts = [[m.start() for m in re.finditer(r'(?<=  )\S', line)]
+                  for line in lines]
+        self.assertEqual(len(starts[0]), 4)
+        self.assertEqual(starts[0], starts[1])
+
+        output = subprocess.check_output(
+            shlex.split("%s devices --unaligned" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        rows = sorted(line.split('\t') for line in output.splitlines())
+        self.assertEqual(rows, [
+            ['0-1', VENDOR, DEVICE_NAME, 'non-authorized', 'not in ACL'],
+            ['0-3', 'Ünïcödé Vendor', 'Dock', 'authorized', 'not in ACL']])
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test the parallel approve-all: domains in parallel, at most two
+    # authorizations per domain, and children only after their parent
+    def test_tbtadm_approve_all_parallel(self):
+        tree0 = TbDomain(host=TbHost([
+            TbDevice('0-1', children=[TbDevice('0-101')]),
+            TbDevice('0-2'),
+            TbDevice('0-3')]))
+        tree1 = TbDomain(index=1, host=TbHost([
+            TbDevice('1-1', children=[TbDevice('1-101')]),
+            TbDevice('1-2'),
+            TbDevice('1-3')], index=1))
+        tree0.connect_tree(self.testbed)
+        tree1.connect_tree(self.testbed)
+        devices = {d.name: d for d in tree0.devices + tree1.devices}
+
+        # Writing the key blocks until it's read here, so the authorizations
+        # in flight can be counted
+        blocking = ['0-1', '0-2', '0-3', '1-2', '1-3']
+        for name in blocking:
+            key = os.path.join(devices[name].syspath, 'key')
+            os.remove(key)
+            os.mkfifo(key)
+        # ...and 1-1 fails, so its child must be skipped
+        authorized = devices['1-1'].authorized_file
+        os.remove(authorized)
+        os.mkdir(authorized)
+
+        proc = subprocess.Popen(shlex.split("%s approve-all" % TBTADM),
+                                stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE)
+
+        # The main thread and two workers per domain
+        def threads():
+            with open('/proc/%d/status' % proc.pid) as f:
+                return int(re.search(r'^Threads:\s+(\d+)$', f.read(),
+                                     re.M).group(1))
+        deadline = time.monotonic() + 10
+        while threads() < 5 and time.monotonic() < deadline:
+            time.sleep(0.05)
+        time.sleep(0.2)
+        self.assertEqual(threads(), 5)
+
+        keys = {}
+        def read_key(name):
+            with open(os.path.join(devices[name].syspath, 'key')) as f:
+                keys[name] = f.read()
+        readers = [threading.Thread(target=read_key, args=(name,))
+                   for name in blocking]
+        for reader in readers:
+            reader.start()
+        for reader in readers:
+            reader.join()
+        out, err = proc.communicate()
+        log.debug(out)
+        log.debug(err)
+
+        self.assertNotEqual(proc.returncode, 0)
+        self.assertTrue(b"2 of 8 devices weren't authorized" in err)
+        self.assertTrue(b"skipped: depends on 1-1, which failed" in out)
+        for name in blocking + ['0-101']:
+            device = devices[name]
+            self.assertEqual(
+                self.testbed.get_sysfs_attr(device.syspath, 'authorized'),
+                '1')
+            key = keys.get(name) or self.testbed.get_sysfs_attr(
+                device.syspath, 'key')
+            with open(os.path.join(ACL, device.unique_id, 'key')) as f:
+                self.assertEqual(f.read(), key)
+        self.assertEqual(
+            self.testbed.get_sysfs_attr(devices['1-101'].syspath,
+                                        'authorized'), '0')
+
+        # disconnect all devices
+        tree0.disconnect(self.testbed)
+        tree1.disconnect(self.testbed)
+
+    # Test devices --no-wake, which reads a suspended domain as usual since the
+    # attributes listed don't wake it up, and the state saved by tbtacl
+    def test_tbtadm_devices_no_wake(self):
+        tree = TbDomain(security=TbDomain.SECURITY_USER, host=TbHost([
+            TbDevice('0-1', device_name=DEVICE_NAME, vendor=VENDOR),
+            TbDevice('0-3')]))
+        tree.connect_tree(self.testbed)
+        device3 = tree.first(lambda d: d.name == '0-3')
+        devpath = device3.syspath[len(self.testbed.get_sys_dir()):]
+
+        subprocess.check_output(shlex.split("%s approve 0-1" % TBTADM))
+        subprocess.check_output(shlex.split("%s add 0-3" % TBTADM))
+        os.makedirs(os.path.join(tree.syspath, 'power'), exist_ok=True)
+        self.testbed.set_attribute(tree.syspath, 'power/runtime_status',
+                                   'suspended')
+        output = subprocess.check_output(
+            shlex.split("%s devices --no-wake" % TBTADM)).decode("utf-8")
+        log.debug(output)
+        self.assertTrue(re.search(r'^0-1 .*%s .*authorized ' % DEVICE_NAME,
+                                  output, re.M))
+        self.assertTrue(re.search(r'^0-3 .*Thunderbolt 0-3 .*non-authorized ',
+                                  output, re.M))
+        self.assertFalse("(cached)" in output or "suspended" in output)
+
+        # A device authorized by tbtacl is saved
+        os.remove(DEVICE_CACHE)
+        subprocess.check_call([TBTACL, 'add', devpath])
+        with open(DEVICE_CACHE) as f:
+            cache = f.read()
+        log.debug(cache)
+        self.assertTrue(re.search(r'^0-3\t', cache, re.M))
+
+        # disconnect all devices
+        tree.disconnect(self.testbed)
+
+    # Test the scans of an ACL that takes many getdents64() calls to read,
+    # with hidden entries and stray files that must be skipped
+    def test_tbtadm_acl_scan(self):
+        # Starting with decimal digits, like a route-string
+        digits = '12345678-1234-4234-8234-123456789abc'
+        uuids = sorted([digits] + [str(uuid.uuid4()) for _ in range(1499)])
+        for entry in uuids:
+            os.makedirs(os.path.join(ACL, entry))
+            for name, value in [('vendor_name', VENDOR),
+                                ('device_name', DEVICE_NAME)]:
+                with open(os.path.join(ACL, entry, name), 'w') as f:
+                    f.write(value + '\n')
+        os.makedirs(os.path.join(ACL, '.hidden'))
+        with open(os.path.join(ACL, 'stray'), 'w') as f:
+            f.write('\n')
+
+        output = subprocess.check_output(
+            shlex.split("%s acl --unaligned" % TBTADM)).decode("utf-8")
+        listed = sorted(line.split('\t')[0] for line in output.splitlines()
+                        if '\t' in line)
+        self.assertEqual(listed, uuids)
+
+        output = subprocess.check_output(
+            shlex.split("%s remove %s" % (TBTADM, digits)))
+        self.assertFalse(b"ACL entry doesn't exist" in output)
+        self.assertFalse(os.path.exists(os.path.join(ACL, digits)))
+        output = subprocess.check_output(
+            shlex.split("%s remove %s" % (TBTADM, digits)))
+        self.assertTrue(b"ACL entry doesn't exist" in output)
+
+        output = subprocess.check_output(
+            shlex.split("%s remove-all" % TBTADM))
+        self.assertTrue(b"1499 entries removed" in output)
+        output = subprocess.check_output(
+            shlex.split("%s remove-all" % TBTADM))
+        self.assertTrue(b"ACL is empty" in output)
+
     # Test multi - controller device tree
     def test_x(self):
         # connect all device